@@ -1,22 +1,64 @@
 #include <getopt.h>
 #include <cstdlib>
 #include <climits>
+#include <fstream>
 #include <spdlog/spdlog.h>
+#include <spdlog/async.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include "server.h"
 #include "Application.h"
+#include "TraceLog.h"
+#include "Realtime.h"
+#include "SpiFlash.h"
+#include "SvfPlayer.h"
+#include "SelfTest.h"
 
 
 Application::Application(const int argc, char **argv) {
     scanArguments(argc, argv);
-    server = std::make_unique<Server>();
+    setupLogging();
+    if (!Config::get()->localMode()) {
+        server = std::make_unique<Server>();
+    }
+}
+
+void Application::setupLogging() {
+    const auto config = Config::get();
+
+    spdlog::init_thread_pool(8192, 1);
+    spdlog::set_default_logger(spdlog::create_async<spdlog::sinks::stdout_color_sink_mt>("xvcnd"));
+
+    const bool dumping = config->flags->showUSB || config->flags->showXVC;
+    spdlog::set_level(dumping ? spdlog::level::debug : spdlog::level::info);
 
-    spdlog::set_level(spdlog::level::debug);
+    // Drain the trace and the async logger on every exit path, including std::exit()
+    TraceLog::get();
+    std::atexit([] {
+        TraceLog::get().stop();
+        spdlog::shutdown();
+    });
+
+    if (!config->traceFile.empty()) {
+        if (!TraceLog::get().open(config->traceFile)) {
+            std::exit(EXIT_FAILURE);
+        }
+        if (!dumping) {
+            spdlog::warn("Trace file given without -U or -X, nothing will be recorded.");
+        }
+    } else if (dumping && SPDLOG_ACTIVE_LEVEL > SPDLOG_LEVEL_DEBUG) {
+        spdlog::warn("Hex dumps are compiled out of this build, use -T file to record a binary trace.");
+    }
 }
 
 [[noreturn]] void Application::usage(const std::string &name) {
     spdlog::error("Usage: {} [-a address] [-p port] "
-                  "[-d vendor:product[:[serial]]] [-g direction_value[:direction_value...]] "
-                  "[-c frequency] [-q] [-B] [-L] [-R] [-S] [-U] [-X]", name);
+                  "[-d vendor:product[:[serial]]] [-g gpio_step[:gpio_step...]] "
+                  "[-c frequency] [-T tracefile] [-q] [-B] [-E] [-L] [-R] [-S] [-U] [-X] "
+                  "[-l] [--protocol-cpu n] [--usb-cpu n] [--rt-priority n] [--mlock] [--busy-poll usec] [--latency-timer ms] [--shift-threads n] "
+                  "[--scan-cache ms] [--scan-cache-ir hex/len[,hex/len...]] [--scan-bridge hex/len] "
+                  "[--spi-flash id|erase:addr:len|write:file[@addr]|verify:file[@addr]|read:file@addr:len] [--svf file.svf|file.xsvf] [--self-test] "
+                  "[--mpsse-token tokenfile] [--broadcast serial[,serial...]] [--relay host:port] [--bitbang host:port] [--mmio path[@offset]] [--broker | --register host:port] "
+                  "[--pin-sampler port|ringfile [--pin-edges]]", name);
     std::exit(EXIT_FAILURE);
 }
 
@@ -30,6 +72,17 @@ int Application::convertInt(const std::string &str) {
     return static_cast<int>(v);
 }
 
+// Read from a file so the secret does not show up in the process list
+std::string Application::readToken(const std::string &path) {
+    std::ifstream file(path);
+    std::string token;
+    if (!file || !std::getline(file, token) || token.empty()) {
+        spdlog::error("Can't read MPSSE token from \"{}\"", path);
+        std::exit(EXIT_FAILURE);
+    }
+    return token;
+}
+
 unsigned int Application::parseFrequency(const std::string_view str) const {
     char *endp;
     double frequency = std::strtod(str.data(), &endp);
@@ -77,9 +130,37 @@ std::tuple<unsigned long, unsigned long, std::string> Application::parseDeviceCo
 }
 
 void Application::scanArguments(const int argc, char **argv) const {
+    static constexpr option longOptions[] = {
+        {"low-latency", no_argument, nullptr, 'l'},
+        {"protocol-cpu", required_argument, nullptr, OPT_PROTOCOL_CPU},
+        {"usb-cpu", required_argument, nullptr, OPT_USB_CPU},
+        {"rt-priority", required_argument, nullptr, OPT_RT_PRIORITY},
+        {"mlock", no_argument, nullptr, OPT_MLOCK},
+        {"busy-poll", required_argument, nullptr, OPT_BUSY_POLL},
+        {"latency-timer", required_argument, nullptr, OPT_LATENCY_TIMER},
+        {"shift-threads", required_argument, nullptr, OPT_SHIFT_THREADS},
+        {"scan-cache", required_argument, nullptr, OPT_SCAN_CACHE},
+        {"scan-cache-ir", required_argument, nullptr, OPT_SCAN_CACHE_IR},
+        {"scan-bridge", required_argument, nullptr, OPT_SCAN_BRIDGE},
+        {"spi-flash", required_argument, nullptr, OPT_SPI_FLASH},
+        {"svf", required_argument, nullptr, OPT_SVF},
+        {"mpsse-token", required_argument, nullptr, OPT_MPSSE_TOKEN},
+        {"broadcast", required_argument, nullptr, OPT_BROADCAST},
+        {"self-test", no_argument, nullptr, OPT_SELF_TEST},
+        {"relay", required_argument, nullptr, OPT_RELAY},
+        {"bitbang", required_argument, nullptr, OPT_BITBANG},
+        {"mmio", required_argument, nullptr, OPT_MMIO},
+        {"broker", no_argument, nullptr, OPT_BROKER},
+        {"register", required_argument, nullptr, OPT_REGISTER},
+        {"pin-sampler", required_argument, nullptr, OPT_PIN_SAMPLER},
+        {"pin-edges", no_argument, nullptr, OPT_PIN_EDGES},
+        {"extensions", no_argument, nullptr, 'E'},
+        {nullptr, 0, nullptr, 0}
+    };
+
     auto config = Config::get();
     int option;
-    while ((option = getopt(argc, argv, "a:b:c:d:x:u:g:hp:qBLRSUX")) != -1) {
+    while ((option = getopt_long(argc, argv, "a:b:c:d:x:u:g:hlp:qBELRST:UX", longOptions, nullptr)) != -1) {
         switch (option) {
             case 'a': {
                 config->bindAddress = optarg;
@@ -103,6 +184,11 @@ void Application::scanArguments(const int argc, char **argv) const {
             case 'h': {
                 usage(argv[0]);
             }
+            case 'l': {
+                config->lockMemory = true;
+                config->busyPollUsec = DEFAULT_BUSY_POLL_USEC;
+            }
+            break;
             case 'p': {
                 config->port = convertInt(optarg);
             }
@@ -126,6 +212,10 @@ void Application::scanArguments(const int argc, char **argv) const {
                 config->jtagIndex = 2;
             }
             break;
+            case 'E': {
+                config->protocolExtensions = true;
+            }
+            break;
             case 'L': {
                 config->flags->loopback = true;
             }
@@ -138,6 +228,119 @@ void Application::scanArguments(const int argc, char **argv) const {
                 config->flags->statisticsFlag = true;
             }
             break;
+            case 'T': {
+                config->traceFile = optarg;
+            }
+            break;
+            case OPT_PROTOCOL_CPU: {
+                config->protocolCpu = convertInt(optarg);
+            }
+            break;
+            case OPT_USB_CPU: {
+                config->usbCpu = convertInt(optarg);
+            }
+            break;
+            case OPT_RT_PRIORITY: {
+                config->realtimePriority = convertInt(optarg);
+            }
+            break;
+            case OPT_MLOCK: {
+                config->lockMemory = true;
+            }
+            break;
+            case OPT_BUSY_POLL: {
+                config->busyPollUsec = convertInt(optarg);
+            }
+            break;
+            case OPT_LATENCY_TIMER: {
+                config->latencyTimer = convertInt(optarg);
+                if (config->latencyTimer < 1 || config->latencyTimer > 255) {
+                    spdlog::error("Latency timer must be 1 to 255 ms");
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+            break;
+            case OPT_SHIFT_THREADS: {
+                config->shiftThreads = convertInt(optarg);
+                if (config->shiftThreads < 0 || config->shiftThreads > 64) {
+                    spdlog::error("Shift threads must be 0 to 64");
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+            break;
+            case OPT_SCAN_CACHE: {
+                config->scanCacheMs = convertInt(optarg);
+            }
+            break;
+            case OPT_SCAN_CACHE_IR: {
+                config->scanCacheInstructions = optarg;
+            }
+            break;
+            case OPT_SCAN_BRIDGE: {
+                char end;
+                if (std::sscanf(optarg, "%x/%u%c", &config->bridgeInstruction, &config->bridgeIrLength, &end) != 2 ||
+                    config->bridgeIrLength == 0 || config->bridgeIrLength > 32) {
+                    spdlog::error("Bad --scan-bridge \"{}\", expected hex/length", optarg);
+                    std::exit(EXIT_FAILURE);
+                }
+            }
+            break;
+            case OPT_SPI_FLASH: {
+                config->spiFlashCommand = optarg;
+            }
+            break;
+            case OPT_SVF: {
+                config->svfFile = optarg;
+            }
+            break;
+            case OPT_SELF_TEST: {
+                config->selfTest = true;
+            }
+            break;
+            case OPT_RELAY: {
+                config->relayAddress = optarg;
+            }
+            break;
+            case OPT_BITBANG: {
+                config->bitbangAddress = optarg;
+            }
+            break;
+            case OPT_MMIO: {
+                config->mmioPath = optarg;
+            }
+            break;
+            case OPT_BROKER: {
+                config->broker = true;
+            }
+            break;
+            case OPT_REGISTER: {
+                config->brokerAddress = optarg;
+            }
+            break;
+            case OPT_PIN_SAMPLER: {
+                config->pinSampler = optarg;
+            }
+            break;
+            case OPT_PIN_EDGES: {
+                config->pinEdges = true;
+            }
+            break;
+            case OPT_MPSSE_TOKEN: {
+                config->mpsseToken = readToken(optarg);
+            }
+            break;
+            case OPT_BROADCAST: {
+                const std::string_view serials = optarg;
+                size_t pos = 0;
+                while (pos <= serials.size()) {
+                    const size_t comma = std::min(serials.find(',', pos), serials.size());
+                    if (comma > pos) {
+                        config->broadcastSerials.emplace_back(serials.substr(pos, comma - pos));
+                    }
+                    pos = comma + 1;
+                }
+            }
+            break;
             default:
                 usage(argv[0]);
         }
@@ -147,8 +350,50 @@ void Application::scanArguments(const int argc, char **argv) const {
         spdlog::error("Unexpected argument: {}", argv[optind]);
         usage(argv[0]);
     }
+    // Busy-poll reaps USB completions on the protocol thread; there is no USB thread to place
+    if (config->busyPollUsec > 0 && config->usbCpu >= 0) {
+        spdlog::error("--usb-cpu has no effect with --busy-poll, USB is polled on the --protocol-cpu thread");
+        std::exit(EXIT_FAILURE);
+    }
+    if (!config->pinSampler.empty() && config->adapterless()) {
+        spdlog::error("--pin-sampler needs an adapter");
+        std::exit(EXIT_FAILURE);
+    }
 }
 
 [[noreturn]] void Application::start() const {
+    const auto config = Config::get();
+    if (config->localMode()) {
+        runLocal(*config);
+    }
+
+    if (config->lockMemory) {
+        Realtime::lockMemory();
+    }
     server->start();
 }
+
+[[noreturn]] void Application::runLocal(const Config &config) {
+    // SVF playback into a simulator or debug bridge needs no adapter
+    const bool adapterless = config.adapterless() && !config.svfFile.empty();
+    const FTDI ftdi;
+    if (!adapterless && !ftdi.init()) {
+        std::exit(EXIT_FAILURE);
+    }
+
+    int result;
+    if (!config.spiFlashCommand.empty()) {
+        SpiFlash flash(ftdi);
+        result = flash.run(config.spiFlashCommand);
+    } else if (config.selfTest) {
+        SelfTest test(ftdi);
+        result = test.run();
+    } else if (const auto engine = ShiftEngine::create(ftdi)) {
+        SvfPlayer player(*engine);
+        result = player.playFile(config.svfFile);
+    } else {
+        result = 0;
+    }
+    ftdi.close();
+    std::exit(result ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -14,15 +14,49 @@ private:
     const std::string ERROR_BAD_DEVICE_CONFIG = "Bad -d vendor:product[:[serial]]";
     const std::string ERROR_BAD_CLOCK_FREQUENCY = "Bad clock frequency argument.";
 
+    static constexpr int DEFAULT_BUSY_POLL_USEC = 50;
+
+    // Long-only options
+    enum {
+        OPT_PROTOCOL_CPU = 256,
+        OPT_USB_CPU,
+        OPT_RT_PRIORITY,
+        OPT_MLOCK,
+        OPT_BUSY_POLL,
+        OPT_LATENCY_TIMER,
+        OPT_SCAN_CACHE,
+        OPT_SCAN_CACHE_IR,
+        OPT_SCAN_BRIDGE,
+        OPT_SHIFT_THREADS,
+        OPT_SPI_FLASH,
+        OPT_SVF,
+        OPT_MPSSE_TOKEN,
+        OPT_BROADCAST,
+        OPT_SELF_TEST,
+        OPT_RELAY,
+        OPT_BITBANG,
+        OPT_MMIO,
+        OPT_BROKER,
+        OPT_REGISTER,
+        OPT_PIN_SAMPLER,
+        OPT_PIN_EDGES,
+    };
+
     void scanArguments(int argc, char **argv) const;
 
+    static void setupLogging();
+
     [[nodiscard]] unsigned int parseFrequency(std::string_view str) const;
 
     [[nodiscard]] std::tuple<unsigned long, unsigned long, std::string> parseDeviceConfig(std::string_view str) const;
 
     [[noreturn]] static void usage(const std::string &name);
 
+    [[noreturn]] static void runLocal(const Config &config);
+
     static int convertInt(const std::string &str);
 
+    static std::string readToken(const std::string &path);
+
     std::unique_ptr<Server> server;
 };
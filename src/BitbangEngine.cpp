@@ -0,0 +1,113 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <spdlog/spdlog.h>
+#include "BitbangEngine.h"
+#include "misc.h"
+
+
+BitbangEngine::BitbangEngine(const std::string &address) {
+    if (!Misc::splitAddress(address, host, port)) {
+        spdlog::error(ERR_BAD_ADDRESS, address);
+        std::exit(EXIT_FAILURE);
+    }
+    message.reserve(3 * WINDOW_BITS);
+    response.resize(WINDOW_BITS);
+}
+
+BitbangEngine::~BitbangEngine() {
+    if (sock >= 0) {
+        (void) send(sock, &QUIT, 1, MSG_NOSIGNAL);
+        close(sock);
+    }
+}
+
+int BitbangEngine::open() {
+    sock = Misc::connectTcp(host, port);
+    if (sock < 0) {
+        return 0;
+    }
+    spdlog::info("Connected to simulator at {}:{}", host, port);
+    return 1;
+}
+
+/*
+ * TDI and TMS are set with TCK low, TDO is sampled before the rising
+ * edge, and the rising edge clocks the TAP.
+ */
+int BitbangEngine::shift(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                         unsigned char *tdo) {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t first = 0; first < shiftBits; first += WINDOW_BITS) {
+        const uint32_t count = std::min(WINDOW_BITS, shiftBits - first);
+        message.clear();
+        for (uint32_t i = first; i < first + count; i++) {
+            const char pins = static_cast<char>((ShiftPlanner::bit(tms, i) << 1) | ShiftPlanner::bit(tdi, i));
+            message.push_back(static_cast<char>('0' + pins));
+            message.push_back(READ_TDO);
+            message.push_back(static_cast<char>('4' + pins));
+        }
+        if (!exchange(count)) {
+            return 0;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            const char c = response[i];
+            if (c != '0' && c != '1') {
+                spdlog::error(ERR_BAD_TDO, static_cast<unsigned char>(c));
+                return 0;
+            }
+            const uint32_t at = first + i;
+            if (c == '1') {
+                tdo[at / 8] |= 1 << (at % 8);
+            } else {
+                tdo[at / 8] &= ~(1 << (at % 8));
+            }
+        }
+        chunkCount++;
+        wireBytes += message.size() + count;
+    }
+    wireBits += shiftBits;
+    busy += std::chrono::steady_clock::now() - start;
+    return 1;
+}
+
+int BitbangEngine::exchange(const uint32_t bits) {
+    const char *out = message.data();
+    size_t remaining = message.size();
+    while (remaining > 0) {
+        const ssize_t n = send(sock, out, remaining, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            spdlog::error(ERR_LOST);
+            return 0;
+        }
+        out += n;
+        remaining -= n;
+    }
+
+    char *in = response.data();
+    remaining = bits;
+    while (remaining > 0) {
+        const ssize_t n = recv(sock, in, remaining, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            spdlog::error(ERR_LOST);
+            return 0;
+        }
+        in += n;
+        remaining -= n;
+    }
+    return 1;
+}
+
+void BitbangEngine::printStatistic() const {
+    const double seconds = std::chrono::duration<double>(busy).count();
+    if (seconds > 0) {
+        spdlog::info("Simulated TCK: {:.0f}/s", wireBits / seconds);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "ShiftEngine.h"
+
+
+/*
+ * Drives a simulated JTAG TAP through OpenOCD's remote_bitbang protocol
+ * instead of an FTDI adapter, so XVC clients can attach to an RTL
+ * simulation. Every TCK costs three characters (falling edge, TDO read,
+ * rising edge); a whole window of them goes out in one write and its TDO
+ * characters are read back in one go, so the simulator services the
+ * socket once per window instead of once per bit.
+ */
+class BitbangEngine final : public ShiftEngine {
+public:
+    // host:port of the simulator's remote_bitbang server
+    explicit BitbangEngine(const std::string &address);
+
+    ~BitbangEngine() override;
+
+    [[nodiscard]] int open();
+
+    [[nodiscard]] int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo) override;
+
+    // The simulator runs TCK as fast as it can
+    [[nodiscard]] int setClock(unsigned int) override {
+        return 1;
+    }
+
+    void printStatistic() const override;
+
+private:
+    [[nodiscard]] int exchange(uint32_t bits);
+
+    std::string host;
+    std::string port;
+    int sock = -1;
+
+    std::vector<char> message;
+    std::vector<char> response;
+
+    std::chrono::steady_clock::duration busy{};
+
+    // TCKs per message; 48 KiB out, 16 KiB back
+    static constexpr uint32_t WINDOW_BITS = 16 * 1024;
+
+    static constexpr char READ_TDO = 'R';
+    static constexpr char QUIT = 'Q';
+
+    static constexpr std::string_view ERR_BAD_ADDRESS = "Bad --bitbang address \"{}\", expected host:port";
+    static constexpr std::string_view ERR_LOST = "Lost simulator connection";
+    static constexpr std::string_view ERR_BAD_TDO = "Simulator sent 0x{:02x} for a TDO read";
+};
@@ -0,0 +1,169 @@
+#include <bit>
+#include <spdlog/spdlog.h>
+#include "BroadcastEngine.h"
+#include "Realtime.h"
+
+
+BroadcastEngine::BroadcastEngine(const FTDI &primary, const std::vector<std::string> &serials):
+    primary(createLocal(primary)) {
+    for (const auto &serial: serials) {
+        auto replica = std::make_unique<Replica>();
+        replica->serial = serial;
+        replica->ftdi = std::make_unique<FTDI>(serial);
+        replicas.push_back(std::move(replica));
+    }
+}
+
+BroadcastEngine::~BroadcastEngine() {
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    started.notify_all();
+
+    for (const auto &replica: replicas) {
+        if (replica->thread.joinable()) {
+            replica->thread.join();
+        }
+        if (replica->mismatches) {
+            spdlog::warn("Replica {}: {} mismatching shifts", replica->serial, replica->mismatches);
+        }
+        replica->ftdi->close();
+    }
+}
+
+int BroadcastEngine::open() {
+    const auto config = Config::get();
+    for (const auto &replica: replicas) {
+        if (!replica->ftdi->init()) {
+            spdlog::error(ERR_REPLICA_INIT, replica->serial);
+            return 0;
+        }
+        replica->engine = createLocal(*replica->ftdi);
+        replica->alive = true;
+        replica->thread = std::thread(&BroadcastEngine::worker, this, std::ref(*replica));
+        Realtime::tuneThread(replica->thread.native_handle(), -1, config->realtimePriority, "replica");
+    }
+    spdlog::info("Broadcasting to {} replicas", replicas.size());
+    return 1;
+}
+
+/*
+ * Replicas shift straight from the caller's TMS/TDI; the caller holds them
+ * until every replica has reported back, so nothing is copied.
+ */
+void BroadcastEngine::worker(Replica &replica) {
+    while (true) {
+        uint32_t bits;
+        const unsigned char *tms;
+        const unsigned char *tdi;
+        unsigned int frequency;
+        {
+            std::unique_lock lock(mutex);
+            started.wait(lock, [&] { return stopping || generation != replica.generation; });
+            if (stopping || !replica.alive) {
+                return;
+            }
+            replica.generation = generation;
+            bits = jobBits;
+            tms = jobTms;
+            tdi = jobTdi;
+            frequency = jobFrequency;
+        }
+
+        int result;
+        if (frequency) {
+            result = replica.engine->setClock(frequency);
+        } else {
+            replica.tdo.resize((bits + 7) / 8);
+            result = replica.engine->shift(bits, tms, tdi, replica.tdo.data());
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            replica.result = result;
+            if (--outstanding == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+}
+
+int BroadcastEngine::shift(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                           unsigned char *tdo) {
+    size_t running = 0;
+    {
+        std::lock_guard lock(mutex);
+        for (const auto &replica: replicas) {
+            running += replica->alive;
+        }
+        jobBits = shiftBits;
+        jobTms = tms;
+        jobTdi = tdi;
+        jobFrequency = 0;
+        outstanding = running;
+        generation++;
+    }
+    started.notify_all();
+    shiftNumber++;
+
+    const int result = primary->shift(shiftBits, tms, tdi, tdo);
+
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [&] { return outstanding == 0; });
+    for (const auto &replica: replicas) {
+        if (!replica->alive) {
+            continue;
+        }
+        if (!replica->result) {
+            spdlog::error(ERR_REPLICA_FAILED, replica->serial);
+            replica->alive = false;
+            continue;
+        }
+        if (result) {
+            compare(*replica, shiftBits, tdo);
+        }
+    }
+    return result;
+}
+
+int BroadcastEngine::setClock(const unsigned int frequency) {
+    {
+        std::lock_guard lock(mutex);
+        size_t running = 0;
+        for (const auto &replica: replicas) {
+            running += replica->alive;
+        }
+        jobFrequency = frequency;
+        outstanding = running;
+        generation++;
+    }
+    started.notify_all();
+
+    const int result = primary->setClock(frequency);
+
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [&] { return outstanding == 0; });
+    for (const auto &replica: replicas) {
+        if (replica->alive && !replica->result) {
+            spdlog::error(ERR_REPLICA_FAILED, replica->serial);
+            replica->alive = false;
+        }
+    }
+    return result;
+}
+
+void BroadcastEngine::compare(Replica &replica, const uint32_t shiftBits, const unsigned char *tdo) const {
+    for (uint32_t i = 0; i < shiftBits; i += 8) {
+        unsigned char difference = replica.tdo[i / 8] ^ tdo[i / 8];
+        if (shiftBits - i < 8) {
+            difference &= (1 << (shiftBits - i)) - 1;
+        }
+        if (difference) {
+            if (replica.mismatches++ < MAX_MISMATCH_REPORTS) {
+                spdlog::warn(WARN_MISMATCH, replica.serial, shiftNumber, i + std::countr_zero(difference));
+            }
+            return;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ShiftEngine.h"
+
+
+/*
+ * Drives a primary adapter and a group of identical replicas in lock step.
+ * Every shift runs on all adapters at once, the replicas each on their own
+ * thread; the client sees the primary's TDO and replica TDO that differs is
+ * counted and logged. A replica that fails drops out and the rest carry on.
+ * Replicas are claimed once and kept for the life of the process.
+ */
+class BroadcastEngine final : public ShiftEngine {
+public:
+    BroadcastEngine(const FTDI &primary, const std::vector<std::string> &serials);
+
+    ~BroadcastEngine() override;
+
+    // Claims and initializes every replica
+    [[nodiscard]] int open();
+
+    using ShiftEngine::shift;
+
+    [[nodiscard]] int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo) override;
+
+    [[nodiscard]] int setClock(unsigned int frequency) override;
+
+    [[nodiscard]] unsigned int clockFrequency() const override {
+        return primary->clockFrequency();
+    }
+
+    [[nodiscard]] bool persistent() const override {
+        return true;
+    }
+
+private:
+    struct Replica {
+        std::string serial;
+        std::unique_ptr<FTDI> ftdi;
+        std::unique_ptr<ShiftEngine> engine;
+        std::thread thread;
+        std::vector<unsigned char> tdo;
+        uint64_t generation = 0;
+        uint64_t mismatches = 0;
+        int result = 1;
+        bool alive = false;
+    };
+
+    void worker(Replica &replica);
+
+    void compare(Replica &replica, uint32_t shiftBits, const unsigned char *tdo) const;
+
+    std::unique_ptr<ShiftEngine> primary;
+    std::vector<std::unique_ptr<Replica> > replicas;
+
+    // Current job, published under mutex and numbered by generation
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    uint64_t generation = 0;
+    size_t outstanding = 0;
+    bool stopping = false;
+    uint32_t jobBits = 0;
+    const unsigned char *jobTms = nullptr;
+    const unsigned char *jobTdi = nullptr;
+    unsigned int jobFrequency = 0;
+    uint64_t shiftNumber = 0;
+
+    static constexpr uint64_t MAX_MISMATCH_REPORTS = 10;
+
+    static constexpr std::string_view ERR_REPLICA_INIT = "Replica {} could not be initialized";
+    static constexpr std::string_view ERR_REPLICA_FAILED = "Replica {} failed, dropping it from the group";
+    static constexpr std::string_view WARN_MISMATCH = "Replica {} TDO differs from primary at shift {}, bit {}";
+};
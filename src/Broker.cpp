@@ -0,0 +1,228 @@
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <spdlog/spdlog.h>
+#include "Broker.h"
+#include "Config.h"
+#include "Realtime.h"
+#include "misc.h"
+
+
+void Broker::serve(const int fd, const std::string &peer) {
+    // Sessions end when either side goes; the broker lives as long as the process
+    std::thread(&Broker::session, this, fd, peer).detach();
+}
+
+void Broker::session(const int fd, const std::string &peer) {
+    Realtime::tuneSocket(fd, Config::get()->busyPollUsec);
+
+    std::string command;
+    if (!readUntil(fd, ':', 16, command)) {
+        close(fd);
+        return;
+    }
+    if (command == "register") {
+        registered(fd, peer);
+        close(fd);
+        return;
+    }
+    if (command == "boards") {
+        (void) list(fd);
+        close(fd);
+        return;
+    }
+
+    const bool claiming = command == "claim";
+    uint32_t idcode = 0;
+    std::string preamble;
+    if (claiming) {
+        unsigned char value[4];
+        if (recv(fd, value, sizeof(value), MSG_WAITALL) != sizeof(value)) {
+            close(fd);
+            return;
+        }
+        std::memcpy(&idcode, value, sizeof(idcode));
+    } else {
+        // Plain XVC: the command already read goes on to the board
+        preamble = command + ":";
+    }
+
+    uint32_t status;
+    auto instance = pick(idcode, status);
+    int board = -1;
+    if (instance) {
+        board = Misc::connectTcp(instance->host, instance->port);
+        if (board < 0) {
+            release(instance);
+            instance.reset();
+            status = CLAIM_ALL_BUSY;
+        }
+    }
+    if (!instance) {
+        spdlog::warn(ERR_NO_BOARD, peer, idcode);
+    }
+
+    if ((!claiming || reply32(fd, status)) && instance) {
+        spdlog::info("{} -> {}:{} ({})", peer, instance->host, instance->port, instance->serial);
+        proxy(fd, board, preamble);
+    }
+    if (instance) {
+        close(board);
+        release(instance);
+    }
+    close(fd);
+}
+
+// The registration stays for as long as the instance keeps its connection open
+void Broker::registered(const int fd, const std::string &peer) {
+    std::string line;
+    if (!readUntil(fd, '\n', MAX_LINE, line)) {
+        return;
+    }
+
+    auto instance = std::make_shared<Instance>();
+    instance->host = peer;
+    std::string idcodes;
+    if (std::istringstream fields(line); !(fields >> instance->port >> instance->serial >> idcodes)) {
+        spdlog::error(ERR_BAD_REGISTRATION, peer, line);
+        return;
+    }
+    std::istringstream codes(idcodes);
+    for (std::string idcode; std::getline(codes, idcode, ',');) {
+        if (idcode != "-") {
+            instance->idcodes.push_back(static_cast<uint32_t>(std::strtoul(idcode.c_str(), nullptr, 16)));
+        }
+    }
+
+    {
+        std::lock_guard guard(lock);
+        instances.push_back(instance);
+    }
+    spdlog::info("Registered {}:{} ({}) {}", instance->host, instance->port, instance->serial, idcodes);
+
+    while (readUntil(fd, '\n', MAX_LINE, line)) {
+        int busy;
+        double shiftsPerSecond, latencyUs;
+        if (std::sscanf(line.c_str(), "%d %lf %lf", &busy, &shiftsPerSecond, &latencyUs) != 3) {
+            spdlog::error(ERR_BAD_REGISTRATION, peer, line);
+            break;
+        }
+        std::lock_guard guard(lock);
+        instance->busy = busy;
+        instance->shiftsPerSecond = shiftsPerSecond;
+        instance->latencyUs = latencyUs;
+    }
+
+    {
+        std::lock_guard guard(lock);
+        std::erase(instances, instance);
+    }
+    spdlog::info("Unregistered {}:{}", instance->host, instance->port);
+}
+
+// Free boards only, least recent load first, then lowest latency, then least used
+std::shared_ptr<Broker::Instance> Broker::pick(const uint32_t idcode, uint32_t &status) {
+    std::lock_guard guard(lock);
+    std::shared_ptr<Instance> best;
+    bool matched = false;
+    for (const auto &instance: instances) {
+        if (idcode && std::ranges::none_of(instance->idcodes, [idcode](const uint32_t id) {
+            return ((id ^ idcode) & IDCODE_MASK) == 0;
+        })) {
+            continue;
+        }
+        matched = true;
+        if (instance->busy || instance->claimed) {
+            continue;
+        }
+        if (!best || std::tie(instance->shiftsPerSecond, instance->latencyUs, instance->claims) <
+                     std::tie(best->shiftsPerSecond, best->latencyUs, best->claims)) {
+            best = instance;
+        }
+    }
+
+    status = best ? CLAIM_OK : matched ? CLAIM_ALL_BUSY : CLAIM_NO_MATCH;
+    if (best) {
+        best->claimed = true;
+        best->claims++;
+    }
+    return best;
+}
+
+void Broker::release(const std::shared_ptr<Instance> &instance) {
+    std::lock_guard guard(lock);
+    instance->claimed = false;
+}
+
+void Broker::proxy(const int client, const int board, const std::string &preamble) {
+    if (!preamble.empty() &&
+        send(board, preamble.data(), preamble.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(preamble.size())) {
+        return;
+    }
+
+    std::vector<char> buffer(PROXY_BUFFER_SIZE);
+    pollfd fds[2] = {{client, POLLIN, 0}, {board, POLLIN, 0}};
+    while (poll(fds, 2, -1) > 0) {
+        for (int i = 0; i < 2; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+            const ssize_t n = recv(fds[i].fd, buffer.data(), buffer.size(), 0);
+            if (n <= 0) {
+                return;
+            }
+            for (ssize_t sent = 0; sent < n;) {
+                const ssize_t m = send(fds[1 - i].fd, buffer.data() + sent, n - sent, MSG_NOSIGNAL);
+                if (m <= 0) {
+                    return;
+                }
+                sent += m;
+            }
+        }
+    }
+}
+
+// host:port serial idcodes free|busy shifts/s latency_us
+bool Broker::list(const int fd) {
+    std::string text;
+    {
+        std::lock_guard guard(lock);
+        for (const auto &instance: instances) {
+            std::string idcodes;
+            for (const auto idcode: instance->idcodes) {
+                idcodes += std::format("{}{:08x}", idcodes.empty() ? "" : ",", idcode);
+            }
+            text += std::format("{}:{} {} {} {} {:.0f} {:.1f}\n", instance->host, instance->port, instance->serial,
+                                idcodes.empty() ? "-" : idcodes, instance->busy || instance->claimed ? "busy" : "free",
+                                instance->shiftsPerSecond, instance->latencyUs);
+        }
+    }
+    return reply32(fd, static_cast<uint32_t>(text.size())) &&
+           send(fd, text.data(), text.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(text.size());
+}
+
+bool Broker::readUntil(const int fd, const char delimiter, const size_t limit, std::string &text) {
+    text.clear();
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (c == delimiter) {
+            return true;
+        }
+        if (text.size() == limit) {
+            return false;
+        }
+        text.push_back(c);
+    }
+    return false;
+}
+
+bool Broker::reply32(const int fd, const uint32_t value) {
+    unsigned char bytes[4];
+    std::memcpy(bytes, &value, sizeof(bytes));
+    return send(fd, bytes, sizeof(bytes), MSG_NOSIGNAL) == sizeof(bytes);
+}
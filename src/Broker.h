@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/*
+ * Board pool broker. xvcd instances started with --register keep a
+ * connection open to it, announcing their boards and reporting load.
+ * Clients connect to the broker as if it were an xvcd:
+ *
+ *   claim:<idcode>  picks the least-loaded free board whose chain has that
+ *                   IDCODE (revision ignored, 0 = any) and replies
+ *                   <u32 status>; on CLAIM_OK the connection is then
+ *                   proxied to the board.
+ *   boards:         replies <u32 length> and one text line per board.
+ *
+ * Anything else is taken as plain XVC for any free board, so Vivado can
+ * point at the broker directly.
+ */
+class Broker {
+public:
+    // Takes over an accepted connection
+    void serve(int fd, const std::string &peer);
+
+private:
+    struct Instance {
+        std::string host;
+        std::string port;
+        std::string serial;
+        std::vector<uint32_t> idcodes;
+
+        // As last reported
+        bool busy = false;
+        double shiftsPerSecond = 0;
+        double latencyUs = 0;
+
+        // Handed to a client and not yet given back
+        bool claimed = false;
+        uint64_t claims = 0;
+    };
+
+    void session(int fd, const std::string &peer);
+
+    void registered(int fd, const std::string &peer);
+
+    [[nodiscard]] std::shared_ptr<Instance> pick(uint32_t idcode, uint32_t &status);
+
+    void release(const std::shared_ptr<Instance> &instance);
+
+    // Copies bytes both ways until either side closes; 'preamble' goes to the board first
+    static void proxy(int client, int board, const std::string &preamble);
+
+    [[nodiscard]] bool list(int fd);
+
+    [[nodiscard]] static bool readUntil(int fd, char delimiter, size_t limit, std::string &text);
+
+    [[nodiscard]] static bool reply32(int fd, uint32_t value);
+
+    std::mutex lock;
+    std::vector<std::shared_ptr<Instance> > instances;
+
+    static constexpr uint32_t CLAIM_OK = 0;
+    static constexpr uint32_t CLAIM_NO_MATCH = 1;
+    static constexpr uint32_t CLAIM_ALL_BUSY = 2;
+
+    // Xilinx and most others keep the silicon revision in the top nibble
+    static constexpr uint32_t IDCODE_MASK = 0x0FFFFFFF;
+
+    static constexpr size_t MAX_LINE = 1024;
+    static constexpr size_t PROXY_BUFFER_SIZE = 64 * 1024;
+
+    static constexpr std::string_view ERR_BAD_REGISTRATION = "Bad registration from {}: \"{}\"";
+    static constexpr std::string_view ERR_NO_BOARD = "No free board for {} (IDCODE {:08x})";
+};
@@ -3,6 +3,7 @@
 #include <memory>
 #include <cstdint>
 #include <string>
+#include <vector>
 #include "DiagnosticFlags.h"
 
 
@@ -28,11 +29,75 @@ public:
 
     // Diagnostics Config
     std::unique_ptr<DiagnosticFlags> flags = std::make_unique<DiagnosticFlags>();
+    std::string traceFile;
+
+    // Accept non-standard protocol commands
+    bool protocolExtensions = false;
+
+    // Answer repeated read-only scans from memory for this long; 0 disables.
+    // Instructions as hex value/IR length; the default is IDCODE and USERCODE on 7-series and UltraScale.
+    int scanCacheMs = 0;
+    std::string scanCacheInstructions = "09/6,08/6";
+
+    // USER instruction fronting the ScanBridge core for axi:, USER4 on 7-series by default
+    uint32_t bridgeInstruction = 0x23;
+    uint32_t bridgeIrLength = 6;
+
+    // Shared secret for the auth:/mpsse: passthrough, empty disables it
+    std::string mpsseToken;
+
+    // Workers encoding and decoding multi-megabit shifts; -1 picks one per spare core, 0 keeps it all on the caller
+    int shiftThreads = -1;
+
+    // Low-latency mode
+    int protocolCpu = -1;
+    int usbCpu = -1;
+    int realtimePriority = 0;
+    bool lockMemory = false;
+    // Poll USB completions on the protocol thread instead of a libusb event thread, which also gives it
+    // --rt-priority; --usb-cpu has no thread to apply to then
+    int busyPollUsec = 0;
+
+    // FTDI latency timer in ms. Reads end with SEND_IMMEDIATE, so it only paces empty status packets.
+    int latencyTimer = 16;
 
     // Serial Number
     std::string serialNumber;
+
+    // host:port of a simulator's remote_bitbang server to shift through instead of the adapter
+    std::string bitbangAddress;
+
+    // path[@offset] of a memory-mapped debug_bridge JTAG controller, likewise
+    std::string mmioPath;
+
+    // TCP port or ring file path to stream sampled GPIO pins to during sessions, edges only if set
+    std::string pinSampler;
+    bool pinEdges = false;
+
+    // Serve as the board pool broker, or register this instance with the one at host:port
+    bool broker = false;
+    std::string brokerAddress;
+
+    // host:port of a remote xvcd to relay clients to instead of driving a local adapter
+    std::string relayAddress;
+
+    // Replica adapters that receive every shift of the primary
+    std::vector<std::string> broadcastSerials;
     std::string gpioArgument;
 
+    // Local SPI flash operation, SVF/XSVF playback or loopback self-test instead of serving XVC
+    std::string spiFlashCommand;
+    std::string svfFile;
+    bool selfTest = false;
+
+    [[nodiscard]] bool adapterless() const {
+        return !bitbangAddress.empty() || !mmioPath.empty();
+    }
+
+    [[nodiscard]] bool localMode() const {
+        return !spiFlashCommand.empty() || !svfFile.empty() || selfTest;
+    }
+
 private:
     static inline std::shared_ptr<Config> mInstance;
 };
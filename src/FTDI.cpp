@@ -1,12 +1,13 @@
 #include "FTDI.h"
+#include "GpioSequencer.h"
 #include <algorithm>
 #include <string>
 #include <thread>
 #include <vector>
 
-FTDI::FTDI() {
+FTDI::FTDI(const std::string &serial) {
     config = Config::get();
-    usb = std::make_unique<USB>();
+    usb = std::make_unique<USB>(serial);
 }
 
 unsigned int FTDI::divisorForFrequency(const unsigned int targetFrequency) {
@@ -35,92 +36,177 @@ unsigned int FTDI::divisorForFrequency(const unsigned int targetFrequency) {
 
 int FTDI::set_clock_speed(const unsigned int targetFrequency) const {
     const unsigned int frequency = config->lockedSpeed ? config->lockedSpeed : targetFrequency;
-    const unsigned int count = divisorForFrequency(frequency) - 1;
+    const unsigned int divisor = divisorForFrequency(frequency);
+    const unsigned int count = divisor - 1;
+    clockFrequency = FTDI_CLOCK_RATE / (2 * divisor);
 
-    const std::vector clockSpeed = {
-        FTDI_DISABLE_TCK_PRESCALER,
-        FTDI_SET_TCK_DIVISOR,
-        static_cast<unsigned char>(count),
-        static_cast<unsigned char>(count >> 8)
-    };
-
-    return usb->write_data(clockSpeed);
+    if (shadow.divisor == divisor) {
+        return 1;
+    }
+    // The prescaler stays off once set, so it only goes out with the first divisor
+    if (!shadow.divisor) {
+        usb->cmdByte(FTDI_DISABLE_TCK_PRESCALER);
+    }
+    usb->cmdByte(FTDI_SET_TCK_DIVISOR);
+    usb->cmdByte(static_cast<int>(count));
+    usb->cmdByte(static_cast<int>(count >> 8));
+    shadow.divisor = divisor;
+    return 1;
 }
 
 void FTDI::cmd_byte(const int value) const {
     usb->cmdByte(value);
 }
 
-void FTDI::enable_loopback() const {
-    usb->cmdByte(FTDI_ENABLE_LOOPBACK);
+void FTDI::set_loopback(const bool enable) const {
+    if (shadow.loopback == enable) {
+        return;
+    }
+    usb->cmdByte(enable ? FTDI_ENABLE_LOOPBACK : FTDI_DISABLE_LOOPBACK);
+    shadow.loopback = enable;
 }
 
-void FTDI::set_tms_bits(const int cmd_bit_count, int param) const {
-    usb->cmdByte(FTDI_MPSSE_XFER_TMS_BITS);
-    usb->cmdByte(cmd_bit_count - 1);
-    usb->cmdByte(param);
+void FTDI::set_tms_bits(const int cmd_bit_count, const int param) const {
+    forget_jtag_pins();
+    put_tms_bits(usb->cmdSpace(3), cmd_bit_count, param);
 }
 
 void FTDI::set_tdi_bytes(const int cmdBytes) const {
-    usb->cmdByte(FTDI_MPSSE_XFER_TDI_BYTES);
-    usb->cmdByte(cmdBytes - 1);
-    usb->cmdByte((cmdBytes - 1) >> 8);
+    forget_jtag_pins();
+    put_tdi_bytes(usb->cmdSpace(3), cmdBytes);
+}
+
+unsigned char *FTDI::put_tms_bits(unsigned char *out, const int cmd_bit_count, const int param) {
+    *out++ = FTDI_MPSSE_XFER_TMS_BITS;
+    *out++ = static_cast<unsigned char>(cmd_bit_count - 1);
+    *out++ = static_cast<unsigned char>(param);
+    return out;
+}
+
+unsigned char *FTDI::put_tdi_bits(unsigned char *out, const int cmd_bit_count, const int param) {
+    *out++ = FTDI_MPSSE_XFER_TDI_BITS;
+    *out++ = static_cast<unsigned char>(cmd_bit_count - 1);
+    *out++ = static_cast<unsigned char>(param);
+    return out;
+}
+
+unsigned char *FTDI::put_tdi_bytes(unsigned char *out, const int cmdBytes) {
+    *out++ = FTDI_MPSSE_XFER_TDI_BYTES;
+    *out++ = static_cast<unsigned char>(cmdBytes - 1);
+    *out++ = static_cast<unsigned char>((cmdBytes - 1) >> 8);
+    return out;
+}
+
+unsigned char *FTDI::put_send_immediate(unsigned char *out) {
+    *out++ = FTDI_SEND_IMMEDIATE;
+    return out;
 }
 
 void FTDI::close() const {
     usb->close();
 }
 
-void FTDI::set_tdi_bits(const int cmd_bit_count, int param) const {
-    usb->cmdByte(FTDI_MPSSE_XFER_TDI_BITS);
-    usb->cmdByte(cmd_bit_count - 1);
-    usb->cmdByte(param);
+void FTDI::set_tdi_bits(const int cmd_bit_count, const int param) const {
+    forget_jtag_pins();
+    put_tdi_bits(usb->cmdSpace(3), cmd_bit_count, param);
 }
 
-int FTDI::set_gpio() const {
-    std::vector<unsigned char> gpio = {FTDI_SET_LOW_BYTE, 0, 0, 0};
+void FTDI::spi_select(const bool active) const {
+    set_low_byte(active ? 0 : FTDI_PIN_TMS, FTDI_PIN_TMS | FTDI_PIN_TDI | FTDI_PIN_TCK);
+}
 
-    const std::string &gpioArgument = config->gpioArgument;
-    std::string::size_type start = 0;
-    std::string::size_type end;
+void FTDI::spi_write(const unsigned char *data, const int count) const {
+    forget_jtag_pins();
+    usb->cmdByte(FTDI_MPSSE_SPI_WRITE);
+    usb->cmdByte(count - 1);
+    usb->cmdByte((count - 1) >> 8);
+    for (int i = 0; i < count; i++) {
+        usb->cmdByte(data[i]);
+    }
+}
 
-    auto processGpioValue = [&](const std::string &token) {
-        unsigned long value = std::stoul(token, nullptr, 16);
-        if (value > 0xFF) {
-            spdlog::error(ERR_GPIO_OUT_OF_RANGE, value);
-            return false;
-        }
+void FTDI::spi_read(const int count) const {
+    forget_jtag_pins();
+    usb->cmdByte(FTDI_MPSSE_SPI_READ);
+    usb->cmdByte(count - 1);
+    usb->cmdByte((count - 1) >> 8);
+}
 
-        const unsigned int direction = value >> 4;
-        value &= 0xF;
-        gpio[1] = (value << 4) | FTDI_PIN_TMS;
-        gpio[2] = (direction << 4) | FTDI_PIN_TMS | FTDI_PIN_TDI | FTDI_PIN_TCK;
+void FTDI::clock_cycles(unsigned int cycles) const {
+    forget_jtag_pins();
+    while (cycles >= 8) {
+        const unsigned int bytes = std::min(cycles / 8, 0x10000u);
+        usb->cmdByte(FTDI_CLOCK_N_BYTES);
+        usb->cmdByte(static_cast<int>(bytes - 1));
+        usb->cmdByte(static_cast<int>((bytes - 1) >> 8));
+        cycles -= bytes * 8;
+    }
+    if (cycles) {
+        usb->cmdByte(FTDI_CLOCK_N_BITS);
+        usb->cmdByte(static_cast<int>(cycles - 1));
+    }
+}
 
-        if (!usb->write_data(gpio)) {
-            return false;
-        }
+void FTDI::send_immediate() const {
+    usb->cmdByte(FTDI_SEND_IMMEDIATE);
+}
 
-        return true;
-    };
+int FTDI::flush() const {
+    return usb->write_tx_buffer();
+}
 
-    while ((end = gpioArgument.find(':', start)) != std::string::npos) {
-        if (std::string token = gpioArgument.substr(start, end - start); !processGpioValue(token)) {
-            return 0;
-        }
-        start = end + 1;
-        std::this_thread::sleep_for(ms100);
+void FTDI::forget_state() const {
+    shadow = {};
+}
+
+void FTDI::forget_jtag_pins() const {
+    shadow.lowValue.reset();
+}
+
+void FTDI::set_low_byte(const unsigned char value, const unsigned char direction) const {
+    if (shadow.lowValue == value && shadow.lowDirection == direction) {
+        return;
     }
+    usb->cmdByte(FTDI_SET_LOW_BYTE);
+    usb->cmdByte(value);
+    usb->cmdByte(direction);
+    shadow.lowValue = value;
+    shadow.lowDirection = direction;
+}
 
-    if (!gpioArgument.substr(start).empty()) {
-        if (!processGpioValue(gpioArgument.substr(start))) {
-            return 0;
-        }
+void FTDI::set_high_byte(const unsigned char value, const unsigned char direction) const {
+    if (shadow.highValue == value && shadow.highDirection == direction) {
+        return;
     }
+    usb->cmdByte(FTDI_SET_HIGH_BYTE);
+    usb->cmdByte(value);
+    usb->cmdByte(direction);
+    shadow.highValue = value;
+    shadow.highDirection = direction;
+}
 
-    return 1;
+void FTDI::read_low_byte() const {
+    usb->cmdByte(FTDI_READ_LOW_BYTE);
+}
+
+void FTDI::read_high_byte() const {
+    usb->cmdByte(FTDI_READ_HIGH_BYTE);
+}
+
+void FTDI::clock_until_gpiol1(const bool level, const unsigned int bytes) const {
+    forget_jtag_pins();
+    usb->cmdByte(level ? FTDI_CLOCK_UNTIL_GPIOL1_HIGH : FTDI_CLOCK_UNTIL_GPIOL1_LOW);
+    usb->cmdByte(static_cast<int>(bytes - 1));
+    usb->cmdByte(static_cast<int>((bytes - 1) >> 8));
+}
+
+int FTDI::set_gpio() const {
+    GpioSequencer sequencer(*this);
+    return sequencer.run(config->gpioArgument);
 }
 
 int FTDI::init() const {
+    forget_state();
     if (!usb->connect()) {
         return 0;
     }
@@ -128,14 +214,18 @@ int FTDI::init() const {
     // Control commands initialization
     if (!usb->set_control(BREQ_RESET, WVAL_RESET_RESET) ||
         !usb->set_control(BREQ_SET_BITMODE, WVAL_SET_BITMODE_MPSSE) ||
-        !usb->set_control(BREQ_SET_LATENCY, 2) ||
+        !usb->set_control(BREQ_SET_LATENCY, config->latencyTimer) ||
         !usb->set_control(BREQ_RESET, WVAL_RESET_PURGE_TX) ||
         !usb->set_control(BREQ_RESET, WVAL_RESET_PURGE_RX)) {
         return 0;
     }
 
-    // Set clock speed and initialize the device
-    if (!set_clock_speed(10000000) || !setStartup()) {
+    // Clock and startup state go out in one write
+    if (!set_clock_speed(10000000)) {
+        return 0;
+    }
+    setStartup();
+    if (!flush()) {
         return 0;
     }
 
@@ -148,6 +238,11 @@ int FTDI::init() const {
     return 1;
 }
 
-int FTDI::setStartup() const {
-    return usb->write_data(startup);
+void FTDI::setStartup() const {
+    set_loopback(false);
+    if (shadow.threePhase != false) {
+        usb->cmdByte(FTDI_DISABLE_3_PHASE_CLOCK);
+        shadow.threePhase = false;
+    }
+    set_low_byte(FTDI_PIN_TMS, FTDI_PIN_TMS | FTDI_PIN_TDI | FTDI_PIN_TCK);
 }
@@ -1,22 +1,25 @@
 #pragma once
 
+#include <optional>
 #include "usb.h"
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 class FTDI {
 public:
-    explicit FTDI();
+    // Empty serial: the adapter selected with -d
+    explicit FTDI(const std::string &serial = {});
 
     [[nodiscard]] int init() const;
 
     [[nodiscard]] int set_gpio() const;
 
+    // Queued with the next transfer; dropped if the divisor is unchanged
     [[nodiscard]] int set_clock_speed(unsigned int targetFrequency) const;
 
     void cmd_byte(int value) const;
 
-    void enable_loopback() const;
+    void set_loopback(bool enable) const;
 
     void set_tms_bits(int cmd_bit_count, int param) const;
 
@@ -24,8 +27,58 @@ public:
 
     void set_tdi_bytes(int cmdBytes) const;
 
+    // The same command headers written to 'out' instead of the TX buffer; return the end
+    static unsigned char *put_tms_bits(unsigned char *out, int cmd_bit_count, int param);
+
+    static unsigned char *put_tdi_bits(unsigned char *out, int cmd_bit_count, int param);
+
+    static unsigned char *put_tdi_bytes(unsigned char *out, int cmdBytes);
+
+    static unsigned char *put_send_immediate(unsigned char *out);
+
     void close() const;
 
+    // SPI on the JTAG pins: TCK=SCK, TDI=MOSI, TDO=MISO, TMS=CS#, mode 0
+    void spi_select(bool active) const;
+
+    void spi_write(const unsigned char *data, int count) const;
+
+    void spi_read(int count) const;
+
+    // Toggle the clock with no data, used as an adapter-timed delay
+    void clock_cycles(unsigned int cycles) const;
+
+    void send_immediate() const;
+
+    // GPIO: low byte is ADBUS (GPIOL0-3 in the top nibble), high byte is ACBUS
+    void set_low_byte(unsigned char value, unsigned char direction) const;
+
+    void set_high_byte(unsigned char value, unsigned char direction) const;
+
+    void read_low_byte() const;
+
+    void read_high_byte() const;
+
+    // Clock up to 'bytes' x 8 cycles, stopping early once GPIOL1 reaches 'level'
+    void clock_until_gpiol1(bool level, unsigned int bytes) const;
+
+    [[nodiscard]] const std::string &serial() const {
+        return usb->serial();
+    }
+
+    // Actual TCK frequency after the last set_clock_speed
+    [[nodiscard]] unsigned int clock_frequency() const {
+        return clockFrequency;
+    }
+
+    [[nodiscard]] int flush() const;
+
+    // The adapter was reset or driven behind our back; resend everything
+    void forget_state() const;
+
+    // Data commands move TMS, TDI and TCK, so the next set_low_byte must go out
+    void forget_jtag_pins() const;
+
     std::unique_ptr<USB> usb;
 
 private:
@@ -33,18 +86,41 @@ private:
 
     std::shared_ptr<Config> config{};
 
+    mutable unsigned int clockFrequency = 0;
+
+    /*
+     * Adapter state as of the last queued command, so settings that are
+     * already in effect cost nothing. Empty means unknown.
+     */
+    struct Shadow {
+        std::optional<unsigned int> divisor;
+        std::optional<bool> loopback;
+        std::optional<bool> threePhase;
+        std::optional<unsigned char> lowValue, lowDirection;
+        std::optional<unsigned char> highValue, highDirection;
+    };
+
+    mutable Shadow shadow;
+
     // Error messages
     static constexpr std::string_view WARN_CLOCK_REQUESTED = "{} Hz clock requested, {} Hz actual";
     static constexpr std::string_view WARN_CLOCK_SLOW = "{} Hz clock is a slow choice.";
-    static constexpr std::string_view ERR_GPIO_OUT_OF_RANGE = "GPIO value out of range: {}";
-    static constexpr std::string_view ERR_BAD_GPIO_FORMAT = "Bad -g direction:value[:value...]";
+    static constexpr std::string_view ERR_BAD_GPIO_FORMAT = "Bad -g sequence";
 
     static constexpr unsigned char FTDI_SET_LOW_BYTE = 0x80;
+    static constexpr unsigned char FTDI_READ_LOW_BYTE = 0x81;
+    static constexpr unsigned char FTDI_SET_HIGH_BYTE = 0x82;
+    static constexpr unsigned char FTDI_READ_HIGH_BYTE = 0x83;
+    static constexpr unsigned char FTDI_CLOCK_UNTIL_GPIOL1_HIGH = 0x9C;
+    static constexpr unsigned char FTDI_CLOCK_UNTIL_GPIOL1_LOW = 0x9D;
     static constexpr unsigned char FTDI_ENABLE_LOOPBACK = 0x84;
     static constexpr unsigned char FTDI_DISABLE_LOOPBACK = 0x85;
     static constexpr unsigned char FTDI_SET_TCK_DIVISOR = 0x86;
     static constexpr unsigned char FTDI_DISABLE_TCK_PRESCALER = 0x8A;
     static constexpr unsigned char FTDI_DISABLE_3_PHASE_CLOCK = 0x8D;
+    static constexpr unsigned char FTDI_SEND_IMMEDIATE = 0x87;
+    static constexpr unsigned char FTDI_CLOCK_N_BITS = 0x8E;
+    static constexpr unsigned char FTDI_CLOCK_N_BYTES = 0x8F;
     static constexpr unsigned char FTDI_ACK_BAD_COMMAND = 0xFA;
 
     // Define constants for FTDI commands
@@ -73,21 +149,17 @@ private:
                                                               FTDI_MPSSE_BIT_BIT_MODE |
                                                               FTDI_MPSSE_BIT_WRITE_ON_FALLING_EDGE;
 
+    static constexpr unsigned char FTDI_MPSSE_SPI_WRITE = FTDI_MPSSE_BIT_WRITE_DATA |
+                                                          FTDI_MPSSE_BIT_WRITE_ON_FALLING_EDGE;
+
+    static constexpr unsigned char FTDI_MPSSE_SPI_READ = FTDI_MPSSE_BIT_READ_DATA;
+
     // FTDI I/O pin bits
     static constexpr unsigned char FTDI_PIN_TCK = 0x1;
     static constexpr unsigned char FTDI_PIN_TDI = 0x2;
     static constexpr unsigned char FTDI_PIN_TDO = 0x4;
     static constexpr unsigned char FTDI_PIN_TMS = 0x8;
 
-    // Startup commands
-    const std::vector<unsigned char> startup{
-        FTDI_DISABLE_LOOPBACK,
-        FTDI_DISABLE_3_PHASE_CLOCK,
-        FTDI_SET_LOW_BYTE,
-        FTDI_PIN_TMS,
-        FTDI_PIN_TMS | FTDI_PIN_TDI | FTDI_PIN_TCK
-    };
-
     // Define other constants
     static constexpr unsigned int FTDI_CLOCK_RATE = 60000000;
     static constexpr int BMREQTYPE_OUT = LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE | LIBUSB_ENDPOINT_OUT;
@@ -99,7 +171,5 @@ private:
     static constexpr unsigned int WVAL_RESET_PURGE_TX = 0x02;
     static constexpr unsigned int WVAL_SET_BITMODE_MPSSE = 0x0200 | FTDI_PIN_TCK | FTDI_PIN_TDI | FTDI_PIN_TMS;
 
-    [[nodiscard]] int setStartup() const;
-
-    static constexpr auto ms100 = std::chrono::duration<int, std::milli>(100);
+    void setStartup() const;
 };
@@ -0,0 +1,208 @@
+#include <charconv>
+#include <spdlog/spdlog.h>
+#include "GpioSequencer.h"
+
+
+GpioSequencer::GpioSequencer(const FTDI &ftdi): ftdi(ftdi) {
+}
+
+/*
+ * The whole sequence is parsed before anything is queued, and a run that
+ * fails partway drops what it left in the TX buffer, so no stray command
+ * or read goes out with the next shift.
+ */
+int GpioSequencer::run(const std::string_view sequence) {
+    expected.clear();
+    queuedNs = 0;
+
+    std::vector<Step> steps;
+    std::string_view::size_type start = 0;
+    while (start <= sequence.size()) {
+        const auto end = std::min(sequence.find(':', start), sequence.size());
+        if (const auto token = sequence.substr(start, end - start); !token.empty()) {
+            Step step{};
+            if (!parse(token, step)) {
+                spdlog::error(ERR_BAD_STEP, token);
+                return 0;
+            }
+            steps.push_back(step);
+        }
+        start = end + 1;
+    }
+
+    bool lastWasPins = false;
+    for (const auto &step: steps) {
+        if (!emit(step, lastWasPins)) {
+            discard();
+            return 0;
+        }
+    }
+
+    // One last read both confirms completion and reports the pins
+    ftdi.read_low_byte();
+    expected.push_back(NO_READ);
+    if (!sync()) {
+        discard();
+        return 0;
+    }
+    return 1;
+}
+
+bool GpioSequencer::parse(const std::string_view token, Step &step) {
+    const char *first = token.data();
+    const char *last = token.data() + token.size();
+
+    switch (token[0]) {
+        // Not a hex digit, so it can't be mistaken for a DV step
+        case 't':
+            step.kind = StepKind::DELAY;
+            return parseTime(token.substr(1), step.nanoseconds);
+
+        case 'w':
+            step.kind = StepKind::WAIT;
+            step.nanoseconds = DEFAULT_WAIT_TIMEOUT;
+            step.value = token.size() >= 2 && token[1] == '1';
+            return token.size() >= 2 && (token[1] == '0' || token[1] == '1') &&
+                   (token.size() == 2 || parseTime(token.substr(2), step.nanoseconds));
+
+        case 'h':
+            step.kind = StepKind::HIGH_PINS;
+            return token.size() == 5 && std::from_chars(first + 1, last, step.value, 16).ptr == last;
+
+        default:
+            step.kind = StepKind::LOW_PINS;
+            return token.size() <= 2 && std::from_chars(first, last, step.value, 16).ptr == last;
+    }
+}
+
+int GpioSequencer::emit(const Step &step, bool &lastWasPins) {
+    switch (step.kind) {
+        case StepKind::DELAY:
+            lastWasPins = false;
+            return delay(step.nanoseconds);
+
+        case StepKind::WAIT:
+            lastWasPins = false;
+            return wait(step.value, step.nanoseconds);
+
+        case StepKind::HIGH_PINS:
+            if (lastWasPins && !delay(DEFAULT_STEP_DELAY)) {
+                return 0;
+            }
+            ftdi.set_high_byte(step.value & 0xFF, step.value >> 8);
+            lastWasPins = true;
+            return pace();
+
+        case StepKind::LOW_PINS: {
+            if (lastWasPins && !delay(DEFAULT_STEP_DELAY)) {
+                return 0;
+            }
+            const unsigned int direction = step.value >> 4;
+            // TMS low, so the clocks of later delays and waits can't walk the TAP to Test-Logic-Reset
+            ftdi.set_low_byte((step.value & 0xF) << 4, direction << 4 | PIN_TMS | PIN_TDI | PIN_TCK);
+            lastWasPins = true;
+            return pace();
+        }
+    }
+    return 0;
+}
+
+void GpioSequencer::discard() const {
+    ftdi.usb->txCount = 0;
+    ftdi.forget_state();
+}
+
+uint64_t GpioSequencer::cyclesFor(const uint64_t nanoseconds) const {
+    return (nanoseconds * ftdi.clock_frequency() + 999'999'999) / 1'000'000'000;
+}
+
+/*
+ * Send what is queued once the buffer fills, and read back once enough
+ * adapter time is queued that the read could outlast the USB timeout.
+ */
+int GpioSequencer::pace() {
+    if (queuedNs >= SYNC_INTERVAL || expected.size() >= MAX_PENDING_READS) {
+        ftdi.read_low_byte();
+        expected.push_back(NO_READ);
+        return sync();
+    }
+    return ftdi.usb->txCount < FLUSH_THRESHOLD || ftdi.flush();
+}
+
+int GpioSequencer::delay(const uint64_t nanoseconds) {
+    uint64_t cycles = cyclesFor(nanoseconds);
+    while (cycles) {
+        const auto chunk = std::min(cycles, MAX_CLOCK_BYTES * 8);
+        ftdi.clock_cycles(static_cast<unsigned int>(chunk));
+        cycles -= chunk;
+        queuedNs += chunk * 1'000'000'000 / ftdi.clock_frequency();
+        if (!pace()) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Clock-until-GPIOL1 stops as soon as the pin is at 'level'; reading the low
+ * byte right after tells a match from a timeout.
+ */
+int GpioSequencer::wait(const bool level, const uint64_t nanoseconds) {
+    uint64_t bytes = std::max<uint64_t>(1, (cyclesFor(nanoseconds) + 7) / 8);
+    while (bytes) {
+        const auto chunk = std::min(bytes, MAX_CLOCK_BYTES);
+        ftdi.clock_until_gpiol1(level, static_cast<unsigned int>(chunk));
+        bytes -= chunk;
+        queuedNs += chunk * 8 * 1'000'000'000 / std::max(1u, ftdi.clock_frequency());
+        if (bytes && !pace()) {
+            return 0;
+        }
+    }
+    ftdi.read_low_byte();
+    expected.push_back(level);
+    return pace();
+}
+
+int GpioSequencer::sync() {
+    if (expected.empty()) {
+        return ftdi.flush();
+    }
+    ftdi.send_immediate();
+    if (!ftdi.flush() || !ftdi.usb->read_data(static_cast<int>(expected.size()))) {
+        return 0;
+    }
+
+    const unsigned char *rx = ftdi.usb->rx_data();
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i] != NO_READ && ((rx[i] & PIN_GPIOL1) != 0) != (expected[i] != 0)) {
+            spdlog::error(ERR_WAIT_TIMEOUT, expected[i] ? "high" : "low");
+            return 0;
+        }
+    }
+    pins = rx[expected.size() - 1];
+    expected.clear();
+    queuedNs = 0;
+    return 1;
+}
+
+bool GpioSequencer::parseTime(const std::string_view text, uint64_t &nanoseconds) {
+    uint64_t value;
+    const auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (ec != std::errc() || ptr == text.data()) {
+        return false;
+    }
+
+    const std::string_view unit(ptr, text.data() + text.size() - ptr);
+    if (unit == "ns") {
+        nanoseconds = value;
+    } else if (unit.empty() || unit == "us") {
+        nanoseconds = value * 1000;
+    } else if (unit == "ms") {
+        nanoseconds = value * 1'000'000;
+    } else if (unit == "s") {
+        nanoseconds = value * 1'000'000'000;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "FTDI.h"
+
+
+/*
+ * Compiles a GPIO waveform into MPSSE commands so pin changes, delays and
+ * waits are timed by the adapter instead of host sleeps. A sequence is a
+ * ':' separated list of steps:
+ *
+ *   DV        GPIOL0-3: direction nibble D, value nibble V (as -g always took)
+ *   hDDVV     ACBUS: direction byte DD, value byte VV
+ *   t<time>   delay, e.g. t250us, t2ms; default unit us
+ *   w<0|1>[<time>]  wait for GPIOL1 low/high, giving up after <time> (1 s)
+ *
+ * Two pin steps with no delay between them are DEFAULT_STEP_DELAY apart.
+ * Delays and waits clock TCK with TMS held. Pin steps drive TMS low, so a
+ * TAP parked in Run-Test/Idle stays there and one in Test-Logic-Reset
+ * moves to Run-Test/Idle; before the first pin step TMS is wherever the
+ * last shift left it.
+ */
+class GpioSequencer {
+public:
+    explicit GpioSequencer(const FTDI &ftdi);
+
+    [[nodiscard]] int run(std::string_view sequence);
+
+    // Low byte pins read back at the end of the last run
+    unsigned char pins = 0;
+
+private:
+    enum class StepKind { LOW_PINS, HIGH_PINS, DELAY, WAIT };
+
+    // 'value' is the pins to set, or the GPIOL1 level waited for
+    struct Step {
+        StepKind kind;
+        unsigned int value;
+        uint64_t nanoseconds;
+    };
+
+    [[nodiscard]] static bool parse(std::string_view token, Step &step);
+
+    [[nodiscard]] int emit(const Step &step, bool &lastWasPins);
+
+    void discard() const;
+
+    [[nodiscard]] int delay(uint64_t nanoseconds);
+
+    [[nodiscard]] int wait(bool level, uint64_t nanoseconds);
+
+    [[nodiscard]] int pace();
+
+    [[nodiscard]] int sync();
+
+    [[nodiscard]] static bool parseTime(std::string_view text, uint64_t &nanoseconds);
+
+    [[nodiscard]] uint64_t cyclesFor(uint64_t nanoseconds) const;
+
+    const FTDI &ftdi;
+
+    // Read-backs queued since the last sync: GPIOL1 level expected after each wait
+    std::vector<int> expected;
+
+    // Adapter time queued since the last sync
+    uint64_t queuedNs = 0;
+
+    static constexpr uint64_t DEFAULT_STEP_DELAY = 100'000'000;
+    static constexpr uint64_t DEFAULT_WAIT_TIMEOUT = 1'000'000'000;
+
+    // Read back well inside the USB read timeout
+    static constexpr uint64_t SYNC_INTERVAL = 1'000'000'000;
+    static constexpr int FLUSH_THRESHOLD = USB::USB_BUFFER_SIZE - 16;
+    static constexpr uint64_t MAX_CLOCK_BYTES = 0x10000;
+    static constexpr size_t MAX_PENDING_READS = 64;
+
+    static constexpr unsigned char PIN_TCK = 0x01;
+    static constexpr unsigned char PIN_TDI = 0x02;
+    static constexpr unsigned char PIN_TMS = 0x08;
+    static constexpr unsigned char PIN_GPIOL1 = 0x20;
+    static constexpr unsigned char NO_READ = 2;
+
+    static constexpr std::string_view ERR_BAD_STEP = "Bad GPIO step \"{}\"";
+    static constexpr std::string_view ERR_WAIT_TIMEOUT = "GPIOL1 did not go {} in time";
+};
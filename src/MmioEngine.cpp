@@ -0,0 +1,129 @@
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "MmioEngine.h"
+
+
+MmioEngine::MmioEngine(const std::string &argument) {
+    const auto at = argument.rfind('@');
+    path = argument.substr(0, at);
+    if (at != std::string::npos) {
+        char *end;
+        const std::string text = argument.substr(at + 1);
+        offset = static_cast<off_t>(std::strtoull(text.c_str(), &end, 0));
+        if (text.empty() || *end != '\0') {
+            spdlog::error(ERR_BAD_OFFSET, argument);
+            std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+MmioEngine::~MmioEngine() {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+// mmap wants a page-aligned offset, so map from the page holding the window
+int MmioEngine::open() {
+    fd = ::open(path.c_str(), O_RDWR | O_SYNC);
+    if (fd < 0) {
+        spdlog::error(ERR_OPEN, path, strerror(errno));
+        return 0;
+    }
+
+    const auto page = static_cast<off_t>(sysconf(_SC_PAGESIZE));
+    const off_t base = offset / page * page;
+    mappingSize = static_cast<size_t>(offset - base) + REGISTER_COUNT * sizeof(uint32_t);
+    void *pointer = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base);
+    if (pointer == MAP_FAILED) {
+        spdlog::error(ERR_MAP, path, offset, strerror(errno));
+        return 0;
+    }
+    mapping = pointer;
+    registers = reinterpret_cast<volatile uint32_t *>(static_cast<char *>(mapping) + (offset - base));
+    lastLength = 0;
+    spdlog::info("JTAG controller at {}@0x{:x}", path, offset);
+    return 1;
+}
+
+/*
+ * Words are taken from the vectors a byte at a time so the bit order holds
+ * on any host; bit 0 of each register is the first TCK.
+ */
+int MmioEngine::shift(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                      unsigned char *tdo) {
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t first = 0; first < shiftBits; first += WORD_BITS) {
+        const uint32_t bits = std::min(WORD_BITS, shiftBits - first);
+        const uint32_t bytes = (bits + 7) / 8;
+        const uint32_t index = first / 8;
+
+        uint32_t tmsWord = 0;
+        uint32_t tdiWord = 0;
+        for (uint32_t i = 0; i < bytes; i++) {
+            tmsWord |= static_cast<uint32_t>(tms[index + i]) << (8 * i);
+            tdiWord |= static_cast<uint32_t>(tdi[index + i]) << (8 * i);
+        }
+
+        // TMS, TDI, control and TDO, plus LENGTH when it changes
+        wireBytes += (bits == lastLength ? 4 : 5) * sizeof(uint32_t);
+        uint32_t tdoWord;
+        if (!shiftWord(bits, tmsWord, tdiWord, tdoWord)) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < bytes; i++) {
+            tdo[index + i] = static_cast<unsigned char>(tdoWord >> (8 * i));
+        }
+        chunkCount++;
+    }
+    wireBits += shiftBits;
+    busy += std::chrono::steady_clock::now() - start;
+    return 1;
+}
+
+int MmioEngine::shiftWord(const uint32_t bits, const uint32_t tms, const uint32_t tdi, uint32_t &tdo) {
+    if (bits != lastLength) {
+        registers[REG_LENGTH] = bits;
+        lastLength = bits;
+    }
+    registers[REG_TMS] = tms;
+    registers[REG_TDI] = tdi;
+
+    // Operands must be visible before the start bit, and TDO read only after it clears
+    std::atomic_thread_fence(std::memory_order_release);
+    registers[REG_CONTROL] = CONTROL_START;
+    uint64_t count = 0;
+    while (registers[REG_CONTROL] & CONTROL_START) {
+        if (++count == POLL_LIMIT) {
+            spdlog::error(ERR_TIMEOUT, path);
+            return 0;
+        }
+        if (count % YIELD_POLLS == 0) {
+            sched_yield();
+        }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    polls += count;
+
+    tdo = registers[REG_TDO];
+    return 1;
+}
+
+void MmioEngine::printStatistic() const {
+    const double seconds = std::chrono::duration<double>(busy).count();
+    if (seconds > 0) {
+        spdlog::info("Bridge TCK: {:.0f}/s", wireBits / seconds);
+    }
+    if (chunkCount) {
+        spdlog::info("Control polls per word: {:.1f}", static_cast<double>(polls) / chunkCount);
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <sys/types.h>
+#include <chrono>
+#include <string>
+#include "ShiftEngine.h"
+
+
+/*
+ * Drives a Xilinx debug_bridge / AXI-JTAG controller through its register
+ * window, mapped from a PCIe BAR resource file, a UIO device or any file a
+ * model services, instead of an FTDI adapter. Each 32-bit word of TMS and
+ * TDI is written, started through the control register, polled until the
+ * controller clears it and its TDO read back; no USB is involved.
+ */
+class MmioEngine final : public ShiftEngine {
+public:
+    // path[@offset] of the register window, offset in bytes
+    explicit MmioEngine(const std::string &argument);
+
+    ~MmioEngine() override;
+
+    [[nodiscard]] int open();
+
+    [[nodiscard]] int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo) override;
+
+    // TCK comes from the fabric clock feeding the bridge
+    [[nodiscard]] int setClock(unsigned int) override {
+        return 1;
+    }
+
+    void printStatistic() const override;
+
+private:
+    [[nodiscard]] int shiftWord(uint32_t bits, uint32_t tms, uint32_t tdi, uint32_t &tdo);
+
+    std::string path;
+    off_t offset = 0;
+
+    int fd = -1;
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    volatile uint32_t *registers = nullptr;
+
+    // LENGTH only needs writing when it changes, which is once per shift at most
+    uint32_t lastLength = 0;
+
+    uint64_t polls = 0;
+    std::chrono::steady_clock::duration busy{};
+
+    // debug_bridge register offsets, in words
+    static constexpr int REG_LENGTH = 0;
+    static constexpr int REG_TMS = 1;
+    static constexpr int REG_TDI = 2;
+    static constexpr int REG_TDO = 3;
+    static constexpr int REG_CONTROL = 4;
+    static constexpr int REGISTER_COUNT = 5;
+
+    static constexpr uint32_t CONTROL_START = 0x01;
+    static constexpr uint32_t WORD_BITS = 32;
+
+    // A word takes at most 32 TCKs; even a slow fabric clock finishes long before this
+    static constexpr uint64_t POLL_LIMIT = 100'000'000;
+
+    // Hardware is done well within this; a software model may need the CPU back
+    static constexpr uint64_t YIELD_POLLS = 256;
+
+    static constexpr std::string_view ERR_BAD_OFFSET = "Bad --mmio offset in \"{}\"";
+    static constexpr std::string_view ERR_OPEN = "Can't open {}: {}";
+    static constexpr std::string_view ERR_MAP = "Can't map {} at 0x{:x}: {}";
+    static constexpr std::string_view ERR_TIMEOUT = "JTAG controller at {} did not finish a shift";
+};
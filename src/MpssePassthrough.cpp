@@ -0,0 +1,166 @@
+#include "MpssePassthrough.h"
+
+
+MpssePassthrough::MpssePassthrough(const FTDI &ftdi): ftdi(ftdi) {
+}
+
+int MpssePassthrough::run(const std::vector<unsigned char> &stream, std::vector<unsigned char> &response) {
+    response.clear();
+    transportFailed = false;
+    executed = 0;
+    if (!parse(stream)) {
+        return 0;
+    }
+
+    // Leave room for the SEND_IMMEDIATE appended to every batch that reads
+    const auto txLimit = static_cast<uint32_t>(ftdi.usb->writeLimit - 1);
+    const auto rxLimit = static_cast<uint32_t>(ftdi.usb->readLimit);
+
+    // Settings queued by FTDI ride along with the first batch
+    size_t first = 0;
+    auto txBytes = static_cast<uint32_t>(ftdi.usb->txCount);
+    uint32_t rxBytes = 0;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const auto &command = commands[i];
+        if (command.size > txLimit || command.responseBytes > rxLimit) {
+            badOffset = command.offset;
+            spdlog::error(ERR_TOO_LARGE, command.offset, txLimit);
+            return 0;
+        }
+        if (txBytes + command.size > txLimit || rxBytes + command.responseBytes > rxLimit) {
+            if (!sendBatch(stream, first, i, rxBytes, response)) {
+                transportFailed = true;
+                executed = commands[first].offset;
+                return 0;
+            }
+            first = i;
+            txBytes = 0;
+            rxBytes = 0;
+        }
+        txBytes += command.size;
+        rxBytes += command.responseBytes;
+    }
+    if (!sendBatch(stream, first, commands.size(), rxBytes, response)) {
+        transportFailed = true;
+        executed = commands[first].offset;
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Split the stream into commands and work out how many bytes each one
+ * returns. Data commands follow the MPSSE bit layout: byte mode takes a
+ * 16-bit length and that many data bytes, bit mode a 3-bit length and one
+ * data byte, and reads return one byte per data byte.
+ */
+int MpssePassthrough::parse(const std::vector<unsigned char> &stream) {
+    commands.clear();
+
+    size_t offset = 0;
+    while (offset < stream.size()) {
+        const unsigned char opcode = stream[offset];
+        const size_t remaining = stream.size() - offset;
+        uint32_t size;
+        uint32_t responseBytes = 0;
+
+        if (!(opcode & 0x80)) {
+            const bool tms = opcode & BIT_WRITE_TMS;
+            const bool bitMode = opcode & BIT_BIT_MODE;
+            const bool write = opcode & (BIT_WRITE_DATA | BIT_WRITE_TMS);
+            const bool read = opcode & BIT_READ_DATA;
+            if ((!write && !read) || (tms && (!bitMode || (opcode & BIT_WRITE_DATA)))) {
+                badOffset = offset;
+                spdlog::error(ERR_BAD_OPCODE, opcode, offset);
+                return 0;
+            }
+            if (bitMode) {
+                if (remaining < 2 || stream[offset + 1] > 7) {
+                    badOffset = offset;
+                    spdlog::error(ERR_TRUNCATED, offset);
+                    return 0;
+                }
+                size = write ? 3 : 2;
+                responseBytes = read ? 1 : 0;
+            } else {
+                if (remaining < 3) {
+                    badOffset = offset;
+                    spdlog::error(ERR_TRUNCATED, offset);
+                    return 0;
+                }
+                const uint32_t length = (stream[offset + 1] | stream[offset + 2] << 8) + 1;
+                size = 3 + (write ? length : 0);
+                responseBytes = read ? length : 0;
+            }
+        } else {
+            switch (opcode) {
+                case 0x81: // read low byte
+                case 0x83: // read high byte
+                    size = 1;
+                    responseBytes = 1;
+                    break;
+                case 0x85: // disable loopback
+                case 0x87: // send immediate
+                case 0x8A: // disable clock divide by 5
+                case 0x8B: // enable clock divide by 5
+                case 0x8C: // enable 3-phase clocking
+                case 0x8D: // disable 3-phase clocking
+                case 0x96: // enable adaptive clocking
+                case 0x97: // disable adaptive clocking
+                    size = 1;
+                    break;
+                case 0x8E: // clock N bits
+                    size = 2;
+                    break;
+                case 0x80: // set low byte
+                case 0x82: // set high byte
+                case 0x86: // set clock divisor
+                case 0x8F: // clock N bytes
+                    size = 3;
+                    break;
+                default:
+                    badOffset = offset;
+                    spdlog::error(ERR_BAD_OPCODE, opcode, offset);
+                    return 0;
+            }
+        }
+
+        if (size > remaining) {
+            badOffset = offset;
+            spdlog::error(ERR_TRUNCATED, offset);
+            return 0;
+        }
+        commands.push_back({static_cast<uint32_t>(offset), size, responseBytes});
+        offset += size;
+    }
+    return 1;
+}
+
+int MpssePassthrough::sendBatch(const std::vector<unsigned char> &stream, const size_t first, const size_t last,
+                                const uint32_t responseBytes, std::vector<unsigned char> &response) const {
+    if (first == last) {
+        return 1;
+    }
+
+    const uint32_t begin = commands[first].offset;
+    const uint32_t end = commands[last - 1].offset + commands[last - 1].size;
+    for (uint32_t i = begin; i < end; i++) {
+        ftdi.usb->cmdByte(stream[i]);
+    }
+    // The client may have changed the clock, pins or loopback
+    ftdi.forget_state();
+    if (responseBytes) {
+        ftdi.send_immediate();
+    }
+    if (!ftdi.flush()) {
+        return 0;
+    }
+    if (responseBytes) {
+        if (!ftdi.usb->read_data(static_cast<int>(responseBytes))) {
+            return 0;
+        }
+        const unsigned char *rx = ftdi.usb->rx_data();
+        response.insert(response.end(), rx, rx + responseBytes);
+    }
+    return 1;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "FTDI.h"
+
+
+/*
+ * Runs a client-built MPSSE command stream on the adapter. The stream is
+ * parsed against a whitelist first, so commands that could wedge the engine
+ * (loopback, wait-on-GPIO, unknown opcodes) never reach the chip, and the
+ * response length is known before anything is sent. Whole commands are then
+ * packed into bulk-sized writes.
+ */
+class MpssePassthrough {
+public:
+    explicit MpssePassthrough(const FTDI &ftdi);
+
+    /*
+     * Returns 1 and fills response, or 0 with badOffset set when the stream
+     * is rejected, or 0 with transportFailed set when USB fails partway.
+     * 'executed' is then how many stream bytes went out in batches that
+     * completed; the failed batch may have run in part.
+     */
+    [[nodiscard]] int run(const std::vector<unsigned char> &stream, std::vector<unsigned char> &response);
+
+    uint32_t badOffset = 0;
+    bool transportFailed = false;
+    uint32_t executed = 0;
+
+private:
+    struct Command {
+        uint32_t offset;
+        uint32_t size;
+        uint32_t responseBytes;
+    };
+
+    [[nodiscard]] int parse(const std::vector<unsigned char> &stream);
+
+    [[nodiscard]] int sendBatch(const std::vector<unsigned char> &stream, size_t first, size_t last,
+                                uint32_t responseBytes, std::vector<unsigned char> &response) const;
+
+    const FTDI &ftdi;
+    std::vector<Command> commands;
+
+    static constexpr unsigned char BIT_WRITE_TMS = 0x40;
+    static constexpr unsigned char BIT_READ_DATA = 0x20;
+    static constexpr unsigned char BIT_WRITE_DATA = 0x10;
+    static constexpr unsigned char BIT_BIT_MODE = 0x02;
+
+    static constexpr std::string_view ERR_BAD_OPCODE = "MPSSE opcode 0x{:02x} at {} not allowed";
+    static constexpr std::string_view ERR_TRUNCATED = "MPSSE command at {} is truncated";
+    static constexpr std::string_view ERR_TOO_LARGE = "MPSSE command at {} exceeds one {} byte transfer";
+};
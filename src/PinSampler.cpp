@@ -0,0 +1,283 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "PinSampler.h"
+#include "FTDI.h"
+
+
+PinSampler::PinSampler(const FTDI &ftdi, std::mutex &adapter, const std::string &target, const bool edges)
+    : ftdi(ftdi), adapter(adapter), target(target), edges(edges) {
+}
+
+PinSampler::~PinSampler() {
+    stop();
+    dropClient();
+    if (listener >= 0) {
+        close(listener);
+    }
+    if (ring) {
+        munmap(ring, ringSize);
+    }
+    if (ringFd >= 0) {
+        close(ringFd);
+    }
+}
+
+// All digits is a port, anything else a file
+int PinSampler::open() {
+    const bool port = !target.empty() && std::ranges::all_of(target, [](const char c) {
+        return c >= '0' && c <= '9';
+    });
+    return port ? openListener() : openRing();
+}
+
+int PinSampler::openListener() {
+    const auto config = Config::get();
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listener < 0) {
+        spdlog::error(ERR_LISTEN, target, strerror(errno));
+        return 0;
+    }
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(std::stoi(target)));
+    if (inet_pton(AF_INET, config->bindAddress.data(), &address.sin_addr) != 1 ||
+        bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        spdlog::error(ERR_LISTEN, target, strerror(errno));
+        return 0;
+    }
+    spdlog::info("Pin samples on port {}", target);
+    return 1;
+}
+
+int PinSampler::openRing() {
+    ringFd = ::open(target.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ringSize = sizeof(RingHeader) + RING_CAPACITY * sizeof(Sample);
+    if (ringFd < 0 || ftruncate(ringFd, static_cast<off_t>(ringSize)) < 0) {
+        spdlog::error(ERR_OPEN, target, strerror(errno));
+        return 0;
+    }
+    void *pointer = mmap(nullptr, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, ringFd, 0);
+    if (pointer == MAP_FAILED) {
+        spdlog::error(ERR_OPEN, target, strerror(errno));
+        return 0;
+    }
+    ring = static_cast<RingHeader *>(pointer);
+    ringSamples = reinterpret_cast<Sample *>(ring + 1);
+    std::memcpy(ring->magic, MAGIC, sizeof(MAGIC));
+    ring->version = VERSION;
+    ring->capacity = RING_CAPACITY;
+    spdlog::info("Pin samples in {}", target);
+    return 1;
+}
+
+void PinSampler::start() {
+    stop();
+    havePins = false;
+    stopping = false;
+    released();
+    worker = std::thread(&PinSampler::loop, this);
+}
+
+void PinSampler::stop() {
+    {
+        std::lock_guard turn(turnLock);
+        stopping = true;
+    }
+    turnChanged.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void PinSampler::released() {
+    lastRelease.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+/*
+ * Only offered while the sampler is waiting for a quiet spell, so a
+ * repeat: costs nothing when there is no one to sample for.
+ */
+void PinSampler::offerTurn() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < nextTurn) {
+        return;
+    }
+    nextTurn = now + TURN_INTERVAL;
+
+    std::unique_lock turn(turnLock);
+    if (!waiting) {
+        return;
+    }
+    turnOffered = true;
+    turnTaken = false;
+    adapter.unlock();
+    turnChanged.notify_all();
+    turnChanged.wait_for(turn, TURN_WAIT, [&] { return turnTaken; });
+    turnOffered = false;
+    turn.unlock();
+    adapter.lock();
+}
+
+void PinSampler::printStatistic() const {
+    spdlog::info("Pin samples: {} in {} batches, {} published, {} dropped, {} backoffs", samples, batches, published,
+                 dropped, backoffs);
+}
+
+void PinSampler::loop() {
+    auto notBefore = std::chrono::steady_clock::time_point{};
+    while (!stopping) {
+        if (listener >= 0) {
+            acceptClient();
+            if (client < 0) {
+                std::this_thread::sleep_for(IDLE_WAIT);
+                continue;
+            }
+        }
+
+        // Sleep through the client's bursts unless the protocol thread offers a turn
+        bool offered;
+        {
+            std::unique_lock turn(turnLock);
+            const auto quiet = [&] {
+                return std::max(notBefore, std::chrono::steady_clock::time_point(
+                                    std::chrono::steady_clock::duration(lastRelease.load()))) + QUIET_PERIOD;
+            };
+            waiting = true;
+            turnChanged.wait_until(turn, quiet(), [&] { return turnOffered || stopping; });
+            waiting = false;
+            offered = turnOffered;
+            if (stopping || (!offered && std::chrono::steady_clock::now() < quiet())) {
+                continue;
+            }
+        }
+
+        std::unique_lock held(adapter, std::try_to_lock);
+        if (!held.owns_lock()) {
+            // Mid-command; a quiet period after it ends at the earliest
+            backoffs++;
+            notBefore = std::chrono::steady_clock::now();
+            continue;
+        }
+        if (offered) {
+            std::lock_guard turn(turnLock);
+            turnTaken = true;
+            turnChanged.notify_all();
+        }
+        if (!sampleBatch(held)) {
+            spdlog::error(ERR_ADAPTER);
+            return;
+        }
+        if (client >= 0) {
+            flushClient();
+        }
+    }
+}
+
+/*
+ * The adapter goes back to the protocol thread as soon as the pins are
+ * in. Samples are spread evenly over the round trip that took them.
+ */
+bool PinSampler::sampleBatch(std::unique_lock<std::mutex> &adapterHeld) {
+    USB &usb = *ftdi.usb;
+    const int count = std::min(MAX_BATCH_SAMPLES, usb.readLimit / 2);
+
+    const auto before = std::chrono::system_clock::now();
+    for (int i = 0; i < count; i++) {
+        ftdi.read_low_byte();
+        ftdi.read_high_byte();
+    }
+    ftdi.send_immediate();
+    if (!usb.write_tx_buffer() || !usb.read_data(2 * count)) {
+        return false;
+    }
+    const auto after = std::chrono::system_clock::now();
+    pins.assign(usb.rx_data(), usb.rx_data() + 2 * count);
+    adapterHeld.unlock();
+
+    const auto start = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(before.time_since_epoch()).count());
+    const auto span = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count());
+    for (int i = 0; i < count; i++) {
+        publish(start + span * (2 * i + 1) / (2 * count), pins[2 * i], pins[2 * i + 1]);
+    }
+    samples += count;
+    batches++;
+    return true;
+}
+
+void PinSampler::publish(const uint64_t timestampNs, const uint8_t low, const uint8_t high) {
+    if (edges && havePins && low == lastLow && high == lastHigh) {
+        return;
+    }
+    havePins = true;
+    lastLow = low;
+    lastHigh = high;
+    published++;
+
+    if (ring) {
+        const uint64_t n = std::atomic_ref(ring->written).load(std::memory_order_relaxed);
+        ringSamples[n % RING_CAPACITY] = {timestampNs, low, high, 0, 0};
+        std::atomic_ref(ring->written).store(n + 1, std::memory_order_release);
+    }
+    if (client >= 0) {
+        if (outgoing.size() + sizeof(Sample) > MAX_OUTGOING) {
+            lost++;
+            dropped++;
+            return;
+        }
+        const Sample sample{timestampNs, low, high, 0, lost};
+        const auto *bytes = reinterpret_cast<const unsigned char *>(&sample);
+        outgoing.insert(outgoing.end(), bytes, bytes + sizeof(sample));
+        lost = 0;
+    }
+}
+
+// One client at a time; it starts with the current pins even when only edges are sent
+void PinSampler::acceptClient() {
+    if (client >= 0) {
+        return;
+    }
+    client = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK);
+    if (client >= 0) {
+        havePins = false;
+        lost = 0;
+        spdlog::info("Pin sample client connected");
+    }
+}
+
+void PinSampler::flushClient() {
+    size_t sent = 0;
+    while (sent < outgoing.size()) {
+        const ssize_t n = send(client, outgoing.data() + sent, outgoing.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            spdlog::info("Pin sample client disconnected");
+            dropClient();
+            return;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    outgoing.erase(outgoing.begin(), outgoing.begin() + static_cast<std::ptrdiff_t>(sent));
+}
+
+void PinSampler::dropClient() {
+    if (client >= 0) {
+        close(client);
+        client = -1;
+    }
+    outgoing.clear();
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class FTDI;
+
+
+/*
+ * Logic-analyzer view of the adapter's GPIO pins (DONE, INIT_B and the
+ * like) during bring-up, without the client polling over JTAG. While a
+ * session has the adapter open, a thread reads both pin bytes back to
+ * back in batched round trips, timestamps each sample and writes it, or
+ * with 'edges' only samples that differ from the one before, to a TCP
+ * client or a ring file other processes map (xvc-pindump reads both).
+ *
+ * The protocol thread holds 'adapter' while a command drives it. The
+ * sampler only takes it once no command has run for QUIET_PERIOD, so a
+ * client's bursts of shifts never wait on it, and a batch is one packet of
+ * pin reads, so the next command waits a microframe or so at most. Where
+ * the adapter stays busy, in repeat:, between svf:/xsvf: batches or across
+ * a stream of shift:, it is lent out every TURN_INTERVAL instead.
+ */
+class PinSampler {
+public:
+    // Wire and ring record: both pin bytes, taken at 'timestampNs' (CLOCK_REALTIME)
+    struct Sample {
+        uint64_t timestampNs;
+        uint8_t low;
+        uint8_t high;
+        uint16_t reserved;
+        // Samples dropped just before this one because the client fell behind
+        uint32_t lost;
+    };
+
+    // Ring file layout: RingHeader, then 'capacity' Samples. Sample n is at n % capacity
+    // and complete once 'written' is past n.
+    struct RingHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t capacity;
+        uint64_t written;
+        uint64_t reserved;
+    };
+
+    static constexpr char MAGIC[8] = {'X', 'V', 'C', 'P', 'I', 'N', 'S', '1'};
+    static constexpr uint32_t VERSION = 1;
+
+    // 'target' is a TCP port to serve samples on or the path of a ring file
+    PinSampler(const FTDI &ftdi, std::mutex &adapter, const std::string &target, bool edges);
+
+    ~PinSampler();
+
+    [[nodiscard]] int open();
+
+    // Sample while the adapter is up
+    void start();
+
+    void stop();
+
+    void printStatistic() const;
+
+    // Protocol thread, at the end of each command
+    void released();
+
+    // Protocol thread, holding 'adapter' in a long command: one batch if due, then it is held again
+    void offerTurn();
+
+private:
+    void loop();
+
+    // One round trip of pin reads; false if the adapter failed
+    [[nodiscard]] bool sampleBatch(std::unique_lock<std::mutex> &adapterHeld);
+
+    void publish(uint64_t timestampNs, uint8_t low, uint8_t high);
+
+    void acceptClient();
+
+    void flushClient();
+
+    void dropClient();
+
+    [[nodiscard]] int openRing();
+
+    [[nodiscard]] int openListener();
+
+    const FTDI &ftdi;
+    std::mutex &adapter;
+    std::string target;
+    bool edges;
+
+    int listener = -1;
+    int client = -1;
+    std::vector<unsigned char> outgoing;
+    uint32_t lost = 0;
+
+    int ringFd = -1;
+    RingHeader *ring = nullptr;
+    Sample *ringSamples = nullptr;
+    size_t ringSize = 0;
+
+    // Edge filter: the last pins published
+    bool havePins = false;
+    uint8_t lastLow = 0;
+    uint8_t lastHigh = 0;
+
+    std::vector<unsigned char> pins;
+
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+
+    // steady_clock ticks at the end of the last command
+    std::atomic<std::chrono::steady_clock::rep> lastRelease{0};
+
+    // offerTurn hand-off; 'waiting' while the sampler is ready to take one
+    std::mutex turnLock;
+    std::condition_variable turnChanged;
+    bool waiting = false;
+    bool turnOffered = false;
+    bool turnTaken = false;
+    std::chrono::steady_clock::time_point nextTurn{};
+
+    uint64_t samples = 0;
+    uint64_t published = 0;
+    uint64_t batches = 0;
+    uint64_t dropped = 0;
+    uint64_t backoffs = 0;
+
+    // Two bytes a sample: one 512-byte high-speed packet less its two status bytes
+    static constexpr int MAX_BATCH_SAMPLES = 255;
+
+    static constexpr uint32_t RING_CAPACITY = 64 * 1024;
+
+    // Socket backlog before samples are dropped instead of queued
+    static constexpr size_t MAX_OUTGOING = 1024 * 1024;
+
+    static constexpr std::chrono::milliseconds QUIET_PERIOD{5};
+    static constexpr std::chrono::milliseconds TURN_INTERVAL{20};
+    static constexpr std::chrono::milliseconds TURN_WAIT{2};
+    static constexpr std::chrono::milliseconds IDLE_WAIT{10};
+
+    static constexpr std::string_view ERR_OPEN = "Can't open pin ring {}: {}";
+    static constexpr std::string_view ERR_LISTEN = "Can't listen for pin samples on port {}: {}";
+    static constexpr std::string_view ERR_ADAPTER = "Pin sampling stopped, adapter read failed";
+};
@@ -0,0 +1,44 @@
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "Realtime.h"
+
+
+void Realtime::tuneThread(const pthread_t thread, const int cpu, const int priority, const std::string_view name) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (const int rc = pthread_setaffinity_np(thread, sizeof(set), &set); rc != 0) {
+            spdlog::warn(WARN_AFFINITY, name, cpu, strerror(rc));
+        }
+    }
+
+    if (priority > 0) {
+        sched_param param{};
+        param.sched_priority = priority;
+        if (const int rc = pthread_setschedparam(thread, SCHED_FIFO, &param); rc != 0) {
+            spdlog::warn(WARN_SCHEDULER, priority, name, strerror(rc));
+        }
+    }
+}
+
+void Realtime::lockMemory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        spdlog::warn(WARN_MLOCK, strerror(errno));
+    }
+}
+
+void Realtime::tuneSocket(const int fd, const int busyPollUsec) {
+    if (busyPollUsec > 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busyPollUsec, sizeof(busyPollUsec)) < 0) {
+        spdlog::warn(WARN_BUSY_POLL, strerror(errno));
+    }
+
+    if (int one = 1; setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        spdlog::warn(WARN_NODELAY, strerror(errno));
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <pthread.h>
+#include <string_view>
+
+
+/*
+ * Low-latency runtime helpers: CPU pinning, SCHED_FIFO, locked memory and
+ * busy-polled sockets. Failures are reported and otherwise ignored, since most
+ * of these need privileges the daemon may not have.
+ */
+class Realtime {
+public:
+    static void tuneThread(pthread_t thread, int cpu, int priority, std::string_view name);
+
+    static void lockMemory();
+
+    static void tuneSocket(int fd, int busyPollUsec);
+
+private:
+    static constexpr std::string_view WARN_AFFINITY = "Can't pin {} thread to CPU {}: {}";
+    static constexpr std::string_view WARN_SCHEDULER = "Can't set SCHED_FIFO priority {} on {} thread: {}";
+    static constexpr std::string_view WARN_MLOCK = "mlockall() failed: {}";
+    static constexpr std::string_view WARN_BUSY_POLL = "SO_BUSY_POLL failed: {}";
+    static constexpr std::string_view WARN_NODELAY = "TCP_NODELAY failed: {}";
+};
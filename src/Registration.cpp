@@ -0,0 +1,69 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+#include "Registration.h"
+#include "misc.h"
+
+
+Registration::Registration(const std::string &address, std::vector<uint32_t> idcodes, std::string serial,
+                           const VncProtocol &vnc): idcodes(std::move(idcodes)), serial(std::move(serial)), vnc(vnc) {
+    if (!Misc::splitAddress(address, host, port)) {
+        spdlog::error(ERR_BAD_ADDRESS, address);
+        std::exit(EXIT_FAILURE);
+    }
+    worker = std::thread(&Registration::loop, this);
+}
+
+Registration::~Registration() {
+    {
+        std::lock_guard guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+void Registration::loop() {
+    do {
+        const int fd = Misc::connectTcp(host, port);
+        if (fd < 0) {
+            continue;
+        }
+        if (announce(fd)) {
+            spdlog::info("Registered with broker {}:{}", host, port);
+            while (pause(INTERVAL) && report(fd)) {
+            }
+        }
+        close(fd);
+    } while (pause(RETRY));
+}
+
+// register:<port> <serial> <idcode>[,<idcode>...]\n, '-' for an empty field
+bool Registration::announce(const int fd) const {
+    const auto config = Config::get();
+    std::string line = std::format("register:{} {} ", config->port, serial.empty() ? "-" : serial);
+    for (size_t i = 0; i < idcodes.size(); i++) {
+        line += std::format("{}{:08x}", i ? "," : "", idcodes[i]);
+    }
+    line += idcodes.empty() ? "-\n" : "\n";
+    return send(fd, line.data(), line.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(line.size());
+}
+
+// <busy> <shifts per second> <mean shift latency in us>\n
+bool Registration::report(const int fd) {
+    const uint64_t shifts = vnc.servedShifts.load(std::memory_order_relaxed);
+    const uint64_t nanos = vnc.servedNanos.load(std::memory_order_relaxed);
+    const uint64_t deltaShifts = shifts - lastShifts;
+    const double latencyUs = deltaShifts ? static_cast<double>(nanos - lastNanos) / deltaShifts / 1000 : 0;
+    lastShifts = shifts;
+    lastNanos = nanos;
+
+    const std::string line = std::format("{} {:.0f} {:.1f}\n", vnc.busy ? 1 : 0,
+                                         static_cast<double>(deltaShifts) / INTERVAL.count(), latencyUs);
+    return send(fd, line.data(), line.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(line.size());
+}
+
+bool Registration::pause(const std::chrono::seconds period) {
+    std::unique_lock guard(lock);
+    return !wake.wait_for(guard, period, [this] { return stopping; });
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "xvncd.h"
+
+
+/*
+ * Keeps this xvcd listed with a --broker. On connect it announces the
+ * XVC port, adapter serial and chain IDCODEs, then reports whether a
+ * client is attached, shifts per second and mean shift latency once per
+ * interval. If the broker goes away it retries until it's back.
+ */
+class Registration {
+public:
+    // host:port of the broker; 'serial' is the adapter's, announced as '-' if empty
+    Registration(const std::string &address, std::vector<uint32_t> idcodes, std::string serial,
+                 const VncProtocol &vnc);
+
+    ~Registration();
+
+private:
+    void loop();
+
+    [[nodiscard]] bool announce(int fd) const;
+
+    [[nodiscard]] bool report(int fd);
+
+    // Sleeps up to 'period'; false once stopping
+    [[nodiscard]] bool pause(std::chrono::seconds period);
+
+    std::string host;
+    std::string port;
+    std::vector<uint32_t> idcodes;
+    std::string serial;
+    const VncProtocol &vnc;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+
+    uint64_t lastShifts = 0;
+    uint64_t lastNanos = 0;
+
+    static constexpr std::chrono::seconds INTERVAL{1};
+    static constexpr std::chrono::seconds RETRY{5};
+
+    static constexpr std::string_view ERR_BAD_ADDRESS = "Bad --register address \"{}\", expected host:port";
+};
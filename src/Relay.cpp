@@ -0,0 +1,339 @@
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "Relay.h"
+#include "misc.h"
+
+
+Relay::Relay(const std::string &address) {
+    if (!Misc::splitAddress(address, host, port)) {
+        spdlog::error(ERR_BAD_ADDRESS, address);
+        std::exit(EXIT_FAILURE);
+    }
+    worker = std::thread(&Relay::workerLoop, this);
+}
+
+Relay::~Relay() {
+    {
+        std::lock_guard guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    worker.join();
+    dropUpstream();
+}
+
+void Relay::serve(const int fd) {
+    FILE *fp = fdopen(fd, "r");
+    if (fp == nullptr) {
+        spdlog::error("fdopen failed: {}", strerror(errno));
+        close(fd);
+        return;
+    }
+    // Sessions end when their client goes; the relay lives as long as the process
+    std::thread(&Relay::sessionLoop, this, std::make_shared<Session>(fd, fp)).detach();
+}
+
+void Relay::sessionLoop(const std::shared_ptr<Session> &session) {
+    bool running = true;
+    while (running) {
+        char name[8];
+        size_t length = 0;
+        int c;
+        while ((c = fgetc(session->fp)) != EOF && c != ':' && length < sizeof(name)) {
+            name[length++] = static_cast<char>(c);
+        }
+        if (c == EOF) {
+            break;
+        }
+
+        const std::string_view command(name, length);
+        if (c == ':' && command == "shift") {
+            running = relayShift(session);
+        } else if (c == ':' && command == "settck") {
+            running = relaySetTck(session);
+        } else if (c == ':' && command == "getinfo") {
+            running = relayGetInfo(session);
+        } else {
+            spdlog::error(ERR_UNSUPPORTED);
+            running = false;
+        }
+    }
+    closeSession(session);
+}
+
+bool Relay::relayShift(const std::shared_ptr<Session> &session) {
+    unsigned char header[4];
+    if (fread(header, 1, sizeof(header), session->fp) != sizeof(header)) {
+        Misc::badEOF();
+        return false;
+    }
+    uint32_t bits;
+    std::memcpy(&bits, header, sizeof(bits));
+    const uint32_t bytes = (bits + 7) / 8;
+
+    std::unique_lock guard(lock);
+    // Before the first getinfo: hold clients to what this xvcd advertises itself
+    const uint32_t limit = maxVectorBytes ? maxVectorBytes : MyBuffer::XVC_BUFFER_SIZE;
+    guard.unlock();
+    if (bytes > limit) {
+        spdlog::error(ERR_TOO_LONG, bytes, limit);
+        return false;
+    }
+
+    Request request{session, {'s', 'h', 'i', 'f', 't', ':'}, bytes, 0};
+    request.command.insert(request.command.end(), header, header + sizeof(header));
+    const size_t vectors = request.command.size();
+    request.command.resize(vectors + 2 * bytes);
+    if (fread(request.command.data() + vectors, 1, 2 * bytes, session->fp) != 2 * bytes) {
+        Misc::badEOF();
+        return false;
+    }
+
+    guard.lock();
+    enqueue(std::move(request), guard);
+    return true;
+}
+
+bool Relay::relaySetTck(const std::shared_ptr<Session> &session) {
+    unsigned char value[4];
+    if (fread(value, 1, sizeof(value), session->fp) != sizeof(value)) {
+        Misc::badEOF();
+        return false;
+    }
+    uint32_t period;
+    std::memcpy(&period, value, sizeof(period));
+
+    // Requests are forwarded in order, so the last one queued is the clock upstream will be at
+    std::unique_lock guard(lock);
+    if (period == queuedPeriod && queuedActual) {
+        unsigned char actual[4];
+        std::memcpy(actual, &*queuedActual, sizeof(actual));
+        guard.unlock();
+        return replyLocally(session, actual, sizeof(actual));
+    }
+    queuedPeriod = period;
+    queuedActual.reset();
+
+    Request request{session, {'s', 'e', 't', 't', 'c', 'k', ':'}, 4, period};
+    request.command.insert(request.command.end(), value, value + sizeof(value));
+    enqueue(std::move(request), guard);
+    return true;
+}
+
+bool Relay::relayGetInfo(const std::shared_ptr<Session> &session) {
+    std::unique_lock guard(lock);
+    if (!info.empty()) {
+        const std::string reply = info;
+        guard.unlock();
+        return replyLocally(session, reinterpret_cast<const unsigned char *>(reply.data()), reply.size());
+    }
+    // Not connected yet; the worker answers once it is
+    enqueue(Request{session, {}, 0, 0}, guard);
+    return true;
+}
+
+// Replies stay in order, so a local answer waits for the session's forwarded ones
+bool Relay::replyLocally(const std::shared_ptr<Session> &session, const unsigned char *data, const size_t size) {
+    std::unique_lock guard(lock);
+    delivered.wait(guard, [&session] { return session->outstanding == 0; });
+    guard.unlock();
+    return sendAll(session->fd, data, size);
+}
+
+void Relay::enqueue(Request request, std::unique_lock<std::mutex> &lock) {
+    request.session->outstanding++;
+    queue.push_back(std::move(request));
+    lock.unlock();
+    wake.notify_one();
+}
+
+void Relay::workerLoop() {
+    // Open the connection up front so the first client doesn't pay for it
+    (void) connectUpstream();
+
+    std::unique_lock guard(lock);
+    while (true) {
+        wake.wait(guard, [this] { return stopping || !queue.empty(); });
+        if (stopping) {
+            return;
+        }
+        std::vector<Request> batch;
+        batch.swap(queue);
+        guard.unlock();
+
+        if (!exchange(batch)) {
+            dropUpstream();
+        }
+        guard.lock();
+    }
+}
+
+/*
+ * Send the whole batch in one write, then read the replies back in order
+ * and hand each to its session. Commands queued meanwhile form the next
+ * batch.
+ */
+bool Relay::exchange(std::vector<Request> &batch) {
+    if (upstream < 0 && !connectUpstream()) {
+        fail(batch, 0);
+        return false;
+    }
+
+    std::vector<unsigned char> out;
+    for (const auto &request: batch) {
+        out.insert(out.end(), request.command.begin(), request.command.end());
+    }
+    if (!sendAll(upstream, out.data(), out.size())) {
+        spdlog::error(ERR_UPSTREAM, host, port);
+        fail(batch, 0);
+        return false;
+    }
+    batches++;
+    commands += batch.size();
+
+    std::vector<unsigned char> reply;
+    for (size_t i = 0; i < batch.size(); i++) {
+        const auto &request = batch[i];
+        if (request.command.empty()) {
+            std::lock_guard guard(lock);
+            reply.assign(info.begin(), info.end());
+        } else {
+            reply.resize(request.replySize);
+            if (!receive(reply.data(), reply.size())) {
+                spdlog::error(ERR_UPSTREAM, host, port);
+                fail(batch, i);
+                return false;
+            }
+        }
+        if (request.period) {
+            sentPeriod = request.period;
+            std::lock_guard guard(lock);
+            if (queuedPeriod == request.period) {
+                uint32_t actual;
+                std::memcpy(&actual, reply.data(), sizeof(actual));
+                queuedActual = actual;
+            }
+        }
+
+        if (!sendAll(request.session->fd, reply.data(), reply.size())) {
+            shutdown(request.session->fd, SHUT_RDWR);
+        }
+        {
+            std::lock_guard guard(lock);
+            request.session->outstanding--;
+        }
+        delivered.notify_all();
+    }
+    return true;
+}
+
+// Sessions that lose a reply are hung up on; their clients reconnect
+void Relay::fail(std::vector<Request> &batch, const size_t from) {
+    {
+        std::lock_guard guard(lock);
+        for (size_t i = from; i < batch.size(); i++) {
+            shutdown(batch[i].session->fd, SHUT_RDWR);
+            batch[i].session->outstanding--;
+        }
+    }
+    delivered.notify_all();
+}
+
+bool Relay::connectUpstream() {
+    upstream = Misc::connectTcp(host, port);
+    if (upstream < 0) {
+        return false;
+    }
+
+    // The remote's vector size is what local clients get told
+    static constexpr unsigned char GETINFO[] = {'g', 'e', 't', 'i', 'n', 'f', 'o', ':'};
+    std::string reply;
+    if (sendAll(upstream, GETINFO, sizeof(GETINFO))) {
+        unsigned char c;
+        while (reply.size() < MAX_INFO_SIZE && receive(&c, 1)) {
+            reply.push_back(static_cast<char>(c));
+            if (c == '\n') {
+                break;
+            }
+        }
+    }
+    const auto colon = reply.rfind(':');
+    if (reply.empty() || reply.back() != '\n' || colon == std::string::npos) {
+        spdlog::error(ERR_UPSTREAM, host, port);
+        dropUpstream();
+        return false;
+    }
+
+    // A new connection may come up at a different clock; restore the last one sent
+    std::optional<uint32_t> actual;
+    if (sentPeriod) {
+        unsigned char settck[11] = {'s', 'e', 't', 't', 'c', 'k', ':'};
+        std::memcpy(settck + 7, &sentPeriod, sizeof(sentPeriod));
+        unsigned char value[4];
+        if (!sendAll(upstream, settck, sizeof(settck)) || !receive(value, sizeof(value))) {
+            spdlog::error(ERR_UPSTREAM, host, port);
+            dropUpstream();
+            return false;
+        }
+        actual.emplace();
+        std::memcpy(&*actual, value, sizeof(value));
+    }
+
+    spdlog::info("Relaying to {}:{} ({})", host, port, reply.substr(0, reply.size() - 1));
+    std::lock_guard guard(lock);
+    info = reply;
+    maxVectorBytes = std::strtoul(reply.c_str() + colon + 1, nullptr, 10);
+    if (actual && queuedPeriod == sentPeriod) {
+        queuedActual = actual;
+    }
+    return true;
+}
+
+void Relay::dropUpstream() {
+    if (upstream >= 0) {
+        close(upstream);
+        upstream = -1;
+        spdlog::info("Relayed {} commands in {} writes", commands, batches);
+    }
+}
+
+bool Relay::receive(unsigned char *data, size_t size) const {
+    while (size > 0) {
+        const ssize_t n = recv(upstream, data, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// MSG_NOSIGNAL: a client that hung up mustn't take the relay down with SIGPIPE
+bool Relay::sendAll(const int fd, const unsigned char *data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+void Relay::closeSession(const std::shared_ptr<Session> &session) {
+    std::unique_lock guard(lock);
+    delivered.wait(guard, [&session] { return session->outstanding == 0; });
+    guard.unlock();
+    fclose(session->fp);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/*
+ * XVC relay for boards behind a WAN hop. Local clients are served by one
+ * thread each, and their commands are forwarded to a remote xvcd over one
+ * persistent connection. Whatever is queued from any session while the
+ * previous batch is in flight goes out in the next single write, and the
+ * replies come back in order and are routed to their sessions. getinfo:,
+ * and settck: for the clock already set upstream, are answered locally.
+ * Only the standard commands are relayed.
+ */
+class Relay {
+public:
+    // host:port of the remote xvcd
+    explicit Relay(const std::string &address);
+
+    ~Relay();
+
+    // Takes over an accepted client socket
+    void serve(int fd);
+
+private:
+    struct Session {
+        int fd;
+        FILE *fp;
+
+        // Forwarded commands whose replies haven't been delivered
+        uint32_t outstanding = 0;
+    };
+
+    struct Request {
+        std::shared_ptr<Session> session;
+        std::vector<unsigned char> command;
+
+        // Bytes in the upstream reply; a request with no command gets the cached getinfo: reply
+        uint32_t replySize;
+
+        // Requested period of a settck:, 0 for other commands
+        uint32_t period;
+    };
+
+    void sessionLoop(const std::shared_ptr<Session> &session);
+
+    [[nodiscard]] bool relayShift(const std::shared_ptr<Session> &session);
+
+    [[nodiscard]] bool relaySetTck(const std::shared_ptr<Session> &session);
+
+    [[nodiscard]] bool relayGetInfo(const std::shared_ptr<Session> &session);
+
+    [[nodiscard]] bool replyLocally(const std::shared_ptr<Session> &session, const unsigned char *data, size_t size);
+
+    void enqueue(Request request, std::unique_lock<std::mutex> &lock);
+
+    void workerLoop();
+
+    [[nodiscard]] bool connectUpstream();
+
+    void dropUpstream();
+
+    [[nodiscard]] bool exchange(std::vector<Request> &batch);
+
+    void fail(std::vector<Request> &batch, size_t from);
+
+    [[nodiscard]] bool receive(unsigned char *data, size_t size) const;
+
+    [[nodiscard]] static bool sendAll(int fd, const unsigned char *data, size_t size);
+
+    void closeSession(const std::shared_ptr<Session> &session);
+
+    std::string host;
+    std::string port;
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable delivered;
+    std::vector<Request> queue;
+    bool stopping = false;
+
+    // Upstream state, guarded by lock
+    std::string info;
+    uint32_t maxVectorBytes = 0;
+    uint32_t queuedPeriod = 0;
+    std::optional<uint32_t> queuedActual;
+
+    // Worker only
+    int upstream = -1;
+    uint32_t sentPeriod = 0;
+    uint64_t batches = 0;
+    uint64_t commands = 0;
+
+    std::thread worker;
+
+    static constexpr size_t MAX_INFO_SIZE = 128;
+
+    static constexpr std::string_view ERR_BAD_ADDRESS = "Bad --relay address \"{}\", expected host:port";
+    static constexpr std::string_view ERR_UPSTREAM = "Lost relay connection to {}:{}";
+    static constexpr std::string_view ERR_UNSUPPORTED = "Relay only forwards getinfo:, settck: and shift:";
+    static constexpr std::string_view ERR_TOO_LONG = "Client requested {} bytes, upstream max is {}";
+};
@@ -0,0 +1,120 @@
+#include <algorithm>
+#include "ScanBridge.h"
+
+
+ScanBridge::ScanBridge(ShiftEngine &engine, const uint32_t instruction, const uint32_t irLength,
+                       uint32_t &idleCycles): engine(engine), instruction(instruction), irLength(irLength),
+                                              idleCycles(idleCycles) {
+    this->idleCycles = std::clamp(idleCycles, MIN_IDLE_CYCLES, MAX_IDLE_CYCLES);
+}
+
+uint32_t ScanBridge::read(const uint32_t address, const uint32_t count, std::vector<uint32_t> &data) {
+    data.resize(count);
+    const uint32_t status = run(address, count, nullptr, data.data());
+    data.resize(completed);
+    return status;
+}
+
+uint32_t ScanBridge::write(const uint32_t address, const std::vector<uint32_t> &data) {
+    return run(address, static_cast<uint32_t>(data.size()), data.data(), nullptr);
+}
+
+uint32_t ScanBridge::run(const uint32_t address, const uint32_t count, const uint32_t *source, uint32_t *sink) {
+    completed = 0;
+    while (completed < count) {
+        const uint32_t n = count - completed;
+        if (!batch(address / 4 + completed, n, source ? source + completed : nullptr)) {
+            return STATUS_JTAG_ERROR;
+        }
+
+        // Scan k + 1 captured the result of command k
+        uint32_t done = 0;
+        for (; done < n; done++) {
+            const uint32_t at = captures[done + 1];
+            uint64_t result = 0;
+            for (uint32_t i = 0; i < DR_LENGTH; i++) {
+                result |= static_cast<uint64_t>(ShiftPlanner::bit(tdo.data(), at + i)) << i;
+            }
+            if (!(result & RESULT_DONE)) {
+                break;
+            }
+            if (result & RESULT_ERROR) {
+                completed += done;
+                return STATUS_AXI_ERROR;
+            }
+            if (sink) {
+                sink[completed + done] = static_cast<uint32_t>(result >> 32);
+            }
+        }
+        completed += done;
+
+        if (done < n) {
+            if (idleCycles == MAX_IDLE_CYCLES) {
+                return STATUS_TIMEOUT;
+            }
+            idleCycles = std::min(idleCycles * 2, MAX_IDLE_CYCLES);
+        }
+    }
+    return STATUS_OK;
+}
+
+/*
+ * Starts with a TAP reset so it doesn't matter where the client left the
+ * chain, and ends in Run-Test/Idle with the bridge still selected.
+ */
+int ScanBridge::batch(const uint32_t wordAddress, const uint32_t count, const uint32_t *source) {
+    const uint32_t scanBits = 3 + DR_LENGTH + 1 + idleCycles;
+    const uint32_t total = 6 + 4 + irLength + 2 + (count + 1) * scanBits;
+    tms.assign((total + 7) / 8, 0);
+    tdi.assign(tms.size(), 0);
+    tdo.resize(tms.size());
+    captures.clear();
+    bits = 0;
+
+    // Test-Logic-Reset, Run-Test/Idle
+    for (int i = 0; i < 5; i++) {
+        clock(true);
+    }
+    clock(false);
+
+    // Select-DR, Select-IR, Capture-IR, Shift-IR, the instruction, Update-IR, Run-Test/Idle
+    clock(true);
+    clock(true);
+    clock(false);
+    clock(false);
+    for (uint32_t i = 0; i < irLength; i++) {
+        clock(i == irLength - 1, instruction >> i & 1);
+    }
+    clock(true);
+    clock(false);
+
+    for (uint32_t k = 0; k <= count; k++) {
+        uint64_t command = 0;
+        if (k < count) {
+            command = CMD_VALID | static_cast<uint64_t>((wordAddress + k) & 0x3FFFFFFF) << 2;
+            if (source) {
+                command |= CMD_WRITE | static_cast<uint64_t>(source[k]) << 32;
+            }
+        }
+
+        // Select-DR, Capture-DR, Shift-DR, the command, Update-DR, Run-Test/Idle
+        clock(true);
+        clock(false);
+        clock(false);
+        captures.push_back(bits);
+        for (uint32_t i = 0; i < DR_LENGTH; i++) {
+            clock(i == DR_LENGTH - 1, command >> i & 1);
+        }
+        clock(true);
+        for (uint32_t i = 0; i < idleCycles; i++) {
+            clock(false);
+        }
+    }
+    return engine.shift(bits, tms.data(), tdi.data(), tdo.data());
+}
+
+void ScanBridge::clock(const bool tmsBit, const bool tdiBit) {
+    tms[bits / 8] |= tmsBit << (bits % 8);
+    tdi[bits / 8] |= tdiBit << (bits % 8);
+    bits++;
+}
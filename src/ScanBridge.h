@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "ShiftEngine.h"
+
+
+/*
+ * Memory access through a small custom bridge core behind a USER
+ * instruction (a BSCANE2 driving an AXI master), which must be built into
+ * the design. This is not Xilinx's JTAG-to-AXI Master IP, whose protocol
+ * is not published; the register layout below is this project's own. The
+ * bridge's 64-bit data register takes one command per DR scan:
+ *
+ *   in:  bit 0 valid, bit 1 write, bits 2-31 word address, bits 32-63 write data
+ *   out: bit 0 done, bit 1 error (SLVERR/DECERR), bits 32-63 read data
+ *
+ * Capture-DR loads the result of the command before, so the commands of
+ * a burst are pipelined one per scan with a few Run-Test/Idle cycles
+ * between them for the AXI side to finish, and a whole batch goes to the
+ * engine as one shift. A command that was not done by the next capture
+ * is issued again, with more idle cycles, from the first word that
+ * missed.
+ */
+class ScanBridge {
+public:
+    // 'idleCycles' carries what the last burst learned over to the next one
+    ScanBridge(ShiftEngine &engine, uint32_t instruction, uint32_t irLength, uint32_t &idleCycles);
+
+    // Byte address, word aligned; 'data' holds up to MAX_WORDS words read or to write
+    [[nodiscard]] uint32_t read(uint32_t address, uint32_t count, std::vector<uint32_t> &data);
+
+    [[nodiscard]] uint32_t write(uint32_t address, const std::vector<uint32_t> &data);
+
+    // Words done before the burst stopped
+    uint32_t completed = 0;
+
+    static constexpr uint32_t STATUS_OK = 0;
+    static constexpr uint32_t STATUS_AXI_ERROR = 1;
+    static constexpr uint32_t STATUS_TIMEOUT = 2;
+    static constexpr uint32_t STATUS_JTAG_ERROR = 3;
+
+    /*
+     * Words per burst, each a single-beat command with its own DR scan. At
+     * MAX_IDLE_CYCLES a scan is over 4 Kbit, so this keeps a batch's TMS,
+     * TDI and TDO vectors to about 130 KB each.
+     */
+    static constexpr uint32_t MAX_WORDS = 256;
+
+private:
+    // Writes 'source' if given, otherwise reads into 'sink'
+    [[nodiscard]] uint32_t run(uint32_t address, uint32_t count, const uint32_t *source, uint32_t *sink);
+
+    // One shift: select the bridge, 'count' commands and a trailing no-op to collect the last result
+    [[nodiscard]] int batch(uint32_t wordAddress, uint32_t count, const uint32_t *source);
+
+    void clock(bool tms, bool tdi = false);
+
+    ShiftEngine &engine;
+    uint32_t instruction;
+    uint32_t irLength;
+    uint32_t &idleCycles;
+
+    std::vector<unsigned char> tms;
+    std::vector<unsigned char> tdi;
+    std::vector<unsigned char> tdo;
+    uint32_t bits = 0;
+
+    // Where each scan's captured result starts in tdo
+    std::vector<uint32_t> captures;
+
+    static constexpr uint32_t DR_LENGTH = 64;
+    static constexpr uint64_t CMD_VALID = 0x1;
+    static constexpr uint64_t CMD_WRITE = 0x2;
+    static constexpr uint64_t RESULT_DONE = 0x1;
+    static constexpr uint64_t RESULT_ERROR = 0x2;
+
+    static constexpr uint32_t MIN_IDLE_CYCLES = 2;
+    static constexpr uint32_t MAX_IDLE_CYCLES = 4096;
+};
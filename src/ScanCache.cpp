@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <spdlog/spdlog.h>
+#include "ScanCache.h"
+
+
+ScanCache::ScanCache(const std::chrono::milliseconds ttl, const std::string &instructions): ttl(ttl) {
+    std::istringstream list(instructions);
+    for (std::string item; std::getline(list, item, ',');) {
+        char *end;
+        const uint32_t value = std::strtoul(item.c_str(), &end, 16);
+        const bool separated = *end == '/';
+        const uint32_t length = separated ? std::strtoul(end + 1, &end, 10) : 0;
+        if (!separated || *end != '\0' || length == 0 || length > 32 || (length < 32 && value >> length)) {
+            spdlog::error(ERR_BAD_INSTRUCTION, item);
+            std::exit(EXIT_FAILURE);
+        }
+        this->instructions.push_back({value, length});
+    }
+}
+
+int ScanCache::shift(ShiftEngine &engine, const uint32_t bits, const unsigned char *tms, const unsigned char *tdi,
+                     unsigned char *tdo, const bool fresh) {
+    const bool reset = startsInReset(bits, tms);
+    if (reset) {
+        // The hardware resets along with it, wherever the last hit left it
+        replayBits = 0;
+    }
+    if (reset && !fresh) {
+        if (const Entry *entry = lookup(bits, tms, tdi)) {
+            std::memcpy(tdo, entry->tdo.data(), entry->tdo.size());
+            replayBits = entry->bits;
+            replayVectors = entry->vectors;
+            (void) follow(bits, tms, tdi);
+            hits++;
+            return 1;
+        }
+        misses++;
+    }
+
+    if (!replay(engine) || !engine.shift(bits, tms, tdi, tdo)) {
+        return 0;
+    }
+    record(bits, tms, tdi, tdo);
+    return 1;
+}
+
+int ScanCache::shift(ShiftEngine &engine, const uint32_t bits, const unsigned char *tms, const unsigned char *tdi,
+                     unsigned char *tdo, ShiftStream &stream) {
+    const uint32_t bytes = (bits + 7) / 8;
+    if (startsInReset(bits, tms)) {
+        return stream.fillTdi(bytes) && shift(engine, bits, tms, tdi, tdo) && stream.drainTdo(bytes);
+    }
+
+    if (!replay(engine) || !engine.shift(bits, tms, tdi, tdo, stream)) {
+        return 0;
+    }
+    record(bits, tms, tdi, tdo);
+    return 1;
+}
+
+/*
+ * The other path starts from where the client believes the TAP is, so a
+ * hit the hardware hasn't caught up with is replayed before letting go.
+ */
+int ScanCache::forget(ShiftEngine &engine) {
+    const int replayed = replay(engine);
+    invalidate();
+    state = UNKNOWN;
+    replayBits = 0;
+    return replayed;
+}
+
+void ScanCache::printStatistic() const {
+    spdlog::info("Scan cache: {} hits, {} misses, {} replays, {} invalidations", hits, misses, replays,
+                 invalidations);
+}
+
+bool ScanCache::startsInReset(const uint32_t bits, const unsigned char *tms) {
+    if (bits < RESET_TMS_BITS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < RESET_TMS_BITS; i++) {
+        if (!ShiftPlanner::bit(tms, i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// FNV-1a over the length and both vectors
+uint64_t ScanCache::hash(const uint32_t bits, const unsigned char *tms, const unsigned char *tdi) {
+    uint64_t h = 0xcbf29ce484222325;
+    const auto mix = [&h](const unsigned char byte) {
+        h = (h ^ byte) * 0x100000001b3;
+    };
+    for (int i = 0; i < 32; i += 8) {
+        mix(static_cast<unsigned char>(bits >> i));
+    }
+    const uint32_t bytes = (bits + 7) / 8;
+    std::for_each(tms, tms + bytes, mix);
+    std::for_each(tdi, tdi + bytes, mix);
+    return h;
+}
+
+const ScanCache::Entry *ScanCache::lookup(const uint32_t bits, const unsigned char *tms, const unsigned char *tdi) {
+    const auto found = entries.find(hash(bits, tms, tdi));
+    if (found == entries.end()) {
+        return nullptr;
+    }
+    const Entry &entry = found->second;
+    const uint32_t bytes = (bits + 7) / 8;
+    if (entry.bits != bits || std::memcmp(entry.vectors.data(), tms, bytes) != 0 ||
+        std::memcmp(entry.vectors.data() + bytes, tdi, bytes) != 0) {
+        return nullptr;
+    }
+    if (std::chrono::steady_clock::now() >= entry.expires) {
+        entries.erase(found);
+        return nullptr;
+    }
+    return &entry;
+}
+
+// A hit is read-only, so running it again only moves the TAP to where the client expects it
+int ScanCache::replay(ShiftEngine &engine) {
+    if (!replayBits) {
+        return 1;
+    }
+    const uint32_t bytes = (replayBits + 7) / 8;
+    replayTdo.resize(bytes);
+    const uint32_t bits = replayBits;
+    replayBits = 0;
+    replays++;
+    return engine.shift(bits, replayVectors.data(), replayVectors.data() + bytes, replayTdo.data());
+}
+
+/*
+ * TDI is shifted on the rising edge in Shift-IR/DR, before TMS moves the
+ * state on. Five TMS ones reset the TAP from anywhere. Bits clocked while
+ * the state is unknown could have shifted anything.
+ */
+bool ScanCache::follow(const uint32_t bits, const unsigned char *tms, const unsigned char *tdi) {
+    bool clean = true;
+    uint32_t ones = 0;
+    for (uint32_t i = 0; i < bits; i++) {
+        const bool tmsBit = ShiftPlanner::bit(tms, i);
+        switch (state) {
+            case UNKNOWN: clean = false;
+                break;
+            case SHIFT_IR: irBits.push_back(ShiftPlanner::bit(tdi, i));
+                break;
+            case SHIFT_DR: clean = clean && readOnly;
+                break;
+            default:
+                break;
+        }
+
+        ones = tmsBit ? ones + 1 : 0;
+        if (ones >= RESET_TMS_BITS) {
+            state = RESET;
+        } else if (state != UNKNOWN) {
+            state = NEXT_STATE[state][tmsBit];
+        }
+
+        switch (state) {
+            // IDCODE or BYPASS after reset
+            case RESET: readOnly = true;
+                break;
+            case CAPTURE_IR: irBits.clear();
+                break;
+            case UPDATE_IR: readOnly = whitelisted();
+                clean = clean && readOnly;
+                break;
+            default:
+                break;
+        }
+    }
+    return clean;
+}
+
+// One whitelisted instruction anywhere in the IR scan, every other device in BYPASS
+bool ScanCache::whitelisted() const {
+    const auto n = static_cast<uint32_t>(irBits.size());
+    if (n == 0) {
+        return false;
+    }
+    if (std::ranges::all_of(irBits, [](const bool b) { return b; })) {
+        return true;
+    }
+    for (const auto &[value, length]: instructions) {
+        for (uint32_t offset = 0; offset + length <= n; offset++) {
+            bool match = true;
+            for (uint32_t i = 0; i < n && match; i++) {
+                const bool inside = i >= offset && i < offset + length;
+                match = irBits[i] == (inside ? (value >> (i - offset) & 1) != 0 : true);
+            }
+            if (match) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ScanCache::record(const uint32_t bits, const unsigned char *tms, const unsigned char *tdi,
+                       const unsigned char *tdo) {
+    const bool reset = startsInReset(bits, tms);
+    if (!follow(bits, tms, tdi)) {
+        invalidate();
+        return;
+    }
+    if (!reset) {
+        return;
+    }
+
+    if (entries.size() >= MAX_ENTRIES) {
+        entries.clear();
+    }
+    const uint32_t bytes = (bits + 7) / 8;
+    Entry &entry = entries[hash(bits, tms, tdi)];
+    entry.bits = bits;
+    entry.vectors.assign(tms, tms + bytes);
+    entry.vectors.insert(entry.vectors.end(), tdi, tdi + bytes);
+    entry.tdo.assign(tdo, tdo + bytes);
+    entry.expires = std::chrono::steady_clock::now() + ttl;
+}
+
+void ScanCache::invalidate() {
+    if (!entries.empty()) {
+        entries.clear();
+        invalidations++;
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ShiftEngine.h"
+
+
+/*
+ * Opt-in memo of read-only scans (--scan-cache). A shift qualifies when
+ * its TMS opens with five ones, so it starts from Test-Logic-Reset
+ * whatever came before, and every instruction it loads is on the
+ * whitelist, with the rest of the chain in BYPASS. Qualifying shifts are
+ * kept by a hash of their vectors and answered from memory until they
+ * expire. Every shift is followed through the TAP state machine; one that
+ * loads another instruction, or shifts DR while one is loaded, drops the
+ * whole cache.
+ *
+ * A hit leaves the hardware TAP where the previous real shift left it.
+ * That only matters if the next shift carries on from where the hit
+ * ended instead of resetting, so the hit is replayed on the hardware
+ * first in that case.
+ */
+class ScanCache {
+public:
+    // 'instructions' is value/length[,value/length...], values in hex
+    ScanCache(std::chrono::milliseconds ttl, const std::string &instructions);
+
+    // Served from the cache when possible; 'fresh' always goes to the hardware
+    [[nodiscard]] int shift(ShiftEngine &engine, uint32_t bits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo, bool fresh = false);
+
+    // The same for cut-through shifts; TDI is read ahead only for shifts that could hit
+    [[nodiscard]] int shift(ShiftEngine &engine, uint32_t bits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo, ShiftStream &stream);
+
+    // The TAP is about to be driven some other way (SVF, GPIO, mpsse:); a pending hit is replayed first
+    [[nodiscard]] int forget(ShiftEngine &engine);
+
+    void printStatistic() const;
+
+private:
+    enum State {
+        RESET, IDLE, SELECT_DR, CAPTURE_DR, SHIFT_DR, EXIT1_DR, PAUSE_DR, EXIT2_DR, UPDATE_DR,
+        SELECT_IR, CAPTURE_IR, SHIFT_IR, EXIT1_IR, PAUSE_IR, EXIT2_IR, UPDATE_IR, UNKNOWN
+    };
+
+    struct Instruction {
+        uint32_t value;
+        uint32_t length;
+    };
+
+    struct Entry {
+        uint32_t bits;
+        std::vector<unsigned char> vectors;
+        std::vector<unsigned char> tdo;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    [[nodiscard]] static bool startsInReset(uint32_t bits, const unsigned char *tms);
+
+    [[nodiscard]] static uint64_t hash(uint32_t bits, const unsigned char *tms, const unsigned char *tdi);
+
+    [[nodiscard]] const Entry *lookup(uint32_t bits, const unsigned char *tms, const unsigned char *tdi);
+
+    [[nodiscard]] int replay(ShiftEngine &engine);
+
+    // Follows the shift through the TAP; true if it stayed read-only throughout
+    [[nodiscard]] bool follow(uint32_t bits, const unsigned char *tms, const unsigned char *tdi);
+
+    [[nodiscard]] bool whitelisted() const;
+
+    // Store it if it qualifies, drop everything if it may have written
+    void record(uint32_t bits, const unsigned char *tms, const unsigned char *tdi, const unsigned char *tdo);
+
+    void invalidate();
+
+    std::chrono::milliseconds ttl;
+    std::vector<Instruction> instructions;
+    std::unordered_map<uint64_t, Entry> entries;
+
+    // Where the client believes the TAP is, and whether the loaded instruction only reads
+    State state = UNKNOWN;
+    bool readOnly = false;
+    std::vector<bool> irBits;
+
+    // Vectors of the last hit, until the hardware catches up with it
+    uint32_t replayBits = 0;
+    std::vector<unsigned char> replayVectors;
+    std::vector<unsigned char> replayTdo;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t replays = 0;
+    uint64_t invalidations = 0;
+
+    static constexpr uint32_t RESET_TMS_BITS = 5;
+    static constexpr size_t MAX_ENTRIES = 256;
+
+    static constexpr State NEXT_STATE[16][2] = {
+        {IDLE, RESET}, {IDLE, SELECT_DR}, {CAPTURE_DR, SELECT_IR}, {SHIFT_DR, EXIT1_DR},
+        {SHIFT_DR, EXIT1_DR}, {PAUSE_DR, UPDATE_DR}, {PAUSE_DR, EXIT2_DR}, {SHIFT_DR, UPDATE_DR},
+        {IDLE, SELECT_DR}, {CAPTURE_IR, RESET}, {SHIFT_IR, EXIT1_IR}, {SHIFT_IR, EXIT1_IR},
+        {PAUSE_IR, UPDATE_IR}, {PAUSE_IR, EXIT2_IR}, {SHIFT_IR, UPDATE_IR}, {IDLE, SELECT_DR}
+    };
+
+    static constexpr std::string_view ERR_BAD_INSTRUCTION = "Bad --scan-cache-ir entry \"{}\", expected value/length";
+};
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <bit>
+#include "SelfTest.h"
+
+
+SelfTest::SelfTest(const FTDI &ftdi): ftdi(ftdi), random(std::random_device{}()) {
+    // -c pins the test to one frequency
+    if (const auto lockedSpeed = Config::get()->lockedSpeed) {
+        frequencies = {lockedSpeed};
+    }
+}
+
+int SelfTest::run() {
+    engine = ShiftEngine::createLocal(ftdi);
+    ftdi.set_loopback(true);
+
+    spdlog::info("   TCK Hz     Bits  Shifts   Mbit/s    Eff   p50 us   p99 us   max us  Errors");
+    int result = 1;
+    for (const auto frequency: frequencies) {
+        for (const auto shiftBits: SHIFT_SIZES) {
+            Result setting{frequency, shiftBits};
+            if (!measure(setting)) {
+                result = 0;
+                break;
+            }
+            report(setting);
+            if (setting.errors) {
+                result = 0;
+            }
+        }
+    }
+
+    ftdi.set_loopback(false);
+    return ftdi.flush() && result;
+}
+
+/*
+ * TMS stays low so every bit goes out through a TDI command and comes
+ * back unchanged; TMS commands would hold TDI at one level instead.
+ */
+int SelfTest::measure(Result &result) {
+    if (!engine->setClock(result.frequency)) {
+        return 0;
+    }
+    result.frequency = ftdi.clock_frequency();
+
+    const uint32_t bytes = (result.shiftBits + 7) / 8;
+    const unsigned char lastMask = result.shiftBits % 8 ? (1 << result.shiftBits % 8) - 1 : 0xFF;
+    const std::vector<unsigned char> tms(bytes);
+    std::vector<unsigned char> tdi(bytes);
+    std::vector<unsigned char> tdo(bytes);
+
+    const auto start = std::chrono::steady_clock::now();
+    while (result.shifts < MAX_SHIFTS &&
+           (result.shifts < MIN_SHIFTS || std::chrono::steady_clock::now() - start < SETTING_TIME)) {
+        std::ranges::generate(tdi, [this] { return static_cast<unsigned char>(random()); });
+
+        const auto before = std::chrono::steady_clock::now();
+        if (!engine->shift(result.shiftBits, tms.data(), tdi.data(), tdo.data())) {
+            return 0;
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - before;
+        result.seconds += elapsed.count();
+        result.latencyUs.push_back(elapsed.count() * 1e6);
+        result.shifts++;
+
+        tdo[bytes - 1] &= lastMask;
+        tdi[bytes - 1] &= lastMask;
+        if (const auto [differs, _] = std::ranges::mismatch(tdi, tdo); differs != tdi.end()) {
+            const auto at = differs - tdi.begin();
+            if (result.errors++ == 0) {
+                spdlog::error(ERR_MISMATCH, result.frequency, result.shiftBits,
+                              at * 8 + std::countr_zero(static_cast<unsigned>(*differs ^ tdo[at])));
+            }
+        }
+    }
+    return 1;
+}
+
+void SelfTest::report(Result &result) {
+    std::ranges::sort(result.latencyUs);
+    const auto percentile = [&result](const double p) {
+        return result.latencyUs[static_cast<size_t>(p * (result.latencyUs.size() - 1))];
+    };
+
+    const double bitRate = static_cast<double>(result.shiftBits) * result.shifts / result.seconds;
+    spdlog::info("{:>9} {:>8} {:>7} {:>8.2f} {:>5.1f}% {:>8.0f} {:>8.0f} {:>8.0f} {:>7}",
+                 result.frequency, result.shiftBits, result.shifts, bitRate / 1e6,
+                 100.0 * bitRate / result.frequency, percentile(0.5), percentile(0.99), result.latencyUs.back(),
+                 result.errors);
+}
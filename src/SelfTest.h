@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+#include "ShiftEngine.h"
+
+
+/*
+ * Adapter throughput self-test. With the MPSSE internal loopback on, TDO
+ * is TDI, so no target is needed: random vectors are shifted through the
+ * same engine and USB path as client shifts over a sweep of TCK
+ * frequencies and shift sizes. Each setting reports achieved bit rate,
+ * per-shift round trip latency and efficiency against the TCK rate.
+ */
+class SelfTest {
+public:
+    explicit SelfTest(const FTDI &ftdi);
+
+    [[nodiscard]] int run();
+
+private:
+    struct Result {
+        unsigned int frequency;
+        uint32_t shiftBits;
+        uint32_t shifts = 0;
+        uint32_t errors = 0;
+        double seconds = 0;
+        std::vector<double> latencyUs;
+    };
+
+    [[nodiscard]] int measure(Result &result);
+
+    static void report(Result &result);
+
+    const FTDI &ftdi;
+    std::unique_ptr<ShiftEngine> engine;
+    std::mt19937 random;
+
+    std::vector<unsigned int> frequencies{30000000, 15000000, 10000000, 6000000, 3000000, 1000000};
+    static constexpr uint32_t SHIFT_SIZES[] = {32, 256, 2048, 16384, 131072};
+
+    // Each setting runs for about this long, within the shift count limits
+    static constexpr std::chrono::milliseconds SETTING_TIME{250};
+    static constexpr uint32_t MIN_SHIFTS = 8;
+    static constexpr uint32_t MAX_SHIFTS = 2000;
+
+    static constexpr std::string_view ERR_MISMATCH = "{} Hz, {} bits: loopback TDO differs from TDI at bit {}";
+};
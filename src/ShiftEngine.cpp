@@ -0,0 +1,486 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <spdlog/spdlog.h>
+#include "ShiftEngine.h"
+#include "BroadcastEngine.h"
+#include "BitbangEngine.h"
+#include "MmioEngine.h"
+
+
+std::unique_ptr<ShiftEngine> ShiftEngine::create(const FTDI &ftdi) {
+    const auto config = Config::get();
+    if (!config->bitbangAddress.empty()) {
+        auto engine = std::make_unique<BitbangEngine>(config->bitbangAddress);
+        if (!engine->open()) {
+            return nullptr;
+        }
+        return engine;
+    }
+    if (!config->mmioPath.empty()) {
+        auto engine = std::make_unique<MmioEngine>(config->mmioPath);
+        if (!engine->open()) {
+            return nullptr;
+        }
+        return engine;
+    }
+    if (config->broadcastSerials.empty()) {
+        return createLocal(ftdi);
+    }
+    auto engine = std::make_unique<BroadcastEngine>(ftdi, config->broadcastSerials);
+    if (!engine->open()) {
+        return nullptr;
+    }
+    return engine;
+}
+
+std::unique_ptr<ShiftEngine> ShiftEngine::createLocal(const FTDI &ftdi) {
+    const auto config = Config::get();
+    const auto *flags = config->flags.get();
+    if (flags->loopback || flags->statisticsFlag || flags->showUSB || flags->showXVC || flags->runtFlag) {
+        return std::make_unique<PlannedShiftEngine<DiagnosticShiftPolicy> >(ftdi);
+    }
+    return std::make_unique<PlannedShiftEngine<FastShiftPolicy> >(ftdi);
+}
+
+template<typename Policy>
+PlannedShiftEngine<Policy>::PlannedShiftEngine(const FTDI &ftdi): ftdi(ftdi) {
+    const auto config = Config::get();
+    loopback = config->flags->loopback;
+    if (config->shiftThreads >= 0) {
+        workerCount = static_cast<unsigned>(config->shiftThreads);
+    } else {
+        const unsigned cores = std::thread::hardware_concurrency();
+        workerCount = std::min(cores ? cores - 1 : 0, MAX_AUTO_WORKERS);
+    }
+}
+
+int ShiftEngine::shift(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                       unsigned char *tdo, ShiftStream &stream) {
+    const uint32_t bytes = (shiftBits + 7) / 8;
+    return stream.fillTdi(bytes) && shift(shiftBits, tms, tdi, tdo) && stream.drainTdo(bytes);
+}
+
+int ShiftEngine::idle(uint64_t cycles, const bool tms) {
+    const std::vector<unsigned char> tmsBits(IDLE_CHUNK_BITS / 8, tms ? 0xFF : 0);
+    const std::vector<unsigned char> tdi(IDLE_CHUNK_BITS / 8, 0);
+    std::vector<unsigned char> tdo(IDLE_CHUNK_BITS / 8);
+    while (cycles) {
+        const auto chunk = static_cast<uint32_t>(std::min<uint64_t>(cycles, IDLE_CHUNK_BITS));
+        if (!shift(chunk, tmsBits.data(), tdi.data(), tdo.data())) {
+            return 0;
+        }
+        cycles -= chunk;
+    }
+    return 1;
+}
+
+template<typename Policy>
+int PlannedShiftEngine<Policy>::shift(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                                      unsigned char *tdo) {
+    ftdi.forget_jtag_pins();
+    if (workerCount && shiftBits >= PARALLEL_MIN_BITS) {
+        return runParallel(shiftBits, tms, tdi, tdo);
+    }
+    return run(shiftBits, tms, tdi, tdo, nullptr);
+}
+
+template<typename Policy>
+int PlannedShiftEngine<Policy>::shift(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                                      unsigned char *tdo, ShiftStream &stream) {
+    ftdi.forget_jtag_pins();
+    return run(shiftBits, tms, tdi, tdo, &stream);
+}
+
+/*
+ * When streaming, each window is planned as soon as its TDI is in, and the
+ * decoded TDO prefix is handed back after every packet.
+ */
+template<typename Policy>
+int PlannedShiftEngine<Policy>::run(const uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                                    unsigned char *tdo, ShiftStream *stream) {
+    // Leave room for the SEND_IMMEDIATE that ends every round trip
+    const auto txLimit = static_cast<uint32_t>(ftdi.usb->writeLimit - 1);
+    const auto rxLimit = static_cast<uint32_t>(ftdi.usb->readLimit);
+
+    if constexpr (Policy::loopback) {
+        if (loopback) {
+            ftdi.set_loopback(true);
+        }
+    }
+
+    decodedBits = 0;
+    uint32_t drainedBytes = 0;
+    const uint32_t window = stream ? STREAM_WINDOW : PLAN_WINDOW;
+
+    for (uint32_t start = 0; start < shiftBits; start += window) {
+        const uint32_t count = std::min(window, shiftBits - start);
+        if (stream && !stream->fillTdi((start + count + 7) / 8)) {
+            return 0;
+        }
+        planner.plan(tms, tdi, start, count, ops);
+
+        for (auto op: ops) {
+            while (true) {
+                const auto tx = static_cast<uint32_t>(ftdi.usb->txCount);
+                if (tx + ShiftPlanner::txBytes(op) <= txLimit && pendingRx + ShiftPlanner::rxBytes(op) <= rxLimit) {
+                    break;
+                }
+
+                // Fill the rest of the round trip with part of a byte command
+                if (op.kind == ShiftPlanner::OpKind::TDI_BYTES) {
+                    const uint32_t room = std::min(txLimit - std::min(txLimit, tx + 3), rxLimit - pendingRx);
+                    if (room > 0) {
+                        const ShiftPlanner::Op head{op.kind, op.start, room * 8};
+                        emit(head, tms, tdi);
+                        op.start += head.length;
+                        op.length -= head.length;
+                    }
+                }
+                if (!transfer(tdo)) {
+                    return 0;
+                }
+                if (stream && decodedBits / 8 > drainedBytes) {
+                    drainedBytes = decodedBits / 8;
+                    if (!stream->drainTdo(drainedBytes)) {
+                        return 0;
+                    }
+                }
+            }
+            emit(op, tms, tdi);
+        }
+    }
+    if (!transfer(tdo)) {
+        return 0;
+    }
+    return !stream || stream->drainTdo((shiftBits + 7) / 8);
+}
+
+template<typename Policy>
+int PlannedShiftEngine<Policy>::setClock(const unsigned int frequency) {
+    return ftdi.set_clock_speed(frequency);
+}
+
+/*
+ * Clock-only commands, a second of adapter time per round trip so no read
+ * outlasts the USB timeout. The first cycle is a TMS command, which puts
+ * the pin at 'tms' for the clocks after it.
+ */
+template<typename Policy>
+int PlannedShiftEngine<Policy>::idle(uint64_t cycles, const bool tms) {
+    if (cycles == 0) {
+        return 1;
+    }
+    USB &usb = *ftdi.usb;
+    const uint64_t perTrip = std::max(ftdi.clock_frequency(), 1u);
+    ftdi.forget_jtag_pins();
+
+    FTDI::put_tms_bits(usb.cmdSpace(3), 1, tms ? 0x3 : 0);
+    cycles--;
+    int rxBytes = 1;
+    do {
+        const uint64_t chunk = std::min(cycles, perTrip);
+        ftdi.clock_cycles(static_cast<unsigned int>(chunk));
+        cycles -= chunk;
+        ftdi.read_low_byte();
+        ftdi.send_immediate();
+        if (!usb.write_tx_buffer<Policy::usbDiagnostics>() ||
+            !usb.read_data<Policy::usbDiagnostics>(rxBytes + 1)) {
+            return 0;
+        }
+        rxBytes = 0;
+    } while (cycles);
+    return 1;
+}
+
+template<typename Policy>
+void PlannedShiftEngine<Policy>::emit(const ShiftPlanner::Op &op, const unsigned char *tms, const unsigned char *tdi) {
+    encode(op, tms, tdi, ftdi.usb->cmdSpace(static_cast<int>(ShiftPlanner::txBytes(op))));
+    pending.push_back(op);
+    pendingRx += ShiftPlanner::rxBytes(op);
+}
+
+template<typename Policy>
+unsigned char *PlannedShiftEngine<Policy>::encode(const ShiftPlanner::Op &op, const unsigned char *tms,
+                                                  const unsigned char *tdi, unsigned char *out) {
+    switch (op.kind) {
+        case ShiftPlanner::OpKind::TMS_BITS: {
+            int tmsBits = 0;
+            for (uint32_t i = 0; i < op.length; i++) {
+                tmsBits |= ShiftPlanner::bit(tms, op.start + i) << i;
+            }
+            // Duplicate the final TMS bit
+            tmsBits |= ShiftPlanner::bit(tms, op.start + op.length - 1) << op.length;
+            return FTDI::put_tms_bits(out, static_cast<int>(op.length), ShiftPlanner::bit(tdi, op.start) << 7 | tmsBits);
+        }
+
+        case ShiftPlanner::OpKind::TDI_BITS: {
+            int tdiBits = 0;
+            for (uint32_t i = 0; i < op.length; i++) {
+                tdiBits |= ShiftPlanner::bit(tdi, op.start + i) << i;
+            }
+            return FTDI::put_tdi_bits(out, static_cast<int>(op.length), tdiBits);
+        }
+
+        case ShiftPlanner::OpKind::TDI_BYTES: {
+            const uint32_t bytes = op.length / 8;
+            out = FTDI::put_tdi_bytes(out, static_cast<int>(bytes));
+            const unsigned char *src = tdi + op.start / 8;
+            if (op.start % 8 == 0) {
+                std::memcpy(out, src, bytes);
+            } else {
+                const uint32_t shift = op.start % 8;
+                for (uint32_t i = 0; i < bytes; i++) {
+                    out[i] = static_cast<unsigned char>(src[i] >> shift | src[i + 1] << (8 - shift));
+                }
+            }
+            return out + bytes;
+        }
+    }
+    return out;
+}
+
+/*
+ * Send the packet, read TDO back and scatter it to the bit positions of the
+ * commands that produced it. Bit-mode reads arrive in the top bits of their
+ * byte.
+ */
+template<typename Policy>
+int PlannedShiftEngine<Policy>::transfer(unsigned char *tdo) {
+    if (pending.empty()) {
+        return 1;
+    }
+    // Have the chip return the tail now instead of on the latency timer
+    ftdi.send_immediate();
+    if constexpr (Policy::statistics) {
+        chunkCount++;
+        wireBytes += ftdi.usb->txCount + pendingRx;
+    }
+
+    USB &usb = *ftdi.usb;
+    if (!usb.write_tx_buffer<Policy::usbDiagnostics>() ||
+        !usb.read_data<Policy::usbDiagnostics>(static_cast<int>(pendingRx))) {
+        return 0;
+    }
+
+    decode(pending.data(), pending.data() + pending.size(), ftdi.usb->rx_data(), tdo);
+    if constexpr (Policy::statistics) {
+        for (const auto &op: pending) {
+            wireBits += op.length;
+        }
+    }
+    decodedBits = pending.back().start + pending.back().length;
+
+    pending.clear();
+    pendingRx = 0;
+    return 1;
+}
+
+template<typename Policy>
+void PlannedShiftEngine<Policy>::decode(const ShiftPlanner::Op *first, const ShiftPlanner::Op *last,
+                                        const unsigned char *rx, unsigned char *tdo) {
+    for (const ShiftPlanner::Op *op = first; op != last; op++) {
+        if (op->kind == ShiftPlanner::OpKind::TDI_BYTES && op->start % 8 == 0) {
+            std::memcpy(tdo + op->start / 8, rx, op->length / 8);
+            rx += op->length / 8;
+            continue;
+        }
+
+        const uint32_t firstBit = op->kind == ShiftPlanner::OpKind::TDI_BYTES ? 0 : 8 - op->length;
+        for (uint32_t i = 0; i < op->length; i++) {
+            const uint32_t rxBit = firstBit + i;
+            const uint32_t at = op->start + i;
+            if (rx[rxBit / 8] & (1 << (rxBit % 8))) {
+                tdo[at / 8] |= 1 << (at % 8);
+            } else {
+                tdo[at / 8] &= ~(1 << (at % 8));
+            }
+        }
+        rx += ShiftPlanner::rxBytes(*op);
+    }
+}
+
+/*
+ * Long local shifts (SVF and XSVF playback, readback) are cut into
+ * segments of a few plan windows. Workers plan and encode segments
+ * ahead of the adapter and decode them behind it, while this thread only
+ * moves bytes through USB, strictly in order. A segment starts a new round
+ * trip, which costs a few bytes per SEGMENT_BITS over run().
+ */
+template<typename Policy>
+int PlannedShiftEngine<Policy>::runParallel(const uint32_t shiftBits, const unsigned char *tms,
+                                            const unsigned char *tdi, unsigned char *tdo) {
+    if (!workers) {
+        workers = std::make_unique<WorkerPool>(workerCount);
+        workerPlanners.resize(workerCount);
+        segments.resize(workerCount * SEGMENTS_PER_WORKER + 1);
+    }
+
+    if constexpr (Policy::loopback) {
+        if (loopback) {
+            ftdi.set_loopback(true);
+        }
+    }
+    // Anything queued for the next transfer goes out ahead of the segments
+    if (ftdi.usb->txCount && !ftdi.flush()) {
+        return 0;
+    }
+
+    const uint32_t total = (shiftBits + SEGMENT_BITS - 1) / SEGMENT_BITS;
+    const auto depth = static_cast<uint32_t>(segments.size());
+    uint32_t submitted = 0;
+    uint32_t sent = 0;
+
+    const auto submitEncode = [&](const uint32_t index) {
+        Segment &segment = segments[index % depth];
+        segment.start = index * SEGMENT_BITS;
+        segment.count = std::min(SEGMENT_BITS, shiftBits - segment.start);
+        segment.encoded = false;
+        segment.decoded = false;
+        jobsRunning++;
+        workers->submit([this, &segment, tms, tdi](const unsigned worker) {
+            encodeSegment(segment, workerPlanners[worker], tms, tdi);
+            std::lock_guard guard(segmentLock);
+            segment.encoded = true;
+            jobsRunning--;
+            segmentChanged.notify_all();
+        });
+    };
+
+    while (sent < total) {
+        // Keep the workers ahead; a slot is free once the segment before in it is decoded
+        while (submitted < total && submitted < sent + depth) {
+            if (submitted >= depth) {
+                await(segments[submitted % depth], &Segment::decoded);
+            }
+            std::lock_guard guard(segmentLock);
+            submitEncode(submitted++);
+        }
+
+        Segment &segment = segments[sent % depth];
+        await(segment, &Segment::encoded);
+        if (!sendSegment(segment)) {
+            settle();
+            return 0;
+        }
+        sent++;
+
+        std::lock_guard guard(segmentLock);
+        jobsRunning++;
+        workers->submit([this, &segment, tdo](unsigned) {
+            decode(segment.ops.data(), segment.ops.data() + segment.ops.size(), segment.rx.data(), tdo);
+            std::lock_guard done(segmentLock);
+            segment.decoded = true;
+            jobsRunning--;
+            segmentChanged.notify_all();
+        });
+    }
+    settle();
+    return 1;
+}
+
+template<typename Policy>
+void PlannedShiftEngine<Policy>::encodeSegment(Segment &segment, ShiftPlanner &segmentPlanner,
+                                               const unsigned char *tms, const unsigned char *tdi) const {
+    // Same limits and packing as run()
+    const auto txLimit = static_cast<uint32_t>(ftdi.usb->writeLimit - 1);
+    const auto rxLimit = static_cast<uint32_t>(ftdi.usb->readLimit);
+
+    segment.ops.clear();
+    segment.tx.clear();
+    segment.packets.clear();
+
+    uint32_t packetStart = 0;
+    uint32_t rx = 0;
+    const auto put = [&](const ShiftPlanner::Op &op) {
+        const size_t at = segment.tx.size();
+        segment.tx.resize(at + ShiftPlanner::txBytes(op));
+        encode(op, tms, tdi, segment.tx.data() + at);
+        segment.ops.push_back(op);
+        rx += ShiftPlanner::rxBytes(op);
+    };
+    const auto close = [&] {
+        if (segment.ops.size() == (segment.packets.empty() ? 0 : segment.packets.back().opsEnd)) {
+            return;
+        }
+        segment.tx.push_back(0);
+        FTDI::put_send_immediate(&segment.tx.back());
+        segment.packets.push_back({
+            static_cast<uint32_t>(segment.tx.size()), static_cast<uint32_t>(segment.ops.size()), rx
+        });
+        packetStart = static_cast<uint32_t>(segment.tx.size());
+        rx = 0;
+    };
+
+    const uint32_t end = segment.start + segment.count;
+    for (uint32_t start = segment.start; start < end; start += PLAN_WINDOW) {
+        segmentPlanner.plan(tms, tdi, start, std::min(PLAN_WINDOW, end - start), segment.planned);
+        for (auto op: segment.planned) {
+            while (true) {
+                const auto tx = static_cast<uint32_t>(segment.tx.size()) - packetStart;
+                if (tx + ShiftPlanner::txBytes(op) <= txLimit && rx + ShiftPlanner::rxBytes(op) <= rxLimit) {
+                    break;
+                }
+                if (op.kind == ShiftPlanner::OpKind::TDI_BYTES) {
+                    const uint32_t room = std::min(txLimit - std::min(txLimit, tx + 3), rxLimit - rx);
+                    if (room > 0) {
+                        const ShiftPlanner::Op head{op.kind, op.start, room * 8};
+                        put(head);
+                        op.start += head.length;
+                        op.length -= head.length;
+                    }
+                }
+                close();
+            }
+            put(op);
+        }
+    }
+    close();
+}
+
+template<typename Policy>
+int PlannedShiftEngine<Policy>::sendSegment(Segment &segment) {
+    USB &usb = *ftdi.usb;
+    uint32_t rxTotal = 0;
+    for (const auto &packet: segment.packets) {
+        rxTotal += packet.rxBytes;
+    }
+    segment.rx.resize(rxTotal);
+
+    uint32_t txFrom = 0;
+    uint32_t rxAt = 0;
+    for (const auto &packet: segment.packets) {
+        const uint32_t length = packet.txEnd - txFrom;
+        std::memcpy(usb.cmdSpace(static_cast<int>(length)), segment.tx.data() + txFrom, length);
+        if constexpr (Policy::statistics) {
+            chunkCount++;
+            wireBytes += length + packet.rxBytes;
+        }
+        if (!usb.write_tx_buffer<Policy::usbDiagnostics>() ||
+            !usb.read_data<Policy::usbDiagnostics>(static_cast<int>(packet.rxBytes))) {
+            return 0;
+        }
+        std::memcpy(segment.rx.data() + rxAt, usb.rx_data(), packet.rxBytes);
+        txFrom = packet.txEnd;
+        rxAt += packet.rxBytes;
+    }
+    if constexpr (Policy::statistics) {
+        wireBits += segment.count;
+    }
+    return 1;
+}
+
+template<typename Policy>
+void PlannedShiftEngine<Policy>::await(const Segment &segment, bool Segment::*done) {
+    std::unique_lock guard(segmentLock);
+    segmentChanged.wait(guard, [&] { return segment.*done; });
+}
+
+template<typename Policy>
+void PlannedShiftEngine<Policy>::settle() {
+    std::unique_lock guard(segmentLock);
+    segmentChanged.wait(guard, [this] { return jobsRunning == 0; });
+}
+
+template class PlannedShiftEngine<FastShiftPolicy>;
+template class PlannedShiftEngine<DiagnosticShiftPolicy>;
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "FTDI.h"
+#include "ShiftPlanner.h"
+#include "WorkerPool.h"
+
+
+/*
+ * Cut-through hooks for a shift whose TDI is still arriving and whose TDO
+ * can leave before the whole vector is done.
+ */
+class ShiftStream {
+public:
+    virtual ~ShiftStream() = default;
+
+    // Make TDI valid up to 'bytes'
+    [[nodiscard]] virtual int fillTdi(uint32_t bytes) = 0;
+
+    // TDO bytes before 'bytes' are final
+    [[nodiscard]] virtual int drainTdo(uint32_t bytes) = 0;
+};
+
+/*
+ * Turns TMS/TDI bit vectors into MPSSE commands and collects TDO.
+ * Shared by the XVC protocol and the local players so all of them drive
+ * the adapter through the same encoder.
+ */
+class ShiftEngine {
+public:
+    virtual ~ShiftEngine() = default;
+
+    /*
+     * Picks the variant matching the diagnostic options in Config, wrapped
+     * in a BroadcastEngine when --broadcast names replica adapters, or a
+     * BitbangEngine with --bitbang, or an MmioEngine with --mmio. Returns
+     * null if the replicas, the simulator or the bridge can't be reached.
+     */
+    static std::unique_ptr<ShiftEngine> create(const FTDI &ftdi);
+
+    // Single-adapter engine, ignoring --broadcast
+    static std::unique_ptr<ShiftEngine> createLocal(const FTDI &ftdi);
+
+    /*
+     * The FTDI/JTAG chip can't shift data to TMS and TDI simultaneously,
+     * so ShiftPlanner switches between TMS and TDI commands as needed.
+     * Commands are packed into packet-sized transfers; a TDI byte command
+     * that straddles a packet is split. Vectors are LSB first and may be
+     * any length.
+     */
+    [[nodiscard]] virtual int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                                    unsigned char *tdo) = 0;
+
+    /*
+     * Same, with TMS complete but TDI filled in through 'stream' as the
+     * shift goes. The default waits for all of TDI and drains TDO at the end.
+     */
+    [[nodiscard]] virtual int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                                    unsigned char *tdo, ShiftStream &stream);
+
+    [[nodiscard]] virtual int setClock(unsigned int frequency) = 0;
+
+    // Kept from one session to the next rather than created per connection
+    [[nodiscard]] virtual bool persistent() const {
+        return false;
+    }
+
+    // Actual TCK after the last setClock, 0 where the engine can't tell
+    [[nodiscard]] virtual unsigned int clockFrequency() const {
+        return 0;
+    }
+
+    /*
+     * 'cycles' clocks with TMS at 'tms' and TDI don't care, for RUNTEST
+     * waits. The default shifts constant vectors a chunk at a time.
+     */
+    [[nodiscard]] virtual int idle(uint64_t cycles, bool tms);
+
+    // Engine-specific lines for -S
+    virtual void printStatistic() const {
+    }
+
+    // Counted by the diagnostic variant only; wireBytes/wireBits gives bytes per shifted bit
+    uint64_t chunkCount = 0;
+    uint64_t wireBytes = 0;
+    uint64_t wireBits = 0;
+
+protected:
+    static constexpr uint32_t IDLE_CHUNK_BITS = 64 * 1024;
+};
+
+// Compile-time switches for the encoder, decoder and USB transfers
+struct FastShiftPolicy {
+    static constexpr bool loopback = false;
+    static constexpr bool statistics = false;
+    static constexpr bool usbDiagnostics = false;
+};
+
+// Everything compiled in; each feature still follows its runtime flag
+struct DiagnosticShiftPolicy {
+    static constexpr bool loopback = true;
+    static constexpr bool statistics = true;
+    static constexpr bool usbDiagnostics = true;
+};
+
+template<typename Policy>
+class PlannedShiftEngine final : public ShiftEngine {
+public:
+    explicit PlannedShiftEngine(const FTDI &ftdi);
+
+    [[nodiscard]] int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo) override;
+
+    [[nodiscard]] int shift(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                            unsigned char *tdo, ShiftStream &stream) override;
+
+    [[nodiscard]] int setClock(unsigned int frequency) override;
+
+    [[nodiscard]] unsigned int clockFrequency() const override {
+        return ftdi.clock_frequency();
+    }
+
+    [[nodiscard]] int idle(uint64_t cycles, bool tms) override;
+
+private:
+    // One round trip of a segment: where its commands end in tx and ops, and the TDO bytes it returns
+    struct Packet {
+        uint32_t txEnd;
+        uint32_t opsEnd;
+        uint32_t rxBytes;
+    };
+
+    // SEGMENT_BITS of a long shift, encoded and decoded by a worker, sent by the caller
+    struct Segment {
+        uint32_t start = 0;
+        uint32_t count = 0;
+        std::vector<ShiftPlanner::Op> planned;
+        std::vector<ShiftPlanner::Op> ops;
+        std::vector<unsigned char> tx;
+        std::vector<Packet> packets;
+        std::vector<unsigned char> rx;
+        bool encoded = false;
+        bool decoded = false;
+    };
+
+    [[nodiscard]] int run(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi, unsigned char *tdo,
+                          ShiftStream *stream);
+
+    [[nodiscard]] int runParallel(uint32_t shiftBits, const unsigned char *tms, const unsigned char *tdi,
+                                  unsigned char *tdo);
+
+    void emit(const ShiftPlanner::Op &op, const unsigned char *tms, const unsigned char *tdi);
+
+    [[nodiscard]] int transfer(unsigned char *tdo);
+
+    // Worker side: plans and packs a segment the way run() would, into its own buffer
+    void encodeSegment(Segment &segment, ShiftPlanner &segmentPlanner, const unsigned char *tms,
+                       const unsigned char *tdi) const;
+
+    // Caller side: the segment's round trips, in order, with the TDO kept for decoding
+    [[nodiscard]] int sendSegment(Segment &segment);
+
+    // Blocks until 'done' is set on the segment
+    void await(const Segment &segment, bool Segment::*done);
+
+    // Blocks until no job is left running, so an early return can't leave one writing
+    void settle();
+
+    static unsigned char *encode(const ShiftPlanner::Op &op, const unsigned char *tms, const unsigned char *tdi,
+                                 unsigned char *out);
+
+    // Scatters the TDO of consecutive commands to their bit positions
+    static void decode(const ShiftPlanner::Op *first, const ShiftPlanner::Op *last, const unsigned char *rx,
+                       unsigned char *tdo);
+
+    const FTDI &ftdi;
+    bool loopback{};
+
+    ShiftPlanner planner;
+    std::vector<ShiftPlanner::Op> ops;
+
+    // Commands in the current packet, in rx order
+    std::vector<ShiftPlanner::Op> pending;
+    uint32_t pendingRx = 0;
+
+    // TDO bits of the current vector already decoded
+    uint32_t decodedBits = 0;
+
+    // Long shifts: a ring of segments in flight and the workers handling them, started on first use
+    unsigned workerCount = 0;
+    std::vector<Segment> segments;
+    std::vector<ShiftPlanner> workerPlanners;
+    std::mutex segmentLock;
+    std::condition_variable segmentChanged;
+    unsigned jobsRunning = 0;
+    std::unique_ptr<WorkerPool> workers;
+
+    // Bits planned per pass; bounds the planner tables for long local vectors
+    static constexpr uint32_t PLAN_WINDOW = 64 * 1024;
+
+    // Bits planned per pass when streaming, about one packet of TDI
+    static constexpr uint32_t STREAM_WINDOW = 4096;
+
+    // Whole bytes, so neighbouring segments never decode into the same TDO byte; a few
+    // plan windows each, so the round trip cut short at every segment end costs little
+    static constexpr uint32_t SEGMENT_BITS = 4 * PLAN_WINDOW;
+
+    // Shorter shifts aren't worth the hand-offs
+    static constexpr uint32_t PARALLEL_MIN_BITS = 2 * SEGMENT_BITS;
+
+    // Segments in flight per worker, enough to keep them busy while the adapter works
+    static constexpr unsigned SEGMENTS_PER_WORKER = 2;
+
+    // --shift-threads default: one per spare core, up to this
+    static constexpr unsigned MAX_AUTO_WORKERS = 4;
+};
+
+extern template class PlannedShiftEngine<FastShiftPolicy>;
+extern template class PlannedShiftEngine<DiagnosticShiftPolicy>;
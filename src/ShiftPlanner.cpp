@@ -0,0 +1,125 @@
+#include <algorithm>
+#include "ShiftPlanner.h"
+
+
+void ShiftPlanner::plan(const unsigned char *tms, const unsigned char *tdi, const uint32_t start,
+                        const uint32_t count, std::vector<Op> &ops) {
+    ops.clear();
+    if (count == 0) {
+        return;
+    }
+
+    // tmsRun[p]: bits from p that keep TMS at its level before p, so a TDI
+    // command can cover them. tdiRun[p]: bits from p with TDI unchanged.
+    tmsRun.assign(count + 1, 0);
+    tdiRun.assign(count + 1, 0);
+    for (uint32_t p = count; p-- > 0;) {
+        const uint32_t at = start + p;
+        if (at > 0 && bit(tms, at) == bit(tms, at - 1)) {
+            tmsRun[p] = tmsRun[p + 1] + 1;
+        }
+        tdiRun[p] = 1;
+        if (p + 1 < count && bit(tdi, at + 1) == bit(tdi, at)) {
+            tdiRun[p] += tdiRun[p + 1];
+        }
+    }
+
+    // Closed: no command open at p. Open: a TDI byte command ends at p and may grow.
+    closedCost.assign(count + 1, INFINITE);
+    openCost.assign(count + 1, INFINITE);
+    closedStep.assign(count + 1, 0);
+    openContinues.assign(count + 1, false);
+    closedCost[0] = 0;
+
+    for (uint32_t p = 0; p < count; p++) {
+        if (openCost[p] < closedCost[p]) {
+            closedCost[p] = openCost[p];
+            closedStep[p] = STEP_CLOSE;
+        }
+        const uint32_t base = closedCost[p];
+        if (base >= INFINITE) {
+            continue;
+        }
+
+        const uint32_t tmsLimit = std::min<uint32_t>(MAX_TMS_BITS, tdiRun[p]);
+        for (uint32_t k = 1; k <= tmsLimit; k++) {
+            if (base + COST_BITS < closedCost[p + k]) {
+                closedCost[p + k] = base + COST_BITS;
+                closedStep[p + k] = STEP_TMS | k;
+            }
+        }
+
+        const uint32_t tdiLimit = std::min<uint32_t>(MAX_TDI_BITS, tmsRun[p]);
+        for (uint32_t k = 1; k <= tdiLimit; k++) {
+            if (base + COST_BITS < closedCost[p + k]) {
+                closedCost[p + k] = base + COST_BITS;
+                closedStep[p + k] = STEP_TDI | k;
+            }
+        }
+
+        if (tmsRun[p] >= 8) {
+            if (base + COST_BYTES_OPEN < openCost[p + 8]) {
+                openCost[p + 8] = base + COST_BYTES_OPEN;
+                openContinues[p + 8] = false;
+            }
+            if (openCost[p] < INFINITE && openCost[p] + COST_BYTES_MORE < openCost[p + 8]) {
+                openCost[p + 8] = openCost[p] + COST_BYTES_MORE;
+                openContinues[p + 8] = true;
+            }
+        }
+    }
+    if (openCost[count] < closedCost[count]) {
+        closedCost[count] = openCost[count];
+        closedStep[count] = STEP_CLOSE;
+    }
+
+    // Walk back from the end and emit in reverse
+    uint32_t p = count;
+    while (p > 0) {
+        const uint8_t step = closedStep[p];
+        if (step == STEP_CLOSE) {
+            const uint32_t end = p;
+            bool more;
+            do {
+                more = openContinues[p];
+                p -= 8;
+            } while (more);
+            ops.push_back({OpKind::TDI_BYTES, start + p, end - p});
+        } else {
+            const uint32_t length = step & STEP_LENGTH;
+            p -= length;
+            ops.push_back({(step & STEP_TDI) ? OpKind::TDI_BITS : OpKind::TMS_BITS, start + p, length});
+        }
+    }
+    std::ranges::reverse(ops);
+}
+
+uint64_t ShiftPlanner::greedyCost(const unsigned char *tms, const unsigned char *tdi, const uint32_t count) {
+    uint64_t cost = 0;
+    uint32_t p = 0;
+    while (p < count) {
+        // TMS command: up to MAX_TMS_BITS while TDI stays put
+        const bool tdiFirst = bit(tdi, p);
+        uint32_t k = 0;
+        do {
+            k++;
+        } while (k < MAX_TMS_BITS && p + k < count && bit(tdi, p + k) == tdiFirst);
+        cost += COST_BITS;
+        p += k;
+
+        // Stash TDI while TMS holds, as whole bytes plus leftover bits
+        const bool level = bit(tms, p - 1);
+        uint32_t stashed = 0;
+        while (p < count && bit(tms, p) == level) {
+            stashed++;
+            p++;
+        }
+        if (stashed >= 8) {
+            cost += 3 + 2 * (stashed / 8);
+        }
+        if (stashed % 8) {
+            cost += COST_BITS;
+        }
+    }
+    return cost;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+/*
+ * Chooses the MPSSE commands for a TMS/TDI vector. A shortest-path pass over
+ * the bit positions picks the mix of TMS-bit, TDI-bit and TDI-byte commands
+ * with the fewest bytes on the wire, counting both the command bytes sent and
+ * the TDO bytes read back.
+ */
+class ShiftPlanner {
+public:
+    enum class OpKind : uint8_t {
+        TMS_BITS,  // up to MAX_TMS_BITS with TDI held
+        TDI_BITS,  // up to MAX_TDI_BITS with TMS held
+        TDI_BYTES  // whole bytes with TMS held
+    };
+
+    struct Op {
+        OpKind kind;
+        uint32_t start;
+        uint32_t length;
+    };
+
+    /*
+     * Plans bits [start, start + count) of LSB-first vectors. TMS is only
+     * assumed to be at a known level from the bit before 'start', so the
+     * first command of a vector is always a TMS command.
+     */
+    void plan(const unsigned char *tms, const unsigned char *tdi, uint32_t start, uint32_t count,
+              std::vector<Op> &ops);
+
+    // Wire cost of the command emitted by the legacy greedy encoder, for comparison
+    [[nodiscard]] static uint64_t greedyCost(const unsigned char *tms, const unsigned char *tdi, uint32_t count);
+
+    [[nodiscard]] static uint32_t txBytes(const Op &op) {
+        return op.kind == OpKind::TDI_BYTES ? 3 + op.length / 8 : 3;
+    }
+
+    [[nodiscard]] static uint32_t rxBytes(const Op &op) {
+        return op.kind == OpKind::TDI_BYTES ? op.length / 8 : 1;
+    }
+
+    static bool bit(const unsigned char *bits, const uint32_t index) {
+        return bits[index / 8] & (1 << (index % 8));
+    }
+
+    static constexpr int MAX_TMS_BITS = 6;
+    static constexpr int MAX_TDI_BITS = 8;
+
+private:
+    std::vector<uint32_t> closedCost;
+    std::vector<uint32_t> openCost;
+    std::vector<uint8_t> closedStep;
+    std::vector<bool> openContinues;
+    std::vector<uint32_t> tmsRun;
+    std::vector<uint32_t> tdiRun;
+
+    // closedStep: low bits are the step length, STEP_* the command that took it
+    static constexpr uint8_t STEP_TMS = 0x00;
+    static constexpr uint8_t STEP_TDI = 0x40;
+    static constexpr uint8_t STEP_CLOSE = 0x80;
+    static constexpr uint8_t STEP_LENGTH = 0x3F;
+
+    static constexpr uint32_t INFINITE = UINT32_MAX / 2;
+    static constexpr uint32_t COST_BITS = 4;
+    static constexpr uint32_t COST_BYTES_OPEN = 5;
+    static constexpr uint32_t COST_BYTES_MORE = 2;
+};
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include "SpiFlash.h"
+
+
+SpiFlash::SpiFlash(const FTDI &ftdi): ftdi(ftdi) {
+    const auto config = Config::get();
+    frequency = config->lockedSpeed ? config->lockedSpeed : DEFAULT_FREQUENCY;
+}
+
+int SpiFlash::run(const std::string &command) {
+    if (!ftdi.set_clock_speed(frequency) || !probe()) {
+        return 0;
+    }
+
+    const auto colon = command.find(':');
+    const std::string verb = command.substr(0, colon);
+    const std::string argument = colon == std::string::npos ? "" : command.substr(colon + 1);
+
+    // file[@addr[:len]]
+    const auto at = argument.find('@');
+    const std::string path = argument.substr(0, at);
+    uint32_t address = 0;
+    uint32_t length = 0;
+    if (at != std::string::npos) {
+        char *endp;
+        address = std::strtoul(argument.c_str() + at + 1, &endp, 0);
+        if (*endp == ':') {
+            length = std::strtoul(endp + 1, nullptr, 0);
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    int result;
+    std::vector<unsigned char> data;
+
+    if (verb == "id") {
+        return 1;
+    } else if (verb == "erase") {
+        char *endp;
+        address = std::strtoul(argument.c_str(), &endp, 0);
+        length = *endp == ':' ? std::strtoul(endp + 1, nullptr, 0) : 0;
+        result = erase(address, length);
+    } else if (verb == "write") {
+        result = readFile(path, data) && keepSectorEdges(address, data) && erase(address, data.size()) &&
+                 program(address, data) && verify(address, data);
+    } else if (verb == "verify") {
+        result = readFile(path, data) && verify(address, data);
+    } else if (verb == "read" && length > 0) {
+        result = read(address, length, data) && writeFile(path, data);
+    } else {
+        spdlog::error(ERR_BAD_COMMAND, command);
+        return 0;
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (result) {
+        spdlog::info("Flash {} done in {:.2f} s", verb, seconds);
+    }
+    return result;
+}
+
+int SpiFlash::probe() {
+    ftdi.spi_select(true);
+    ftdi.spi_write(&CMD_JEDEC_ID, 1);
+    ftdi.spi_read(3);
+    ftdi.spi_select(false);
+    ftdi.send_immediate();
+    if (!ftdi.flush() || !ftdi.usb->read_data(3)) {
+        return 0;
+    }
+
+    const unsigned char *id = ftdi.usb->rx_data();
+    if ((id[0] == 0x00 && id[1] == 0x00) || (id[0] == 0xFF && id[1] == 0xFF) || id[2] < 10 || id[2] > 31) {
+        spdlog::error(ERR_NO_FLASH, id[0], id[1], id[2]);
+        return 0;
+    }
+
+    capacity = 1u << id[2];
+    spdlog::info("SPI flash JEDEC ID {:02x} {:02x} {:02x}, {} KiB", id[0], id[1], id[2], capacity / 1024);
+    if (capacity > MAX_ADDRESS) {
+        spdlog::warn("Only the first {} MiB are reachable with 3-byte addressing", MAX_ADDRESS >> 20);
+        capacity = MAX_ADDRESS;
+    }
+    return 1;
+}
+
+void SpiFlash::queueCommand(const unsigned char opcode) const {
+    ftdi.spi_select(true);
+    ftdi.spi_write(&opcode, 1);
+    ftdi.spi_select(false);
+}
+
+void SpiFlash::queueAddressed(const unsigned char opcode, const uint32_t address, const unsigned char *data,
+                              const int count) const {
+    const unsigned char header[] = {
+        opcode,
+        static_cast<unsigned char>(address >> 16),
+        static_cast<unsigned char>(address >> 8),
+        static_cast<unsigned char>(address)
+    };
+    ftdi.spi_select(true);
+    ftdi.spi_write(header, sizeof(header));
+    if (count > 0) {
+        ftdi.spi_write(data, count);
+    }
+    ftdi.spi_select(false);
+}
+
+void SpiFlash::queueStatusPolls(const int count) const {
+    for (int i = 0; i < count; i++) {
+        ftdi.spi_select(true);
+        ftdi.spi_write(&CMD_READ_STATUS, 1);
+        ftdi.spi_read(1);
+        ftdi.spi_select(false);
+    }
+    ftdi.send_immediate();
+}
+
+unsigned int SpiFlash::cyclesFor(const std::chrono::microseconds delay) const {
+    return static_cast<unsigned int>(static_cast<uint64_t>(delay.count()) * frequency / 1000000);
+}
+
+/*
+ * Append status polls to whatever is already queued and send it all.
+ * Returns the number of polls that saw the device busy, or -1 on error.
+ */
+int SpiFlash::waitReady(const unsigned int delayCycles, const std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    int busyPolls = 0;
+
+    if (delayCycles) {
+        ftdi.clock_cycles(delayCycles);
+    }
+    while (true) {
+        queueStatusPolls(POLLS_PER_BATCH);
+        if (!ftdi.flush() || !ftdi.usb->read_data(POLLS_PER_BATCH)) {
+            return -1;
+        }
+
+        const unsigned char *status = ftdi.usb->rx_data();
+        for (int i = 0; i < POLLS_PER_BATCH; i++) {
+            if (!(status[i] & STATUS_BUSY)) {
+                return busyPolls;
+            }
+            busyPolls++;
+        }
+
+        if (std::chrono::steady_clock::now() > deadline) {
+            spdlog::error(ERR_TIMEOUT);
+            return -1;
+        }
+        if (timeout > std::chrono::milliseconds(100)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+int SpiFlash::erase(uint32_t address, const uint32_t length) {
+    const uint32_t end = (address + length + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    const uint32_t start = address & ~(SECTOR_SIZE - 1);
+    if (length == 0 || end > capacity) {
+        spdlog::error(ERR_RANGE, address, length, capacity);
+        return 0;
+    }
+    if (start < address) {
+        spdlog::warn(WARN_EXTRA_ERASE, start, address);
+    }
+    if (address + length < end) {
+        spdlog::warn(WARN_EXTRA_ERASE, address + length, end);
+    }
+    address = start;
+
+    while (address < end) {
+        const bool block = (address % BLOCK_SIZE) == 0 && end - address >= BLOCK_SIZE;
+        queueCommand(CMD_WRITE_ENABLE);
+        queueAddressed(block ? CMD_BLOCK_ERASE : CMD_SECTOR_ERASE, address, nullptr, 0);
+        if (waitReady(0, std::chrono::milliseconds(block ? 3000 : 1000)) < 0) {
+            return 0;
+        }
+        address += block ? BLOCK_SIZE : SECTOR_SIZE;
+    }
+    return 1;
+}
+
+/*
+ * Erasing works on whole sectors, so widen 'data' to them with what the
+ * flash holds around it now; programming it back leaves those bytes as
+ * they were.
+ */
+int SpiFlash::keepSectorEdges(uint32_t &address, std::vector<unsigned char> &data) const {
+    const auto length = static_cast<uint32_t>(data.size());
+    if (address + length > capacity) {
+        spdlog::error(ERR_RANGE, address, length, capacity);
+        return 0;
+    }
+    const uint32_t start = address & ~(SECTOR_SIZE - 1);
+    const uint32_t end = (address + length + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+
+    std::vector<unsigned char> edge;
+    if (address + length < end) {
+        if (!read(address + length, end - (address + length), edge)) {
+            return 0;
+        }
+        data.insert(data.end(), edge.begin(), edge.end());
+    }
+    if (start < address) {
+        if (!read(start, address - start, edge)) {
+            return 0;
+        }
+        data.insert(data.begin(), edge.begin(), edge.end());
+        address = start;
+    }
+    return 1;
+}
+
+int SpiFlash::program(uint32_t address, const std::vector<unsigned char> &data) {
+    if (address + data.size() > capacity) {
+        spdlog::error(ERR_RANGE, address, data.size(), capacity);
+        return 0;
+    }
+
+    size_t offset = 0;
+    while (offset < data.size()) {
+        // Never cross a page boundary within one program command
+        const auto count = static_cast<int>(std::min<size_t>(PAGE_SIZE - (address % PAGE_SIZE),
+                                                             data.size() - offset));
+        queueCommand(CMD_WRITE_ENABLE);
+        queueAddressed(CMD_PAGE_PROGRAM, address, data.data() + offset, count);
+
+        const int busyPolls = waitReady(cyclesFor(pageProgramTime), std::chrono::milliseconds(50));
+        if (busyPolls < 0) {
+            return 0;
+        }
+        if (busyPolls == 0) {
+            pageProgramTime -= pageProgramTime / 8;
+        } else if (busyPolls >= POLLS_PER_BATCH) {
+            pageProgramTime += pageProgramTime / 4;
+        }
+
+        address += count;
+        offset += count;
+    }
+    return 1;
+}
+
+int SpiFlash::read(uint32_t address, const uint32_t length, std::vector<unsigned char> &data) const {
+    if (address + length > capacity) {
+        spdlog::error(ERR_RANGE, address, length, capacity);
+        return 0;
+    }
+
+    data.clear();
+    data.reserve(length);
+
+    // One fast read spanning the whole range, collected in packet-sized pieces
+    const unsigned char header[] = {
+        CMD_FAST_READ,
+        static_cast<unsigned char>(address >> 16),
+        static_cast<unsigned char>(address >> 8),
+        static_cast<unsigned char>(address),
+        0
+    };
+    ftdi.spi_select(true);
+    ftdi.spi_write(header, sizeof(header));
+
+    while (data.size() < length) {
+        const int count = static_cast<int>(std::min<size_t>(READ_CHUNK, length - data.size()));
+        ftdi.spi_read(count);
+        ftdi.send_immediate();
+        if (!ftdi.flush() || !ftdi.usb->read_data(count)) {
+            return 0;
+        }
+        const unsigned char *rx = ftdi.usb->rx_data();
+        data.insert(data.end(), rx, rx + count);
+    }
+
+    ftdi.spi_select(false);
+    return ftdi.flush();
+}
+
+int SpiFlash::verify(const uint32_t address, const std::vector<unsigned char> &data) const {
+    std::vector<unsigned char> actual;
+    if (!read(address, data.size(), actual)) {
+        return 0;
+    }
+    if (const auto [a, e] = std::ranges::mismatch(actual, data); a != actual.end()) {
+        const auto offset = static_cast<uint32_t>(a - actual.begin());
+        spdlog::error(ERR_VERIFY, address + offset, *a, *e);
+        return 0;
+    }
+    return 1;
+}
+
+bool SpiFlash::readFile(const std::string &path, std::vector<unsigned char> &data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        spdlog::error("Can't open \"{}\"", path);
+        return false;
+    }
+    data.assign(std::istreambuf_iterator(file), std::istreambuf_iterator<char>());
+    if (data.empty()) {
+        spdlog::error("\"{}\" is empty", path);
+        return false;
+    }
+    return true;
+}
+
+bool SpiFlash::writeFile(const std::string &path, const std::vector<unsigned char> &data) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()))) {
+        spdlog::error("Can't write \"{}\"", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "FTDI.h"
+
+
+/*
+ * SPI NOR programmer running directly on the MPSSE engine.
+ * Commands are batched so a page program and its first status polls share
+ * one USB round trip; an adapter-timed delay lets the polls land just
+ * after the typical program time.
+ */
+class SpiFlash {
+public:
+    explicit SpiFlash(const FTDI &ftdi);
+
+    // id | erase:addr:len | write:file[@addr] | verify:file[@addr] | read:file@addr:len
+    [[nodiscard]] int run(const std::string &command);
+
+private:
+    [[nodiscard]] int probe();
+
+    [[nodiscard]] int erase(uint32_t address, uint32_t length);
+
+    // Widens a write to whole sectors, keeping the bytes around it
+    [[nodiscard]] int keepSectorEdges(uint32_t &address, std::vector<unsigned char> &data) const;
+
+    [[nodiscard]] int program(uint32_t address, const std::vector<unsigned char> &data);
+
+    [[nodiscard]] int read(uint32_t address, uint32_t length, std::vector<unsigned char> &data) const;
+
+    [[nodiscard]] int verify(uint32_t address, const std::vector<unsigned char> &data) const;
+
+    [[nodiscard]] int waitReady(unsigned int delayCycles, std::chrono::milliseconds timeout);
+
+    void queueCommand(unsigned char opcode) const;
+
+    void queueAddressed(unsigned char opcode, uint32_t address, const unsigned char *data, int count) const;
+
+    void queueStatusPolls(int count) const;
+
+    [[nodiscard]] unsigned int cyclesFor(std::chrono::microseconds delay) const;
+
+    static bool readFile(const std::string &path, std::vector<unsigned char> &data);
+
+    static bool writeFile(const std::string &path, const std::vector<unsigned char> &data);
+
+    const FTDI &ftdi;
+    unsigned int frequency;
+    uint32_t capacity = 0;
+
+    // Learned page program time, trimmed toward the point where the first poll reports ready
+    std::chrono::microseconds pageProgramTime{500};
+
+    static constexpr unsigned int DEFAULT_FREQUENCY = 10000000;
+    static constexpr uint32_t PAGE_SIZE = 256;
+    static constexpr uint32_t SECTOR_SIZE = 4096;
+    static constexpr uint32_t BLOCK_SIZE = 65536;
+    static constexpr uint32_t MAX_ADDRESS = 1 << 24;
+    static constexpr int READ_CHUNK = 496;
+    static constexpr int POLLS_PER_BATCH = 16;
+
+    static constexpr unsigned char CMD_WRITE_ENABLE = 0x06;
+    static constexpr unsigned char CMD_READ_STATUS = 0x05;
+    static constexpr unsigned char CMD_PAGE_PROGRAM = 0x02;
+    static constexpr unsigned char CMD_SECTOR_ERASE = 0x20;
+    static constexpr unsigned char CMD_BLOCK_ERASE = 0xD8;
+    static constexpr unsigned char CMD_FAST_READ = 0x0B;
+    static constexpr unsigned char CMD_JEDEC_ID = 0x9F;
+    static constexpr unsigned char STATUS_BUSY = 0x01;
+
+    static constexpr std::string_view ERR_BAD_COMMAND = "Bad --spi-flash command \"{}\"";
+    static constexpr std::string_view ERR_NO_FLASH = "No SPI flash responding (JEDEC ID {:02x} {:02x} {:02x})";
+    static constexpr std::string_view ERR_RANGE = "Flash range 0x{:x}+0x{:x} exceeds 0x{:x}";
+    static constexpr std::string_view ERR_TIMEOUT = "Flash busy timeout";
+    static constexpr std::string_view WARN_EXTRA_ERASE = "Erasing whole sectors also clears 0x{:x}-0x{:x}";
+    static constexpr std::string_view ERR_VERIFY = "Verify failed at 0x{:x}: read {:02x}, expected {:02x}";
+};
@@ -0,0 +1,623 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <spdlog/spdlog.h>
+#include "SvfPlayer.h"
+
+
+SvfPlayer::SvfPlayer(ShiftEngine &engine): engine(engine) {
+    const auto config = Config::get();
+    frequency = config->lockedSpeed ? config->lockedSpeed : DEFAULT_FREQUENCY;
+}
+
+int SvfPlayer::playFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        spdlog::error("Can't open \"{}\"", path);
+        return 0;
+    }
+    const std::vector<unsigned char> data{std::istreambuf_iterator(file), std::istreambuf_iterator<char>()};
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool xsvf = path.size() > 5 && path.substr(path.size() - 5) == ".xsvf";
+    const int result = xsvf
+                           ? playXsvf(data)
+                           : playSvf(std::string_view(reinterpret_cast<const char *>(data.data()), data.size()));
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (result) {
+        spdlog::info("{} played in {:.2f} s", path, seconds);
+    } else {
+        spdlog::error("{} failed at {} {}", path, xsvf ? "offset" : "line", failedAt);
+    }
+    return result;
+}
+
+void SvfPlayer::reset() {
+    tmsBatch.clear();
+    tdiBatch.clear();
+    batchBits = 0;
+    checks.clear();
+    failedAt = 0;
+    mismatch = false;
+
+    hir = hdr = tir = tdr = sir = sdr = ScanParams{};
+    endIR = endDR = runState = runEndState = IDLE;
+    runTestUs = 0;
+    repeatCount = 0;
+    tdoMask.clear();
+
+    // The client may have left the TAP anywhere
+    for (int i = 0; i < 5; i++) {
+        clock(true, false);
+    }
+}
+
+void SvfPlayer::clock(const bool tms, const bool tdi) {
+    if ((batchBits % 8) == 0) {
+        tmsBatch.push_back(0);
+        tdiBatch.push_back(0);
+    }
+    setBit(tmsBatch, batchBits, tms);
+    setBit(tdiBatch, batchBits, tdi);
+    state = NEXT_STATE[state][tms];
+    batchBits++;
+}
+
+void SvfPlayer::moveTo(const TapState target) {
+    if (state == target) {
+        return;
+    }
+    if (target == RESET) {
+        for (int i = 0; i < 5; i++) {
+            clock(true, false);
+        }
+        return;
+    }
+
+    // Shortest TMS path through the 16-state TAP controller
+    std::array<int, STATE_COUNT> from{};
+    from.fill(-1);
+    std::array<bool, STATE_COUNT> via{};
+    std::array<TapState, STATE_COUNT> queue{};
+    size_t head = 0, tail = 0;
+    queue[tail++] = state;
+    from[state] = state;
+    while (head < tail && from[target] < 0) {
+        const TapState s = queue[head++];
+        for (const bool tms: {false, true}) {
+            if (const TapState n = NEXT_STATE[s][tms]; from[n] < 0) {
+                from[n] = s;
+                via[n] = tms;
+                queue[tail++] = n;
+            }
+        }
+    }
+
+    std::vector<bool> path;
+    for (TapState s = target; s != state; s = static_cast<TapState>(from[s])) {
+        path.push_back(via[s]);
+    }
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        clock(*it, false);
+    }
+}
+
+void SvfPlayer::shiftBits(const uint32_t length, const Bits &tdi, const bool exit) {
+    for (uint32_t i = 0; i < length; i++) {
+        clock(exit && i + 1 == length, bit(tdi, i));
+    }
+}
+
+void SvfPlayer::addCheck(const size_t offset, const uint32_t length, const Bits &expected, const Bits *mask) {
+    Check check{offset, length, expected, {}, location};
+    const size_t bytes = (length + 7) / 8;
+    if (mask && mask->size() >= bytes) {
+        check.mask.assign(mask->begin(), mask->begin() + static_cast<long>(bytes));
+    } else {
+        check.mask.assign(bytes, 0xFF);
+    }
+    checks.push_back(std::move(check));
+}
+
+void SvfPlayer::scan(const bool ir, const uint32_t length, const Bits &tdi, const Bits *expected, const Bits *mask,
+                     const TapState end) {
+    if (length > 0) {
+        moveTo(ir ? IRSHIFT : DRSHIFT);
+        const size_t offset = batchBits;
+        shiftBits(length, tdi, true);
+        if (expected) {
+            addCheck(offset, length, *expected, mask);
+        }
+    }
+    moveTo(end);
+}
+
+/*
+ * Short waits stay in the batch. Longer ones flush it and have the engine
+ * clock without data, so a wait costs a few command bytes instead of a
+ * bit per cycle. TMS is still at the run state's level from moveTo.
+ */
+int SvfPlayer::runTest(const uint64_t cycles, const TapState run, const TapState end, const bool report) {
+    moveTo(run);
+    if (cycles <= INLINE_RUN_CYCLES) {
+        for (uint64_t i = 0; i < cycles; i++) {
+            clock(run == RESET, false);
+        }
+    } else {
+        if (!flush(report)) {
+            return 0;
+        }
+        if (!engine.idle(cycles, run == RESET)) {
+            failedAt = location;
+            return 0;
+        }
+        if (onFlush) {
+            onFlush();
+        }
+    }
+    moveTo(end);
+    return 1;
+}
+
+// At the clock the adapter actually runs, which -c may hold below the FREQUENCY asked for
+uint64_t SvfPlayer::cyclesFor(const double seconds) const {
+    const unsigned int actual = engine.clockFrequency();
+    return clampCycles(std::ceil(seconds * (actual ? actual : frequency)));
+}
+
+uint64_t SvfPlayer::clampCycles(const double cycles) {
+    if (!(cycles > 0)) {
+        return 0;
+    }
+    return cycles < static_cast<double>(MAX_RUN_CYCLES) ? static_cast<uint64_t>(cycles) : MAX_RUN_CYCLES;
+}
+
+int SvfPlayer::flush(const bool report) {
+    if (batchBits == 0) {
+        return 1;
+    }
+
+    tdoBatch.resize(tmsBatch.size());
+    const int shifted = engine.shift(batchBits, tmsBatch.data(), tdiBatch.data(), tdoBatch.data());
+
+    int result = shifted;
+    if (!shifted) {
+        failedAt = location;
+    }
+    for (size_t c = 0; result && c < checks.size(); c++) {
+        const Check &check = checks[c];
+        for (uint32_t i = 0; i < check.length; i++) {
+            if (bit(check.mask, i) && bit(tdoBatch, check.offset + i) != bit(check.expected, i)) {
+                mismatch = true;
+                failedAt = check.location;
+                if (report) {
+                    spdlog::error("TDO mismatch at bit {} of {}", i, check.length);
+                }
+                result = 0;
+                break;
+            }
+        }
+    }
+
+    tmsBatch.clear();
+    tdiBatch.clear();
+    batchBits = 0;
+    checks.clear();
+    if (onFlush) {
+        onFlush();
+    }
+    return result;
+}
+
+int SvfPlayer::playSvf(const std::string_view text) {
+    reset();
+
+    std::vector<std::string> tokens;
+    std::string token;
+    uint32_t line = 1;
+    bool inParen = false;
+
+    for (size_t i = 0; i < text.size(); i++) {
+        const char c = text[i];
+        if (c == '\n') {
+            line++;
+        }
+        if (inParen) {
+            if (c == ')') {
+                inParen = false;
+                tokens.push_back(std::move(token));
+                token.clear();
+            } else if (!std::isspace(static_cast<unsigned char>(c))) {
+                token += c;
+            }
+            continue;
+        }
+        if (c == '!' || (c == '/' && i + 1 < text.size() && text[i + 1] == '/')) {
+            while (i + 1 < text.size() && text[i + 1] != '\n') {
+                i++;
+            }
+            continue;
+        }
+        if (c == '(' || c == ';' || std::isspace(static_cast<unsigned char>(c))) {
+            if (!token.empty()) {
+                tokens.push_back(std::move(token));
+                token.clear();
+            }
+            if (c == '(') {
+                token = "(";
+                inParen = true;
+            } else if (c == ';' && !tokens.empty()) {
+                if (!svfStatement(tokens) || (batchBits >= FLUSH_BITS && !flush())) {
+                    failedAt = failedAt ? failedAt : location;
+                    return 0;
+                }
+                tokens.clear();
+            }
+            continue;
+        }
+        if (tokens.empty() && token.empty()) {
+            location = line;
+        }
+        token += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+
+    if (!flush()) {
+        return 0;
+    }
+    return 1;
+}
+
+int SvfPlayer::svfStatement(const std::vector<std::string> &tokens) {
+    const std::string &command = tokens[0];
+
+    if (command == "ENDIR" || command == "ENDDR") {
+        TapState end;
+        if (tokens.size() != 2 || !svfState(tokens[1], end)) {
+            spdlog::error("Bad {} at line {}", command, location);
+            return 0;
+        }
+        (command == "ENDIR" ? endIR : endDR) = end;
+    } else if (command == "STATE") {
+        for (size_t i = 1; i < tokens.size(); i++) {
+            TapState next;
+            if (!svfState(tokens[i], next)) {
+                spdlog::error("Bad state {} at line {}", tokens[i], location);
+                return 0;
+            }
+            moveTo(next);
+        }
+    } else if (command == "FREQUENCY") {
+        if (!flush()) {
+            return 0;
+        }
+        const auto config = Config::get();
+        frequency = tokens.size() >= 2 ? static_cast<unsigned int>(std::strtod(tokens[1].c_str(), nullptr)) : 0;
+        if (frequency == 0) {
+            frequency = config->lockedSpeed ? config->lockedSpeed : DEFAULT_FREQUENCY;
+        }
+        if (!engine.setClock(frequency)) {
+            return 0;
+        }
+    } else if (command == "HIR" || command == "HDR" || command == "TIR" || command == "TDR") {
+        ScanParams &params = command == "HIR" ? hir : command == "HDR" ? hdr : command == "TIR" ? tir : tdr;
+        return svfScan(tokens, params);
+    } else if (command == "SIR" || command == "SDR") {
+        const bool ir = command == "SIR";
+        ScanParams &body = ir ? sir : sdr;
+        if (!svfScan(tokens, body)) {
+            return 0;
+        }
+
+        // Shifted order is header, body, trailer
+        const ScanParams &header = ir ? hir : hdr;
+        const ScanParams &trailer = ir ? tir : tdr;
+        const uint32_t total = header.length + body.length + trailer.length;
+        const size_t bytes = (total + 7) / 8;
+        Bits tdi(bytes), expected(bytes), mask(bytes);
+        bool check = false;
+        uint32_t offset = 0;
+        for (const ScanParams *part: std::array<const ScanParams *, 3>{&header, &body, &trailer}) {
+            concat(tdi, offset, part->tdi, part->length);
+            if (part->checkTdo) {
+                concat(expected, offset, part->tdo, part->length);
+                concat(mask, offset, part->mask, part->length);
+                check = true;
+            }
+            offset += part->length;
+        }
+        scan(ir, total, tdi, check ? &expected : nullptr, &mask, ir ? endIR : endDR);
+    } else if (command == "RUNTEST") {
+        return svfRunTest(tokens);
+    } else if (command == "TRST") {
+        if (tokens.size() >= 2 && tokens[1] == "ON") {
+            spdlog::warn("TRST is not wired on this adapter, ignored at line {}", location);
+        }
+    } else {
+        spdlog::error("Unsupported SVF command {} at line {}", command, location);
+        return 0;
+    }
+    return 1;
+}
+
+int SvfPlayer::svfScan(const std::vector<std::string> &tokens, ScanParams &params) const {
+    if (tokens.size() < 2) {
+        spdlog::error("Missing length at line {}", location);
+        return 0;
+    }
+
+    const auto length = static_cast<uint32_t>(std::strtoul(tokens[1].c_str(), nullptr, 10));
+    const size_t bytes = (length + 7) / 8;
+    if (length != params.length) {
+        params.length = length;
+        params.tdi.assign(bytes, 0);
+        params.tdo.assign(bytes, 0);
+        params.mask.assign(bytes, 0xFF);
+    }
+    params.checkTdo = false;
+
+    for (size_t i = 2; i + 1 < tokens.size(); i += 2) {
+        const std::string &key = tokens[i];
+        Bits *dest = key == "TDI" ? &params.tdi : key == "TDO" ? &params.tdo : key == "MASK" ? &params.mask : nullptr;
+        Bits ignored;
+        if (key == "SMASK") {
+            dest = &ignored;
+        }
+        if (dest == nullptr || !svfHex(tokens[i + 1], length, *dest)) {
+            spdlog::error("Bad {} {} at line {}", tokens[0], key, location);
+            return 0;
+        }
+        if (key == "TDO") {
+            params.checkTdo = true;
+        }
+    }
+    return 1;
+}
+
+int SvfPlayer::svfRunTest(const std::vector<std::string> &tokens) {
+    size_t i = 1;
+    if (TapState run; i < tokens.size() && svfState(tokens[i], run)) {
+        runState = runEndState = run;
+        i++;
+    }
+
+    uint64_t cycles = 0;
+    double minTime = 0;
+    if (i + 1 < tokens.size() && (tokens[i + 1] == "TCK" || tokens[i + 1] == "SCK")) {
+        cycles = clampCycles(std::strtod(tokens[i].c_str(), nullptr));
+        i += 2;
+    }
+    if (i + 1 < tokens.size() && tokens[i + 1] == "SEC") {
+        minTime = std::strtod(tokens[i].c_str(), nullptr);
+        i += 2;
+    }
+    if (i < tokens.size() && tokens[i] == "MAXIMUM") {
+        i += 3;
+    }
+    if (i + 1 < tokens.size() && tokens[i] == "ENDSTATE") {
+        if (!svfState(tokens[i + 1], runEndState)) {
+            spdlog::error("Bad RUNTEST end state at line {}", location);
+            return 0;
+        }
+        i += 2;
+    }
+    if (i != tokens.size()) {
+        spdlog::error("Bad RUNTEST at line {}", location);
+        return 0;
+    }
+
+    return runTest(std::max(cycles, cyclesFor(minTime)), runState, runEndState);
+}
+
+bool SvfPlayer::svfHex(const std::string &token, const uint32_t length, Bits &bits) {
+    if (token.empty() || token[0] != '(') {
+        return false;
+    }
+    bits.assign((length + 7) / 8, 0);
+
+    // Rightmost digit holds the first bits shifted
+    uint32_t index = 0;
+    for (size_t i = token.size() - 1; i > 0 && index < length; i--) {
+        const int c = std::toupper(static_cast<unsigned char>(token[i]));
+        int nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'A' && c <= 'F') {
+            nibble = c - 'A' + 10;
+        } else {
+            return false;
+        }
+        for (int b = 0; b < 4 && index < length; b++, index++) {
+            setBit(bits, index, nibble & (1 << b));
+        }
+    }
+    return true;
+}
+
+bool SvfPlayer::svfState(const std::string &name, TapState &state) {
+    static constexpr std::array<std::string_view, STATE_COUNT> NAMES = {
+        "RESET", "IDLE", "DRSELECT", "DRCAPTURE", "DRSHIFT", "DREXIT1", "DRPAUSE", "DREXIT2", "DRUPDATE",
+        "IRSELECT", "IRCAPTURE", "IRSHIFT", "IREXIT1", "IRPAUSE", "IREXIT2", "IRUPDATE"
+    };
+    const auto it = std::ranges::find(NAMES, name);
+    if (it == NAMES.end()) {
+        return false;
+    }
+    state = static_cast<TapState>(it - NAMES.begin());
+    return true;
+}
+
+void SvfPlayer::concat(Bits &dest, const uint32_t offset, const Bits &src, const uint32_t length) {
+    for (uint32_t i = 0; i < length; i++) {
+        setBit(dest, offset + i, bit(src, i));
+    }
+}
+
+int SvfPlayer::xsvfScan(const bool ir, const Bits &tdi, const Bits *expected, const uint32_t length) {
+    auto issue = [&](const uint32_t us, const bool report) {
+        scan(ir, length, tdi, expected, &tdoMask, ir ? endIR : endDR);
+        return !us || runTest(cyclesFor(us / 1e6), IDLE, IDLE, report);
+    };
+
+    if (!expected || repeatCount == 0) {
+        return issue(runTestUs, true);
+    }
+
+    // Retries depend on the result, so this scan can't share a batch with later ones
+    if (!flush()) {
+        return 0;
+    }
+    uint32_t us = runTestUs;
+    for (unsigned int attempt = 0;; attempt++) {
+        const bool last = attempt >= repeatCount;
+        if (issue(us, last) && flush(last)) {
+            return 1;
+        }
+        if (!mismatch || last) {
+            return 0;
+        }
+        mismatch = false;
+        us += us / 4;
+    }
+}
+
+int SvfPlayer::playXsvf(const std::vector<unsigned char> &data) {
+    enum : unsigned char {
+        XCOMPLETE = 0x00, XTDOMASK = 0x01, XSIR = 0x02, XSDR = 0x03, XRUNTEST = 0x04, XREPEAT = 0x07,
+        XSDRSIZE = 0x08, XSDRTDO = 0x09, XSDRB = 0x0C, XSDRC = 0x0D, XSDRE = 0x0E, XSDRTDOB = 0x0F,
+        XSDRTDOC = 0x10, XSDRTDOE = 0x11, XSTATE = 0x12, XENDIR = 0x13, XENDDR = 0x14, XSIR2 = 0x15,
+        XCOMMENT = 0x16, XWAIT = 0x17
+    };
+
+    reset();
+
+    size_t pos = 0;
+    uint32_t sdrSize = 0;
+    Bits tdi, tdoExpected;
+    bool haveExpected = false;
+
+    auto number = [&](const int bytes, uint32_t &value) {
+        if (pos + bytes > data.size()) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < bytes; i++) {
+            value = (value << 8) | data[pos++];
+        }
+        return true;
+    };
+    // XSVF vectors are stored MSB first
+    auto vector = [&](const uint32_t bits, Bits &out) {
+        const size_t bytes = (bits + 7) / 8;
+        if (pos + bytes > data.size()) {
+            return false;
+        }
+        out.assign(bytes, 0);
+        for (uint32_t i = 0; i < bits; i++) {
+            setBit(out, i, data[pos + bytes - 1 - i / 8] & (1 << (i % 8)));
+        }
+        pos += bytes;
+        return true;
+    };
+
+    while (pos < data.size()) {
+        location = pos;
+        const unsigned char command = data[pos++];
+        uint32_t a = 0, b = 0, c = 0;
+        bool ok = true;
+
+        switch (command) {
+            case XCOMPLETE:
+                return flush();
+            case XTDOMASK:
+                ok = vector(sdrSize, tdoMask);
+                break;
+            case XSIR:
+            case XSIR2:
+                ok = number(command == XSIR ? 1 : 2, a) && vector(a, tdi) && xsvfScan(true, tdi, nullptr, a);
+                break;
+            case XSDR:
+                ok = vector(sdrSize, tdi) && xsvfScan(false, tdi, haveExpected ? &tdoExpected : nullptr, sdrSize);
+                break;
+            case XSDRTDO:
+                ok = vector(sdrSize, tdi) && vector(sdrSize, tdoExpected);
+                haveExpected = true;
+                ok = ok && xsvfScan(false, tdi, &tdoExpected, sdrSize);
+                break;
+            case XRUNTEST:
+                ok = number(4, runTestUs);
+                break;
+            case XREPEAT:
+                ok = number(1, a);
+                repeatCount = a;
+                break;
+            case XSDRSIZE:
+                ok = number(4, sdrSize);
+                tdoMask.assign((sdrSize + 7) / 8, 0xFF);
+                break;
+            case XSDRB:
+            case XSDRC:
+            case XSDRE:
+            case XSDRTDOB:
+            case XSDRTDOC:
+            case XSDRTDOE: {
+                const bool withTdo = command >= XSDRTDOB;
+                ok = vector(sdrSize, tdi) && (!withTdo || vector(sdrSize, tdoExpected));
+                if (!ok) {
+                    break;
+                }
+                if (command == XSDRB || command == XSDRTDOB) {
+                    moveTo(DRSHIFT);
+                }
+                const size_t offset = batchBits;
+                const bool exit = command == XSDRE || command == XSDRTDOE;
+                shiftBits(sdrSize, tdi, exit);
+                if (withTdo) {
+                    addCheck(offset, sdrSize, tdoExpected, &tdoMask);
+                }
+                if (exit) {
+                    moveTo(endDR);
+                }
+            }
+            break;
+            case XSTATE:
+                ok = number(1, a) && a < STATE_COUNT;
+                if (ok) {
+                    moveTo(static_cast<TapState>(a));
+                }
+                break;
+            case XENDIR:
+                ok = number(1, a);
+                endIR = a ? IRPAUSE : IDLE;
+                break;
+            case XENDDR:
+                ok = number(1, a);
+                endDR = a ? DRPAUSE : IDLE;
+                break;
+            case XCOMMENT:
+                while (pos < data.size() && data[pos++] != 0) {
+                }
+                break;
+            case XWAIT:
+                ok = number(1, a) && number(1, b) && number(4, c) && a < STATE_COUNT && b < STATE_COUNT;
+                if (ok) {
+                    ok = runTest(cyclesFor(c / 1e6), static_cast<TapState>(a), static_cast<TapState>(b));
+                }
+                break;
+            default:
+                spdlog::error("Unsupported XSVF command 0x{:02x} at offset {}", command, location);
+                ok = false;
+                break;
+        }
+
+        if (!ok || (batchBits >= FLUSH_BITS && !flush())) {
+            failedAt = failedAt ? failedAt : location;
+            return 0;
+        }
+    }
+    return flush();
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ShiftEngine.h"
+
+
+/*
+ * Local SVF/XSVF player. Consecutive scans and RUNTEST clocks are queued
+ * into one TMS/TDI batch and shifted through the ShiftEngine in large
+ * transfers; expected TDO is checked after each batch and playback stops
+ * at the first mismatch.
+ */
+class SvfPlayer {
+public:
+    explicit SvfPlayer(ShiftEngine &engine);
+
+    // Plays an .xsvf file as XSVF, anything else as SVF
+    [[nodiscard]] int playFile(const std::string &path);
+
+    [[nodiscard]] int playSvf(std::string_view text);
+
+    [[nodiscard]] int playXsvf(const std::vector<unsigned char> &data);
+
+    // SVF line or XSVF byte offset of the statement that failed
+    uint32_t failedAt = 0;
+
+    // Called between batches and after long waits, where the adapter may be lent out
+    std::function<void()> onFlush;
+
+private:
+    // Numbered as in XSVF XSTATE
+    enum TapState : uint8_t {
+        RESET, IDLE, DRSELECT, DRCAPTURE, DRSHIFT, DREXIT1, DRPAUSE, DREXIT2, DRUPDATE,
+        IRSELECT, IRCAPTURE, IRSHIFT, IREXIT1, IRPAUSE, IREXIT2, IRUPDATE, STATE_COUNT
+    };
+
+    // LSB first, like XVC vectors
+    using Bits = std::vector<unsigned char>;
+
+    struct Check {
+        size_t offset;
+        uint32_t length;
+        Bits expected;
+        Bits mask;
+        uint32_t location;
+    };
+
+    // Persistent parameters of one of SIR/SDR/HIR/HDR/TIR/TDR
+    struct ScanParams {
+        uint32_t length = 0;
+        Bits tdi;
+        Bits tdo;
+        Bits mask;
+        bool checkTdo = false;
+    };
+
+    void reset();
+
+    void clock(bool tms, bool tdi);
+
+    void moveTo(TapState target);
+
+    void shiftBits(uint32_t length, const Bits &tdi, bool exit);
+
+    void scan(bool ir, uint32_t length, const Bits &tdi, const Bits *expected, const Bits *mask, TapState end);
+
+    [[nodiscard]] int runTest(uint64_t cycles, TapState run, TapState end, bool report = true);
+
+    [[nodiscard]] int flush(bool report = true);
+
+    void addCheck(size_t offset, uint32_t length, const Bits &expected, const Bits *mask);
+
+    [[nodiscard]] uint64_t cyclesFor(double seconds) const;
+
+    [[nodiscard]] static uint64_t clampCycles(double cycles);
+
+    // SVF
+    [[nodiscard]] int svfStatement(const std::vector<std::string> &tokens);
+
+    [[nodiscard]] int svfScan(const std::vector<std::string> &tokens, ScanParams &params) const;
+
+    [[nodiscard]] int svfRunTest(const std::vector<std::string> &tokens);
+
+    [[nodiscard]] static bool svfHex(const std::string &token, uint32_t length, Bits &bits);
+
+    [[nodiscard]] static bool svfState(const std::string &name, TapState &state);
+
+    static void concat(Bits &dest, uint32_t offset, const Bits &src, uint32_t length);
+
+    // XSVF
+    [[nodiscard]] int xsvfScan(bool ir, const Bits &tdi, const Bits *expected, uint32_t length);
+
+    static bool bit(const Bits &bits, const size_t index) {
+        return bits[index / 8] & (1 << (index % 8));
+    }
+
+    static void setBit(Bits &bits, const size_t index, const bool value) {
+        if (value) {
+            bits[index / 8] |= 1 << (index % 8);
+        } else {
+            bits[index / 8] &= ~(1 << (index % 8));
+        }
+    }
+
+    static constexpr TapState NEXT_STATE[STATE_COUNT][2] = {
+        {IDLE, RESET}, {IDLE, DRSELECT}, {DRCAPTURE, IRSELECT}, {DRSHIFT, DREXIT1},
+        {DRSHIFT, DREXIT1}, {DRPAUSE, DRUPDATE}, {DRPAUSE, DREXIT2}, {DRSHIFT, DRUPDATE},
+        {IDLE, DRSELECT}, {IRCAPTURE, RESET}, {IRSHIFT, IREXIT1}, {IRSHIFT, IREXIT1},
+        {IRPAUSE, IRUPDATE}, {IRPAUSE, IREXIT2}, {IRSHIFT, IRUPDATE}, {IDLE, DRSELECT}
+    };
+
+    static constexpr size_t FLUSH_BITS = 4 * 1024 * 1024;
+    static constexpr unsigned int DEFAULT_FREQUENCY = 10000000;
+
+    // Waits up to this many cycles are shifted with the batch
+    static constexpr uint64_t INLINE_RUN_CYCLES = 4096;
+
+    // About 100 days at 30 MHz; bounds absurd RUNTEST times
+    static constexpr uint64_t MAX_RUN_CYCLES = uint64_t{1} << 48;
+
+    ShiftEngine &engine;
+    unsigned int frequency;
+    uint32_t location = 0;
+
+    TapState state = RESET;
+    Bits tmsBatch;
+    Bits tdiBatch;
+    Bits tdoBatch;
+    size_t batchBits = 0;
+    std::vector<Check> checks;
+
+    // SVF persistent state
+    ScanParams hir, hdr, tir, tdr, sir, sdr;
+    TapState endIR = IDLE;
+    TapState endDR = IDLE;
+    TapState runState = IDLE;
+    TapState runEndState = IDLE;
+
+    // XSVF persistent state
+    uint32_t runTestUs = 0;
+    unsigned int repeatCount = 0;
+    Bits tdoMask;
+
+    bool mismatch = false;
+};
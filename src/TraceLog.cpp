@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "TraceLog.h"
+
+
+TraceLog::~TraceLog() {
+    stop();
+}
+
+bool TraceLog::open(const std::string &path) {
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        spdlog::error("Can't open trace file \"{}\": {}", path, std::strerror(errno));
+        return false;
+    }
+
+    FileHeader header{};
+    std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        spdlog::error("Can't write trace file \"{}\": {}", path, std::strerror(errno));
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void TraceLog::start() {
+    started = true;
+    pending.reserve(64 * 1024);
+    worker = std::thread{[this] { run(); }};
+}
+
+void TraceLog::record(const std::string_view tag, const unsigned char *data, const uint32_t size) {
+#if SPDLOG_ACTIVE_LEVEL > SPDLOG_LEVEL_DEBUG
+    // Hex dumps are compiled out; only the binary trace remains.
+    if (file == nullptr) {
+        return;
+    }
+#endif
+    const uint32_t captured = file ? size : std::min(size, MAX_BYTES_TO_SHOW);
+
+    RecordHeader header{};
+    header.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    header.size = size;
+    header.captured = captured;
+    std::memcpy(header.tag, tag.data(), std::min(tag.size(), sizeof(header.tag)));
+
+    {
+        std::lock_guard lock(mutex);
+        if (!started) {
+            start();
+        }
+        if (pending.size() + sizeof(header) + captured > MAX_PENDING_BYTES) {
+            dropped++;
+            return;
+        }
+        const auto *h = reinterpret_cast<const unsigned char *>(&header);
+        pending.insert(pending.end(), h, h + sizeof(header));
+        pending.insert(pending.end(), data, data + captured);
+    }
+    cv.notify_one();
+}
+
+void TraceLog::run() {
+    std::vector<unsigned char> block;
+    block.reserve(64 * 1024);
+
+    std::unique_lock lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty() && stopping) {
+            break;
+        }
+        block.swap(pending);
+        lock.unlock();
+
+        if (file) {
+            std::fwrite(block.data(), 1, block.size(), file);
+        } else {
+            writeText(block);
+        }
+        block.clear();
+
+        lock.lock();
+    }
+}
+
+void TraceLog::writeText(const std::vector<unsigned char> &block) const {
+    static constexpr char HEX[] = "0123456789abcdef";
+
+    size_t offset = 0;
+    while (offset + sizeof(RecordHeader) <= block.size()) {
+        RecordHeader header;
+        std::memcpy(&header, block.data() + offset, sizeof(header));
+        offset += sizeof(header);
+
+        const std::string_view tag(header.tag, strnlen(header.tag, sizeof(header.tag)));
+        std::string result(header.captured * 3, ' ');
+        for (uint32_t i = 0; i < header.captured; ++i) {
+            const unsigned char byte = block[offset + i];
+            result[i * 3 + 1] = HEX[byte >> 4];
+            result[i * 3 + 2] = HEX[byte & 0xF];
+        }
+        offset += header.captured;
+
+        spdlog::debug("{}{}:{}", tag, header.size, result);
+    }
+}
+
+void TraceLog::stop() {
+    bool running;
+    {
+        std::lock_guard lock(mutex);
+        running = started;
+        stopping = true;
+    }
+    if (running) {
+        cv.notify_one();
+        worker.join();
+    }
+    started = false;
+    stopping = false;
+
+    if (dropped) {
+        spdlog::warn("Trace dropped {} records", dropped);
+        dropped = 0;
+    }
+    if (file) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
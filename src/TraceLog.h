@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+/*
+ * Off-thread recorder for the -U/-X buffer dumps.
+ * The hot path only copies the raw vector into a pending block; a background
+ * thread either appends it to a binary trace file (-T, decoded offline by
+ * xvc-tracedump) or formats it as hex through spdlog.
+ */
+class TraceLog {
+public:
+    static TraceLog &get() {
+        static TraceLog instance;
+        return instance;
+    }
+
+    // Binary trace file layout: FileHeader, then RecordHeader + data repeated.
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    struct RecordHeader {
+        uint64_t timestampNs;
+        uint32_t size;
+        uint32_t captured;
+        char tag[8];
+    };
+
+    static constexpr char MAGIC[8] = {'X', 'V', 'C', 'T', 'R', 'A', 'C', 'E'};
+    static constexpr uint32_t VERSION = 1;
+
+    bool open(const std::string &path);
+
+    void record(std::string_view tag, const unsigned char *data, uint32_t size);
+
+    void stop();
+
+    TraceLog(const TraceLog &) = delete;
+
+    TraceLog &operator=(const TraceLog &) = delete;
+
+private:
+    TraceLog() = default;
+
+    ~TraceLog();
+
+    void start();
+
+    void run();
+
+    void writeText(const std::vector<unsigned char> &block) const;
+
+    static constexpr uint32_t MAX_BYTES_TO_SHOW = 40;
+    static constexpr size_t MAX_PENDING_BYTES = 64 * 1024 * 1024;
+
+    FILE *file{};
+    bool started = false;
+    bool stopping = false;
+    uint64_t dropped = 0;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<unsigned char> pending;
+    std::thread worker;
+};
@@ -0,0 +1,47 @@
+#include "WorkerPool.h"
+#include "Config.h"
+#include "Realtime.h"
+
+
+WorkerPool::WorkerPool(const unsigned count) {
+    const int priority = Config::get()->realtimePriority;
+    for (unsigned i = 0; i < count; i++) {
+        threads.emplace_back(&WorkerPool::loop, this, i);
+        Realtime::tuneThread(threads.back().native_handle(), -1, priority, "encoder");
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread: threads) {
+        thread.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void(unsigned worker)> job) {
+    {
+        std::lock_guard guard(lock);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void WorkerPool::loop(const unsigned worker) {
+    while (true) {
+        std::function<void(unsigned)> job;
+        {
+            std::unique_lock guard(lock);
+            wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty()) {
+                return;
+            }
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job(worker);
+    }
+}
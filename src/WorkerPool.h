@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/*
+ * A few threads taking jobs in submission order, for the encode and decode
+ * of long shifts. Each job is told which worker runs it so it can use that
+ * worker's scratch state without locking.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned count);
+
+    ~WorkerPool();
+
+    [[nodiscard]] unsigned size() const {
+        return static_cast<unsigned>(threads.size());
+    }
+
+    void submit(std::function<void(unsigned worker)> job);
+
+private:
+    void loop(unsigned worker);
+
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::function<void(unsigned)> > jobs;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+};
@@ -1,5 +1,13 @@
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
 #include <spdlog/spdlog.h>
 #include "misc.h"
+#include "Config.h"
+#include "Realtime.h"
+#include "TraceLog.h"
 
 
 void Misc::badEOF() {
@@ -10,12 +18,49 @@ void Misc::badChar(int c) {
     spdlog::error("Unexpected character! {}", static_cast<char>(c));
 }
 
-void MyBuffer::showBuf(uint32_t numBytes) const {
-    const uint32_t limit = std::min(numBytes, MAX_BYTES_TO_SHOW);
+bool Misc::splitAddress(const std::string_view address, std::string &host, std::string &port) {
+    const auto colon = address.rfind(':');
+    if (colon == std::string_view::npos || colon == 0 || colon + 1 == address.size()) {
+        return false;
+    }
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+    return true;
+}
+
+int Misc::connectTcp(const std::string &host, const std::string &port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses;
+    if (const int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses); rc != 0) {
+        spdlog::error("Can't resolve {}: {}", host, gai_strerror(rc));
+        return -1;
+    }
 
-    std::string result = std::format("{}{}:", name, numBytes);
-    for (uint32_t i = 0; i < limit; ++i) {
-        result += std::format(" {:02x}", static_cast<int>(buffer->at(i)));
+    int fd = -1;
+    int error = 0;
+    for (const auto *address = addresses; address != nullptr; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        error = errno;
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
     }
-    spdlog::debug(result);
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        spdlog::error("Can't connect to {}:{}: {}", host, port, strerror(error));
+        return -1;
+    }
+    Realtime::tuneSocket(fd, Config::get()->busyPollUsec);
+    return fd;
+}
+
+void MyBuffer::showBuf(const uint32_t numBytes, const uint32_t offset) const {
+    TraceLog::get().record(name, buffer->data() + offset,
+                           std::min(numBytes, static_cast<uint32_t>(buffer->size()) - offset));
 }
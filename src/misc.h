@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 
 class Misc {
@@ -7,6 +8,12 @@ public:
     static void badEOF();
 
     static void badChar(int c);
+
+    // Split "host:port"; false if either part is missing
+    static bool splitAddress(std::string_view address, std::string &host, std::string &port);
+
+    // Connected TCP socket with Nagle off, or -1 after logging why
+    static int connectTcp(const std::string &host, const std::string &port);
 };
 
 class MyBuffer {
@@ -18,10 +25,8 @@ public:
 
     std::unique_ptr<std::vector<unsigned char> > buffer = std::make_unique<std::vector<unsigned char> >(XVC_BUFFER_SIZE);
 
-    void showBuf(uint32_t numBytes) const;
+    void showBuf(uint32_t numBytes, uint32_t offset = 0) const;
 
 private:
     std::string_view name;
-
-    static constexpr uint32_t MAX_BYTES_TO_SHOW = 40;
 };
@@ -5,14 +5,52 @@
 #include <arpa/inet.h>
 #include <cstdlib>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "server.h"
+#include "Realtime.h"
 
-Server::Server() : vnc(std::make_unique<VncProtocol>()) {
+Server::Server() {
     isContinue = true;
+    const auto config = Config::get();
+    if (config->broker) {
+        broker = std::make_unique<Broker>();
+    } else if (!config->relayAddress.empty()) {
+        relay = std::make_unique<Relay>(config->relayAddress);
+    } else {
+        vnc = std::make_unique<VncProtocol>();
+        vnc->startDiscovery();
+    }
+
+    /*
+     * SIGUSR1 brings the adapter up ahead of the first client. SA_RESTART
+     * keeps it from failing a session's socket reads; the pipe wakes the
+     * accept wait whichever thread the signal lands on.
+     */
+    if (pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        spdlog::error("Can't create wake pipe: {}", strerror(errno));
+        std::exit(EXIT_FAILURE);
+    }
+    struct sigaction action{};
+    action.sa_handler = onPrewarm;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, nullptr);
+
     if (const auto rc = createSocket(); rc < 0) {
         spdlog::error("Failed to create socket, exiting.");
         std::exit(EXIT_FAILURE);
     }
+
+    // Scan the chain once so the broker can match boards by IDCODE
+    if (vnc && !config->brokerAddress.empty()) {
+        auto idcodes = vnc->identify();
+        if (idcodes.empty()) {
+            spdlog::warn("No IDCODEs found, registering without any");
+        }
+        registration = std::make_unique<Registration>(config->brokerAddress, std::move(idcodes), vnc->adapterSerial(),
+                                                      *vnc);
+    }
 }
 
 Server::~Server() {
@@ -20,9 +58,52 @@ Server::~Server() {
     close(_socket);
 }
 
+void Server::onPrewarm(int) {
+    const int saved = errno;
+    prewarmRequested = 1;
+    constexpr char wake = 0;
+    (void) !write(wakePipe[1], &wake, 1);
+    errno = saved;
+}
+
+// A signal during a session is only acted on once it ends
+void Server::prewarmIfRequested() const {
+    char drain[16];
+    while (read(wakePipe[0], drain, sizeof(drain)) > 0) {
+    }
+    if (prewarmRequested) {
+        prewarmRequested = 0;
+        if (vnc) {
+            vnc->prewarm();
+        }
+    }
+}
+
+// systemd-style socket activation: the listening socket arrives as fd 3
+int Server::inheritSocket() {
+    const char *pid = std::getenv("LISTEN_PID");
+    const char *fds = std::getenv("LISTEN_FDS");
+    if (pid == nullptr || fds == nullptr || std::strtol(pid, nullptr, 10) != getpid() ||
+        std::strtol(fds, nullptr, 10) < 1) {
+        return -1;
+    }
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    fcntl(LISTEN_FDS_START, F_SETFD, FD_CLOEXEC);
+    return LISTEN_FDS_START;
+}
+
 int Server::createSocket() {
     const auto config = Config::get();
 
+    if (const int fd = inheritSocket(); fd >= 0) {
+        _socket = fd;
+        spdlog::info("Using inherited listening socket");
+        return 0;
+    }
+
     _socket = socket(AF_INET, SOCK_STREAM, 0);
     if (_socket < 0) {
         spdlog::error("Socket creation failed: {}", strerror(errno));
@@ -51,7 +132,7 @@ int Server::createSocket() {
         return -1;
     }
 
-    if (listen(_socket, 1) < 0) {
+    if (listen(_socket, vnc ? 1 : SHARED_BACKLOG) < 0) {
         spdlog::error("Listen() failed: {}", strerror(errno));
         close(_socket);
         return -1;
@@ -62,18 +143,55 @@ int Server::createSocket() {
 }
 
 void Server::internal_loop() const {
+    const auto config = Config::get();
     std::string farName(INET_ADDRSTRLEN, '\0');
 
     while (isContinue) {
+        prewarmIfRequested();
+
+        pollfd ready[] = {{_socket, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        if (poll(ready, 2, -1) < 0 && errno != EINTR) {
+            spdlog::error("Can't wait for connections: {}", strerror(errno));
+            std::exit(2);
+        }
+        if (!(ready[0].revents & POLLIN)) {
+            continue;
+        }
+
         sockaddr_in farAddr{};
         socklen_t addrlen = sizeof(farAddr);
 
         const int fd = accept(_socket, reinterpret_cast<struct sockaddr *>(&farAddr), &addrlen);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
         if (fd < 0) {
             spdlog::error("Can't accept connection: {}", strerror(errno));
             std::exit(2);
         }
 
+        if (config->busyPollUsec > 0) {
+            Realtime::tuneSocket(fd, config->busyPollUsec);
+        }
+
+        if (relay) {
+            if (!config->flags->quietFlag) {
+                inet_ntop(farAddr.sin_family, &farAddr.sin_addr, farName.data(), sizeof(farAddr.sin_addr));
+                spdlog::info("Relay client {}", farName);
+            }
+            relay->serve(fd);
+            continue;
+        }
+        if (broker) {
+            // Registrations are reached back at this address, so it must not come out truncated
+            if (!inet_ntop(farAddr.sin_family, &farAddr.sin_addr, farName.data(), farName.size())) {
+                close(fd);
+                continue;
+            }
+            broker->serve(fd, farName.c_str());
+            continue;
+        }
+
         FILE *fp = fdopen(fd, "r");
         if (fp == nullptr) {
             spdlog::error("fdopen failed: {}", strerror(errno));
@@ -81,11 +199,12 @@ void Server::internal_loop() const {
             std::exit(2);
         }
 
+        // No adapter: turn this client away and keep listening
         if (!vnc->connect(fp, fd)) {
+            spdlog::error("Adapter not available, closing connection");
             vnc->close();
             fclose(fp);
-            close(fd);
-            std::exit(2);
+            continue;
         }
 
         if (!vnc->isQuietMode()) {
@@ -93,7 +212,9 @@ void Server::internal_loop() const {
             spdlog::info("Connect {}", farName);
         }
 
+        vnc->busy = true;
         vnc->processCommands();
+        vnc->busy = false;
 
         if (!vnc->isQuietMode()) {
             spdlog::info("Disconnect {}", farName);
@@ -106,5 +227,7 @@ void Server::internal_loop() const {
 }
 
 void Server::start() const {
+    const auto config = Config::get();
+    Realtime::tuneThread(pthread_self(), config->protocolCpu, config->realtimePriority, "protocol");
     internal_loop();
 }
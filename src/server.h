@@ -1,6 +1,10 @@
 #pragma once
 
+#include <csignal>
 #include "xvncd.h"
+#include "Relay.h"
+#include "Broker.h"
+#include "Registration.h"
 
 class Server {
 public:
@@ -13,11 +17,34 @@ public:
 private:
     int createSocket();
 
+    static int inheritSocket();
+
+    static void onPrewarm(int);
+
+    void prewarmIfRequested() const;
+
+    static inline volatile sig_atomic_t prewarmRequested = 0;
+
+    // Written by onPrewarm so the wait for a client wakes up
+    static inline int wakePipe[2] = {-1, -1};
+
     int _socket{};
 
     std::unique_ptr<VncProtocol> vnc;
 
+    // Set with --relay or --broker, in place of vnc
+    std::unique_ptr<Relay> relay;
+    std::unique_ptr<Broker> broker;
+
+    // Set with --register
+    std::unique_ptr<Registration> registration;
+
     void internal_loop() const;
 
     volatile bool isContinue = true;
+
+    static constexpr int LISTEN_FDS_START = 3;
+
+    // A relay or broker serves several clients at once
+    static constexpr int SHARED_BACKLOG = 16;
 };
@@ -4,40 +4,111 @@
 #include <libusb.h>
 #include <spdlog/spdlog.h>
 #include "usb.h"
+#include "Realtime.h"
 
 #include <iostream>
 
-USB::USB() : vendorId(0x0403),
-             productId(0x6014),
-             serialNumber(nullptr) {
+USB::USB(const std::string &serial) : vendorId(0x0403),
+                                     productId(0x6014),
+                                     serialNumber(serial) {
     config = Config::get();
+    if (serialNumber.empty()) {
+        serialNumber = config->serialNumber;
+    }
+    showUSB = config->flags->showUSB;
+    runtFlag = config->flags->runtFlag;
+    busyPoll = config->busyPollUsec > 0;
+    diagnostics = showUSB || runtFlag || config->flags->statisticsFlag;
+    txBuf.buffer->resize(MAX_WRITE_SIZE);
+}
 
-    libusb_init_context(&usb_context, nullptr, 0);
+/*
+ * libusb is brought up on first use rather than at construction, so the
+ * daemon can listen before touching the bus. Not thread safe; the caller
+ * keeps discovery and bring-up on one thread at a time.
+ */
+int USB::init_context() {
+    if (usb_context) {
+        return 1;
+    }
+    if (const int status = libusb_init_context(&usb_context, nullptr, 0); status < 0) {
+        spdlog::error(ERROR_LIBUSB_INIT, libusb_strerror(status));
+        usb_context = nullptr;
+        return 0;
+    }
 
-    if (const int rc = libusb_hotplug_register_callback(usb_context,
-                                                        LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
-                                                        LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
-                                                        0,
-                                                        static_cast<int>(vendorId), static_cast<int>(productId),
-                                                        LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, nullptr,
-                                                        &callback_handle); rc != LIBUSB_SUCCESS) {
-        spdlog::info("Error creating a hotplug callback\n");
-        libusb_exit(usb_context);
-        std::exit(EXIT_FAILURE);
+    if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+        if (const int rc = libusb_hotplug_register_callback(usb_context,
+                                                            LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                                                            LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                                                            0,
+                                                            static_cast<int>(vendorId), static_cast<int>(productId),
+                                                            LIBUSB_HOTPLUG_MATCH_ANY, hotplug_callback, nullptr,
+                                                            &callback_handle); rc != LIBUSB_SUCCESS) {
+            spdlog::warn("Error creating a hotplug callback: {}", libusb_strerror(rc));
+        } else {
+            hotplugRegistered = true;
+        }
+    }
+
+    // In busy-poll mode transfers reap their own completions, so no event thread competes for them.
+    if (busyPoll) {
+        transfer = libusb_alloc_transfer(0);
+    } else {
+        usb_handle_events();
     }
+    return 1;
+}
 
-    usb_handle_events();
+// Enumerate only: report whether an adapter is present without opening it
+int USB::discover() {
+    if (!init_context()) {
+        return 0;
+    }
 
-    if (const int status = libusb_init(&usb_context); status < 0) {
-        spdlog::error("Failed to initialize libusb: {}", libusb_strerror(status));
-        std::exit(EXIT_FAILURE);
+    libusb_device **list;
+    const auto n = libusb_get_device_list(usb_context, &list);
+    if (n < 0) {
+        spdlog::error(ERROR_LIBUSB_INIT, libusb_strerror(static_cast<int>(n)));
+        return 0;
+    }
+
+    int found = 0;
+    for (ssize_t i = 0; i < n && !found; ++i) {
+        libusb_device_descriptor desc{};
+        if (libusb_get_device_descriptor(list[i], &desc) < 0 || desc.idVendor != vendorId) {
+            continue;
+        }
+        found = desc.idProduct == productId || std::ranges::any_of(validCodes, [&desc](const uint16_t code) {
+            return desc.idProduct == code;
+        });
+    }
+    libusb_free_device_list(list, 1);
+
+    if (found) {
+        SPDLOG_DEBUG("USB adapter present");
+    } else {
+        spdlog::warn("No USB adapter yet; will look again when a client connects");
     }
+    return found;
 }
 
 USB::~USB() {
     isContinue = false;
-    libusb_hotplug_deregister_callback(nullptr, callback_handle);
-    libusb_exit(nullptr);
+    if (transfer) {
+        libusb_free_transfer(transfer);
+    }
+    if (hotplugRegistered) {
+        libusb_hotplug_deregister_callback(usb_context, callback_handle);
+    }
+    if (callback_handle_thread.joinable()) {
+        // Wake the event thread out of libusb so it sees isContinue before the context goes
+        libusb_interrupt_event_handler(usb_context);
+        callback_handle_thread.join();
+    }
+    if (usb_context) {
+        libusb_exit(usb_context);
+    }
 }
 
 void USB::usb_handle_events() {
@@ -50,6 +121,39 @@ void USB::usb_handle_events() {
     };
 
     callback_handle_thread = std::move(std::thread{f});
+    Realtime::tuneThread(callback_handle_thread.native_handle(), config->usbCpu, config->realtimePriority, "USB");
+}
+
+void USB::transfer_callback(libusb_transfer *transfer) {
+    *static_cast<int *>(transfer->user_data) = 1;
+}
+
+int USB::bulk_transfer(const int endpoint, unsigned char *data, const int length, int *transferred,
+                       const unsigned int timeout) {
+    if (!busyPoll) {
+        return libusb_bulk_transfer(dev_handle, endpoint, data, length, transferred, timeout);
+    }
+
+    int completed = 0;
+    libusb_fill_bulk_transfer(transfer, dev_handle, endpoint, data, length, transfer_callback, &completed, timeout);
+    if (const int status = libusb_submit_transfer(transfer); status < 0) {
+        return status;
+    }
+
+    timeval zero{};
+    while (!completed) {
+        libusb_handle_events_timeout_completed(usb_context, &zero, &completed);
+    }
+
+    *transferred = transfer->actual_length;
+    switch (transfer->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            return LIBUSB_SUCCESS;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            return LIBUSB_ERROR_TIMEOUT;
+        default:
+            return LIBUSB_ERROR_IO;
+    }
 }
 
 void USB::getDeviceString(const int index, std::string &dest) const {
@@ -83,7 +187,7 @@ void USB::getEndpoints(const libusb_interface_descriptor *iface_desc) {
                     std::exit(EXIT_FAILURE);
                 }
                 bulkInEndpointAddress = ep->bEndpointAddress;
-                bulkInRequestSize = std::min(ep->wMaxPacketSize, static_cast<uint16_t>(txBuf.buffer->size()));
+                bulkInRequestSize = ep->wMaxPacketSize;
             } else {
                 if (bulkOutEndpointAddress != 0) {
                     spdlog::error(ERROR_TOO_MANY_OUTPUT_ENDPOINTS);
@@ -109,14 +213,14 @@ int USB::hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotplu
 
     switch (event) {
         case LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED:
-            spdlog::debug("Connected USB device");
+            SPDLOG_DEBUG("Connected USB device");
 
             if (const int rc = libusb_open(dev, &dev_handle); LIBUSB_SUCCESS != rc) {
                 spdlog::error("Could not open USB device");
             }
             break;
         case LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT:
-            spdlog::debug("Disconnected USB device");
+            SPDLOG_DEBUG("Disconnected USB device");
 
             if (dev_handle) {
                 libusb_close(dev_handle);
@@ -187,93 +291,158 @@ int USB::findDevice(libusb_device **list, ssize_t count) {
             deviceProductId = desc.idProduct;
             getDeviceStrings(&desc);
 
-            if (serialNumber == nullptr || std::strcmp(serialNumber, deviceSerialString.data()) == 0) {
+            if (serialNumber.empty() || serialNumber == deviceSerialString) {
                 getEndpoints(iface_desc);
                 libusb_free_config_descriptor(libusb_config);
                 productId = desc.idProduct;
+                setLimits();
                 return 1;
             }
             libusb_close(dev_handle);
         }
         libusb_free_config_descriptor(libusb_config);
     }
+    // Left over from the last device tried
+    deviceSerialString.clear();
     return 0;
 }
 
+/*
+ * A read is only started once the whole write is out, so whatever the
+ * commands return has to fit the chip's RX FIFO meanwhile or the MPSSE
+ * stalls and the write with it. The read buffer has room for the status
+ * bytes of every packet plus the pair that lands ahead of the data.
+ */
+void USB::setLimits() {
+    readLimit = bulkInRequestSize - STATUS_BYTE_COUNT;
+    for (size_t i = 0; i < validCodes.size(); i++) {
+        if (validCodes[i] == productId) {
+            readLimit = rxFifoSizes[i];
+        }
+    }
+    const int payload = bulkInRequestSize - STATUS_BYTE_COUNT;
+    const int packets = (readLimit + payload - 1) / payload;
+    rxBuf.buffer->resize(STATUS_BYTE_COUNT + readLimit + (packets + 1) * bulkInRequestSize);
+}
+
 int USB::write_tx_buffer() {
-    txBuf.buffer->resize(txCount);
+    return diagnostics ? write_tx_buffer<true>() : write_tx_buffer<false>();
+}
+
+int USB::read_data(const int bytes_to_read) {
+    return diagnostics ? read_data<true>(bytes_to_read) : read_data<false>(bytes_to_read);
+}
 
+template<bool Diagnostics>
+int USB::write_tx_buffer() {
     auto nSend = txCount;
     auto *buffer = txBuf.buffer->data();
 
-    if (config->flags->showUSB) {
-        txBuf.showBuf(nSend);
+    if constexpr (Diagnostics) {
+        if (showUSB) {
+            txBuf.showBuf(nSend);
+        }
+        largestWriteRequest = std::max(largestWriteRequest, nSend);
     }
-    largestWriteRequest = std::max(largestWriteRequest, nSend);
 
     while (nSend > 0) {
         int transferred;
-        if (const int status = libusb_bulk_transfer(dev_handle, bulkOutEndpointAddress, buffer, nSend, &transferred,
-                                                    10000);
+        if (const int status = bulk_transfer(bulkOutEndpointAddress, buffer, nSend, &transferred, 10000);
             status < 0) {
             spdlog::error(ERROR_USB_WRITE_FAILED, nSend, libusb_strerror(status));
             return 0;
         }
         nSend -= transferred;
         buffer += transferred;
-        largestWriteSent = std::max(largestWriteSent, transferred);
+        if constexpr (Diagnostics) {
+            largestWriteSent = std::max(largestWriteSent, transferred);
+        }
     }
+    txCount = 0;
     return 1;
 }
 
 int USB::write_data(const std::vector<unsigned char> &data) {
-    *txBuf.buffer = data;
+    std::ranges::copy(data, txBuf.buffer->begin());
+    txCount = static_cast<int>(data.size());
     return write_tx_buffer();
 }
 
+/*
+ * Multi-packet reads land straight in rxBuf. Each transfer is placed so
+ * its first status pair overwrites the last two bytes already received,
+ * which are put back afterwards; only the later packets of a transfer
+ * are moved down over their status bytes. A single-packet read, the
+ * common case for short shifts, is not copied at all.
+ */
+template<bool Diagnostics>
 int USB::read_data(const int bytes_to_read) {
-    largestReadRequest = std::max(largestReadRequest, bytes_to_read);
+    if constexpr (Diagnostics) {
+        largestReadRequest = std::max(largestReadRequest, bytes_to_read);
+    }
 
-    if (bytes_to_read + STATUS_BYTE_COUNT > bulkInRequestSize) {
-        spdlog::error(ERROR_USB_READ_REQUEST_LIMIT, bytes_to_read + STATUS_BYTE_COUNT, bulkInRequestSize);
-        std::exit(EXIT_FAILURE);
+    if (bytes_to_read > readLimit) {
+        spdlog::error(ERROR_USB_READ_REQUEST_LIMIT, bytes_to_read, readLimit);
+        return 0;
     }
 
-    auto base = rxBuf.buffer->data();
-    auto bytesRemaining = bytes_to_read;
+    const int payload = bulkInRequestSize - STATUS_BYTE_COUNT;
+    auto *data = rxBuf.buffer->data() + STATUS_BYTE_COUNT;
+    int received = 0;
 
-    while (bytesRemaining > 0) {
-        const int bytesToTransfer = std::min(bytesRemaining + STATUS_BYTE_COUNT, bulkInRequestSize);
+    while (received < bytes_to_read) {
+        const int packets = (bytes_to_read - received + payload - 1) / payload;
+        auto *landing = data + received - STATUS_BYTE_COUNT;
+        unsigned char saved[STATUS_BYTE_COUNT];
+        std::memcpy(saved, landing, STATUS_BYTE_COUNT);
 
         int bytesTransferred = 0;
-        if (const auto status = libusb_bulk_transfer(dev_handle, bulkInEndpointAddress, txBuf.buffer->data(),
-                                                     bytesToTransfer, &bytesTransferred, 5000); status < 0) {
+        if (const auto status = bulk_transfer(bulkInEndpointAddress, landing, packets * bulkInRequestSize,
+                                              &bytesTransferred, 5000); status < 0) {
             spdlog::error(ERROR_USB_READ_FAILED, libusb_strerror(status));
-            std::exit(EXIT_FAILURE);
+            return 0;
         }
+        std::memcpy(landing, saved, STATUS_BYTE_COUNT);
 
         if (bytesTransferred < STATUS_BYTE_COUNT) {
-            if (config->flags->runtFlag) {
-                spdlog::warn(WARNING_USB_READ_LESS_THAN_STATUS_COUNT);
+            if constexpr (Diagnostics) {
+                if (runtFlag) {
+                    spdlog::warn(WARNING_USB_READ_LESS_THAN_STATUS_COUNT);
+                }
             }
             continue;
         }
 
-        const auto dataBytes = bytesTransferred - STATUS_BYTE_COUNT;
-        std::memcpy(base, txBuf.buffer->data() + STATUS_BYTE_COUNT, dataBytes);
-
-        base += dataBytes;
-        bytesRemaining -= dataBytes;
+        // Only the last packet of a transfer can be short
+        received += std::min(bytesTransferred, bulkInRequestSize) - STATUS_BYTE_COUNT;
+        for (int offset = bulkInRequestSize; offset < bytesTransferred; offset += bulkInRequestSize) {
+            const int length = std::min(bytesTransferred - offset, bulkInRequestSize) - STATUS_BYTE_COUNT;
+            if (length > 0) {
+                std::memmove(data + received, landing + offset + STATUS_BYTE_COUNT, length);
+                received += length;
+            }
+        }
     }
 
-    if (config->flags->showUSB) {
-        rxBuf.showBuf(bytes_to_read);
+    if constexpr (Diagnostics) {
+        if (showUSB) {
+            rxBuf.showBuf(bytes_to_read, STATUS_BYTE_COUNT);
+        }
     }
 
     return 1;
 }
 
+template int USB::write_tx_buffer<false>();
+template int USB::write_tx_buffer<true>();
+template int USB::read_data<false>(int bytes_to_read);
+template int USB::read_data<true>(int bytes_to_read);
+
 int USB::connect() {
+    if (!init_context()) {
+        return 0;
+    }
+
     libusb_device **list;
     const auto n = libusb_get_device_list(usb_context, &list);
     if (n < 0) {
@@ -317,6 +486,8 @@ void USB::close() {
         libusb_close(dev_handle);
         dev_handle = nullptr;
     }
+    // Commands queued for a device that's gone
+    txCount = 0;
 }
 
 int USB::set_control(int bRequest, int wValue) const {
@@ -334,14 +505,27 @@ int USB::set_control(int bRequest, int wValue) const {
 }
 
 void USB::cmdByte(const int byte) {
-    if (txCount >= USB_BUFFER_SIZE) {
+    if (txCount >= MAX_WRITE_SIZE) {
+        spdlog::error("FTDI TX OVERFLOW!");
+        std::exit(EXIT_FAILURE);
+    }
+    (*txBuf.buffer)[txCount++] = byte;
+}
+
+unsigned char *USB::cmdSpace(const int bytes) {
+    if (txCount + bytes > MAX_WRITE_SIZE) {
         spdlog::error("FTDI TX OVERFLOW!");
         std::exit(EXIT_FAILURE);
     }
-    txCount++;
-    txBuf.buffer->at(txCount) = byte;
+    unsigned char *space = txBuf.buffer->data() + txCount;
+    txCount += bytes;
+    return space;
 }
 
 bool USB::check(const int rxIndex, const int rxBit) const {
-    return rxBuf.buffer->at(rxIndex) & rxBit;
+    return rxBuf.buffer->at(STATUS_BYTE_COUNT + rxIndex) & rxBit;
+}
+
+const unsigned char *USB::rx_data() const {
+    return rxBuf.buffer->data() + STATUS_BYTE_COUNT;
 }
@@ -2,6 +2,7 @@
 
 #include <libusb.h>
 #include <array>
+#include <atomic>
 #include <string>
 #include <thread>
 #include "Config.h"
@@ -10,11 +11,16 @@
 
 class USB {
 public:
-    explicit USB();
+    explicit USB(const std::string &serial = {});
 
     ~USB();
 
     static constexpr int USB_BUFFER_SIZE = 512;
+    static constexpr int MAX_WRITE_SIZE = 4096;
+
+    int init_context();
+
+    int discover();
 
     int connect();
 
@@ -24,8 +30,17 @@ public:
 
     int read_data(int bytes_to_read);
 
+    // Variants with the dumps and request statistics compiled in or out
+    template<bool Diagnostics>
+    int write_tx_buffer();
+
+    template<bool Diagnostics>
+    int read_data(int bytes_to_read);
+
     [[nodiscard]] bool check(int rxIndex, int rxBit) const;
 
+    [[nodiscard]] const unsigned char *rx_data() const;
+
     [[nodiscard]] int set_control(int bRequest, int wValue) const;
 
     void usb_handle_events();
@@ -36,15 +51,29 @@ public:
     int largestWriteRequest{};
     int largestReadRequest{};
     int bulkOutRequestSize{};
+    int bulkInRequestSize{};
+
+    // Most bytes one write may queue and one read may return. Reads are held
+    // to what the chip's RX FIFO takes while the write is still going out.
+    int writeLimit = MAX_WRITE_SIZE;
+    int readLimit{};
 
     int txCount = 0;
 
     void cmdByte(int byte);
 
+    // Claims the next 'bytes' of the TX buffer for the caller to fill
+    [[nodiscard]] unsigned char *cmdSpace(int bytes);
+
+    // Serial number of the adapter connect() opened, empty if none
+    [[nodiscard]] const std::string &serial() const {
+        return deviceSerialString;
+    }
+
 private:
     uint32_t vendorId;
     uint32_t productId;
-    const char *serialNumber;
+    std::string serialNumber;
 
     int deviceVendorId{};
     int deviceProductId{};
@@ -59,7 +88,6 @@ private:
     unsigned char bTag{};
     int bulkOutEndpointAddress{};
     int bulkInEndpointAddress{};
-    int bulkInRequestSize{};
 
     libusb_device_handle *dev_handle{};
 
@@ -79,7 +107,7 @@ private:
     static constexpr std::string_view ERROR_USB_READ_FAILED = "Bulk read failed: {}";
     static constexpr std::string_view ERROR_USB_WRITE_FAILED = "Bulk write {} failed: {}";
     static constexpr std::string_view ERROR_GET_CONFIG_DESCRIPTOR = "Can't get vendor {} product {} configuration.";
-    static constexpr std::string_view ERROR_USB_READ_REQUEST_LIMIT = "USB read request size %d exceeds limit {}.";
+    static constexpr std::string_view ERROR_USB_READ_REQUEST_LIMIT = "USB read request size {} exceeds limit {}.";
     static constexpr std::string_view WARNING_USB_READ_LESS_THAN_STATUS_COUNT = "Received less than status byte count.";
 
     static constexpr std::array<uint16_t, 3> validCodes = {
@@ -88,7 +116,11 @@ private:
         0x6014 // FT232H
     };
 
-    const int STATUS_BYTE_COUNT = 2;
+    // RX FIFO per channel, same order
+    static constexpr std::array<int, 3> rxFifoSizes = {4096, 2048, 1024};
+
+    // The FTDI prefixes every IN packet with two modem status bytes
+    static constexpr int STATUS_BYTE_COUNT = 2;
 
     MyBuffer txBuf{"Tx"};
 
@@ -96,6 +128,12 @@ private:
 
     std::shared_ptr<Config> config;
 
+    // Diagnostics copied out of Config once, read on every transfer
+    bool showUSB{};
+    bool runtFlag{};
+    bool busyPoll{};
+    bool diagnostics{};
+
     void getDeviceString(int index, std::string &dest) const;
 
     int findDevice(libusb_device **list, ssize_t count);
@@ -104,9 +142,18 @@ private:
 
     void getEndpoints(const libusb_interface_descriptor *iface_desc);
 
+    void setLimits();
+
+    int bulk_transfer(int endpoint, unsigned char *data, int length, int *transferred, unsigned int timeout);
+
+    static void transfer_callback(libusb_transfer *transfer);
+
+    libusb_transfer *transfer{};
+
     static int hotplug_callback(libusb_context *ctx, libusb_device *dev, libusb_hotplug_event event, void *user_data);
 
     libusb_hotplug_callback_handle callback_handle{};
+    bool hotplugRegistered{};
     std::thread callback_handle_thread;
-    volatile bool isContinue = true;
+    std::atomic<bool> isContinue{true};
 };
@@ -1,24 +1,50 @@
+#include <poll.h>
 #include <cstdio>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <bit>
 #include <spdlog/spdlog.h>
 #include <print>
+#include <thread>
 #include "xvncd.h"
 #include "misc.h"
+#include "GpioSequencer.h"
+#include "ScanBridge.h"
 
 
-VncProtocol::VncProtocol(): ftdi(std::make_unique<FTDI>()), fd(0) {
+VncProtocol::VncProtocol(): ftdi(std::make_unique<FTDI>()),
+                           passthrough(std::make_unique<MpssePassthrough>(*ftdi)), fd(0) {
     const auto config = Config::get();
     flags = config->flags.get();
+    showXVC = flags->showXVC;
+    loopback = flags->loopback;
+    cutThrough = !showXVC && !loopback;
+    extensions = config->protocolExtensions;
+    adapterless = config->adapterless();
+    singleAdapter = !adapterless && config->broadcastSerials.empty();
+    passthroughEnabled = extensions && singleAdapter && !config->mpsseToken.empty();
+    if (config->scanCacheMs > 0) {
+        scanCache = std::make_unique<ScanCache>(std::chrono::milliseconds(config->scanCacheMs),
+                                                config->scanCacheInstructions);
+    }
+    if (!config->pinSampler.empty()) {
+        pinSampler = std::make_unique<PinSampler>(*ftdi, adapterLock, config->pinSampler, config->pinEdges);
+        if (!pinSampler->open()) {
+            std::exit(EXIT_FAILURE);
+        }
+    }
 }
 
 VncProtocol::~VncProtocol() {
+    if (discovery.joinable()) {
+        discovery.join();
+    }
     close();
 }
 
 int VncProtocol::do_get_info() const {
-    if (flags->showXVC) {
+    if (showXVC) {
         spdlog::info("getinfo: {}", VERSION);
     }
     std::vector<unsigned char> cBuf{};
@@ -29,153 +55,12 @@ int VncProtocol::do_get_info() const {
     return reply(cBuf);
 }
 
-int VncProtocol::shiftChunks(const uint32_t shiftBits) {
-    uint32_t nBits = shiftBits;
-    unsigned char iBit = 0x01;
-    int iIndex = 0;
-    int cmdBitCount;
-    int tmsBit;
-    int tdoBit = 0x01;
-    int tdoIndex = 0;
-    std::vector<unsigned short> rxBitCounts((USB::USB_BUFFER_SIZE / 3) + 1);
-
-    if (flags->loopback) {
-        ftdi->enable_loopback();
-    }
-
-    while (nBits) {
-        int rxBytesWanted = 0;
-        int rxBitCountIndex = 0;
-
-        ftdi->usb->txCount = 0;
-        chunkCount++;
-
-        do {
-            const int tdiFirstState = (tdiBuf.buffer->at(iIndex) & iBit) != 0;
-            cmdBitCount = 0;
-            int cmdBit = 0x01;
-            int tmsBits = 0;
-            do {
-                tmsBit = (tmsBuf.buffer->at(iIndex) & iBit) ? cmdBit : 0;
-                tmsBits |= tmsBit;
-                if (iBit == 0x80) {
-                    iBit = 0x01;
-                    iIndex++;
-                } else {
-                    iBit <<= 1;
-                }
-                cmdBitCount++;
-                cmdBit <<= 1;
-            } while (cmdBitCount < 6 && cmdBitCount < nBits && (tdiBuf.buffer->at(iIndex) & iBit) != 0 == tdiFirstState)
-            ;
-
-            // Duplicate the final TMS bit
-            tmsBits |= (tmsBit << 1);
-            const int tmsState = tmsBit != 0;
-
-            // Send the TMS bits and TDI value
-            ftdi->set_tms_bits(cmdBitCount, (tdiFirstState << 7) | tmsBits);
-
-            rxBitCountIndex++;
-            rxBitCounts[rxBitCountIndex] = cmdBitCount;
-
-            rxBytesWanted++;
-            nBits -= cmdBitCount;
-
-            // Stash TDI bits until bit limit reached or TMS change of state
-            cmdBitCount = 0;
-            int cmdIndex = 0;
-            cmdBit = 0x01;
-            cmdBuf.buffer->at(0) = 0;
-
-            while (nBits > 0 &&
-                   ((tmsBuf.buffer->at(iIndex) & iBit) == tmsState) &&
-                   (ftdi->usb->txCount + (cmdBitCount / 8)) < (ftdi->usb->bulkOutRequestSize - 5)) {
-                if (tdiBuf.buffer->at(iIndex) & iBit) {
-                    cmdBuf.buffer->at(cmdIndex) |= cmdBit;
-                }
-                if (cmdBit == 0x80) {
-                    cmdBit = 0x01;
-                    cmdIndex++;
-                    cmdBuf.buffer->at(cmdIndex) = 0;
-                } else {
-                    cmdBit <<= 1;
-                }
-                if (iBit == 0x80) {
-                    iBit = 0x01;
-                    iIndex++;
-                } else {
-                    iBit <<= 1;
-                }
-                cmdBitCount++;
-                nBits--;
-            }
-
-            // Send stashed TDI bits
-            if (cmdBitCount > 0) {
-                rxBitCountIndex++;
-                rxBitCounts[rxBitCountIndex] = cmdBitCount;
-
-                const int cmdBytes = cmdBitCount / 8;
-                if (cmdBitCount >= 8) {
-                    rxBytesWanted += cmdBytes;
-                    cmdBitCount -= cmdBytes * 8;
-
-                    ftdi->set_tdi_bytes(cmdBytes);
-
-                    for (int i = 0; i < cmdBytes; i++) {
-                        ftdi->cmd_byte(cmdBuf.buffer->at(i));
-                    }
-                }
-                if (cmdBitCount) {
-                    rxBytesWanted++;
-                    ftdi->set_tdi_bits(cmdBitCount, cmdBuf.buffer->at(cmdBytes));
-                }
-            }
-        } while (nBits != 0 && ftdi->usb->txCount + cmdBitCount / 8 < (ftdi->usb->bulkOutRequestSize - 6));
-
-        // Shift data
-        if (const int wr = ftdi->usb->write_tx_buffer(); !wr) {
-            return 0;
-        }
-
-        if (const int rd = ftdi->usb->read_data(rxBytesWanted); !rd) {
-            return 0;
-        }
-
-        // Process received data
-        int rxIndex = 0;
-        for (int i = 0; i <= rxBitCountIndex; i++) {
-            int rxBitCount = rxBitCounts[i];
-            int rxBit = (rxBitCount < 8) ? (1 << (8 - rxBitCount)) : 0x01;
-
-            while (rxBitCount--) {
-                if (tdoBit == 0x1) {
-                    tdoBuf.buffer->at(tdoIndex) = 0;
-                }
-                if (ftdi->usb->check(rxIndex, rxBit)) {
-                    tdoBuf.buffer->at(tdoIndex) |= tdoBit;
-                }
-                if (rxBit == 0x80) {
-                    rxBit = (rxBitCount < 8) ? (1 << (8 - rxBitCount)) : 0x01;
-                    rxIndex++;
-                } else {
-                    rxBit <<= 1;
-                }
-
-                if (tdoBit == 0x80) {
-                    tdoBit = 0x01;
-                    tdoIndex++;
-                } else {
-                    tdoBit <<= 1;
-                }
-            }
-        }
-        if (rxIndex != rxBytesWanted) {
-            spdlog::warn("consumed {} but supplied {}", rxIndex, rxBytesWanted);
-        }
+int VncProtocol::shiftChunks(const uint32_t nBits, const bool fresh) {
+    if (scanCache) {
+        return scanCache->shift(*engine, nBits, tmsBuf.buffer->data(), tdiBuf.buffer->data(), tdoBuf.buffer->data(),
+                                fresh);
     }
-    return 1;
+    return engine->shift(nBits, tmsBuf.buffer->data(), tdiBuf.buffer->data(), tdoBuf.buffer->data());
 }
 
 int VncProtocol::fetch32(uint32_t *value) const {
@@ -203,7 +88,7 @@ uint32_t VncProtocol::shift() {
     bitCount += nBits;
     shiftCount++;
 
-    if (flags->showXVC) {
+    if (showXVC) {
         spdlog::info("shift: {}", nBits);
     }
 
@@ -216,17 +101,24 @@ uint32_t VncProtocol::shift() {
         fread(tdiBuf.buffer->data(), 1, nBytes, fp) != nBytes) {
         return 0;
     }
-    if (flags->showXVC) {
+    if (showXVC) {
         tmsBuf.showBuf(nBytes);
         tdiBuf.showBuf(nBytes);
     }
-    if (!shiftChunks(nBits)) {
-        return 0;
+    {
+        std::lock_guard adapterHeld(adapterLock);
+        if (!shiftChunks(nBits)) {
+            return 0;
+        }
+        // Back-to-back shifts never leave the sampler a quiet spell
+        if (pinSampler) {
+            pinSampler->offerTurn();
+        }
     }
-    if (flags->showXVC) {
+    if (showXVC) {
         tdoBuf.showBuf(nBytes);
     }
-    if (flags->loopback && std::memcmp(tdiBuf.buffer->data(), tdoBuf.buffer->data(), nBytes) != 0) {
+    if (loopback && std::memcmp(tdiBuf.buffer->data(), tdoBuf.buffer->data(), nBytes) != 0) {
         spdlog::error("Loopback failed.");
     }
     return nBytes;
@@ -249,7 +141,11 @@ int VncProtocol::matchInput(const char *str) const {
 }
 
 int VncProtocol::reply(const std::vector<unsigned char> &buf) const {
-    if (write(fd, buf.data(), buf.size()) != buf.size()) {
+    return reply(buf.data(), buf.size());
+}
+
+int VncProtocol::reply(const unsigned char *data, const size_t size) const {
+    if (write(fd, data, size) != static_cast<ssize_t>(size)) {
         spdlog::error("reply failed: {}", strerror(errno));
         return 0;
     }
@@ -266,22 +162,569 @@ bool VncProtocol::do_set_tck() const {
     uint32_t num;
     if (!fetch32(&num)) return true;
     uint32_t frequency = FREQUENCY / num;
-    if (flags->showXVC) {
+    if (showXVC) {
         spdlog::info("settck: {} ({} Hz)", num, frequency);
     }
-    if (!ftdi->set_clock_speed(frequency)) return true;
+    {
+        std::lock_guard adapterHeld(adapterLock);
+        if (!engine->setClock(frequency)) return true;
+    }
     if (!reply32(num)) return true;
     return false;
 }
 
+VncProtocol::SocketStream::SocketStream(FILE *fp, const int fd, unsigned char *tdi, const unsigned char *tdo):
+    fp(fp), fd(fd), tdi(tdi), tdo(tdo) {
+}
+
+int VncProtocol::SocketStream::fillTdi(const uint32_t bytes) {
+    if (bytes > tdiBytes) {
+        if (fread(tdi + tdiBytes, 1, bytes - tdiBytes, fp) != bytes - tdiBytes) {
+            Misc::badEOF();
+            return 0;
+        }
+        tdiBytes = bytes;
+    }
+    return 1;
+}
+
+int VncProtocol::SocketStream::drainTdo(const uint32_t bytes) {
+    while (tdoBytes < bytes) {
+        const ssize_t sent = write(fd, tdo + tdoBytes, bytes - tdoBytes);
+        if (sent <= 0) {
+            spdlog::error("reply failed: {}", strerror(errno));
+            return 0;
+        }
+        tdoBytes += sent;
+    }
+    return 1;
+}
+
+/*
+ * shift: with the TMS vector in hand, start shifting while TDI is still
+ * arriving and send TDO back as each packet completes.
+ */
+bool VncProtocol::do_shift_cut_through() {
+    uint32_t nBits;
+    if (!fetch32(&nBits)) {
+        return true;
+    }
+    if (nBits > largestShiftRequest) {
+        largestShiftRequest = nBits;
+    }
+    bitCount += nBits;
+    shiftCount++;
+
+    const uint32_t nBytes = (nBits + 7) / 8;
+    if (nBytes > MyBuffer::XVC_BUFFER_SIZE) {
+        spdlog::error("Client requested {}, max is {}", nBytes, MyBuffer::XVC_BUFFER_SIZE);
+        std::exit(EXIT_FAILURE);
+    }
+    if (fread(tmsBuf.buffer->data(), 1, nBytes, fp) != nBytes) {
+        return true;
+    }
+
+    // TDI streams in under the lock; only the TMS vector is in hand
+    SocketStream stream(fp, fd, tdiBuf.buffer->data(), tdoBuf.buffer->data());
+    std::lock_guard adapterHeld(adapterLock);
+    const int shifted = scanCache
+                            ? scanCache->shift(*engine, nBits, tmsBuf.buffer->data(), tdiBuf.buffer->data(),
+                                               tdoBuf.buffer->data(), stream)
+                            : engine->shift(nBits, tmsBuf.buffer->data(), tdiBuf.buffer->data(),
+                                            tdoBuf.buffer->data(), stream);
+    if (shifted && pinSampler) {
+        pinSampler->offerTurn();
+    }
+    return !shifted;
+}
+
 bool VncProtocol::do_shift() {
-    if (const uint32_t nBytes = shift(); nBytes <= 0) {
+    const auto start = std::chrono::steady_clock::now();
+    bool stop;
+    if (cutThrough) {
+        stop = do_shift_cut_through();
+    } else {
+        const uint32_t nBytes = shift();
+        stop = nBytes <= 0 || !reply(tdoBuf.buffer->data(), nBytes);
+    }
+
+    // Load and latency as advertised to a broker
+    servedShifts.fetch_add(1, std::memory_order_relaxed);
+    servedNanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                              std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+    return stop;
+}
+
+/*
+ * repeat: <nBits> <count> <intervalUs> <flags> <tms> <tdi> [<mask> <value>]
+ * Runs the same shift up to 'count' times (0 = until the stop condition),
+ * replying <iteration> <tdo> per reported result, then
+ * <REPEAT_END> <iterations> <reason>. With nothing to write back the
+ * socket is checked each time round, so a client that goes away can't
+ * leave it running.
+ */
+bool VncProtocol::do_repeat() {
+    uint32_t nBits, count, intervalUs, repeatFlags;
+    if (!fetch32(&nBits) || !fetch32(&count) || !fetch32(&intervalUs) || !fetch32(&repeatFlags)) {
+        return true;
+    }
+
+    const uint32_t nBytes = (nBits + 7) / 8;
+    const bool stopOnMatch = repeatFlags & REPEAT_STOP_ON_MATCH;
+    const bool changesOnly = repeatFlags & REPEAT_CHANGES_ONLY;
+    if (nBits == 0 || nBytes > MyBuffer::XVC_BUFFER_SIZE || (count == 0 && !stopOnMatch)) {
+        spdlog::error("Bad repeat: {} bits, count {}, flags {:x}", nBits, count, repeatFlags);
+        return true;
+    }
+
+    std::vector<unsigned char> mask(nBytes), value(nBytes);
+    if (fread(tmsBuf.buffer->data(), 1, nBytes, fp) != nBytes ||
+        fread(tdiBuf.buffer->data(), 1, nBytes, fp) != nBytes) {
+        return true;
+    }
+    if (stopOnMatch && (fread(mask.data(), 1, nBytes, fp) != nBytes ||
+                        fread(value.data(), 1, nBytes, fp) != nBytes)) {
+        return true;
+    }
+    if (showXVC) {
+        spdlog::info("repeat: {} x{} every {} us", nBits, count, intervalUs);
+        tmsBuf.showBuf(nBytes);
+        tdiBuf.showBuf(nBytes);
+    }
+
+    const auto interval = std::chrono::microseconds(intervalUs);
+    auto next = std::chrono::steady_clock::now();
+    std::vector<unsigned char> previous;
+    std::vector<unsigned char> record(4 + nBytes);
+    uint32_t iteration = 0;
+    uint32_t reason = REPEAT_COUNT_REACHED;
+
+    std::lock_guard adapterHeld(adapterLock);
+    while (count == 0 || iteration < count) {
+        if (clientGone()) {
+            spdlog::info("repeat: client went away after {} iterations", iteration);
+            return true;
+        }
+        if (!shiftChunks(nBits, true)) {
+            return true;
+        }
+        bitCount += nBits;
+        shiftCount++;
+
+        const unsigned char *tdo = tdoBuf.buffer->data();
+        if (!changesOnly || previous.empty() || std::memcmp(previous.data(), tdo, nBytes) != 0) {
+            std::memcpy(record.data(), &iteration, 4);
+            std::memcpy(record.data() + 4, tdo, nBytes);
+            if (!reply(record)) {
+                return true;
+            }
+            if (changesOnly) {
+                previous.assign(tdo, tdo + nBytes);
+            }
+        }
+        iteration++;
+
+        if (stopOnMatch) {
+            bool match = true;
+            for (uint32_t i = 0; i < nBytes && match; i++) {
+                match = (tdo[i] & mask[i]) == value[i];
+            }
+            if (match) {
+                reason = REPEAT_CONDITION_MET;
+                break;
+            }
+        }
+
+        if (pinSampler) {
+            pinSampler->offerTurn();
+        }
+        if (intervalUs) {
+            next += interval;
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    if (showXVC) {
+        spdlog::info("repeat: ran {}, reason {}", iteration, reason);
+    }
+    return !reply32(REPEAT_END) || !reply32(iteration) || !reply32(reason);
+}
+
+bool VncProtocol::clientGone() const {
+    pollfd entry{fd, POLLRDHUP, 0};
+    return poll(&entry, 1, 0) > 0 && entry.revents & (POLLRDHUP | POLLHUP | POLLERR);
+}
+
+// <length> <bytes>
+bool VncProtocol::fetchBlock(std::vector<unsigned char> &data) const {
+    uint32_t length;
+    if (!fetch32(&length)) {
+        return false;
+    }
+    if (length > MAX_UPLOAD_SIZE) {
+        spdlog::error("Upload of {} bytes exceeds {}", length, MAX_UPLOAD_SIZE);
+        return false;
+    }
+
+    data.resize(length);
+    if (fread(data.data(), 1, length, fp) != length) {
+        Misc::badEOF();
+        return false;
+    }
+    return true;
+}
+
+/*
+ * verify: <nBits> <flags> [<tms>] [<tdi>] <expected> [<mask>]
+ * Shifts like shift: but keeps TDO, comparing it with 'expected' wherever
+ * 'mask' is set; with VERIFY_NO_MASK no mask is sent and every bit counts.
+ * A readback needn't upload vectors it doesn't vary: with VERIFY_IN_SHIFT
+ * no TMS is sent, the TAP being in Shift-DR or Shift-IR already, and TMS
+ * stays low until the last bit exits; with VERIFY_TDI_FILL no TDI is sent
+ * and every bit is 0, or 1 with VERIFY_TDI_ONES.
+ * Replies <status> <first mismatching bit>, then with VERIFY_DIFF <count>
+ * and <byte offset> <TDO byte> for each of the first VERIFY_MAX_DIFF
+ * differing bytes. With VERIFY_STOP_ON_FAIL nothing is shifted once a
+ * verify: has failed since the last VERIFY_FIRST, so a pipelined pass
+ * stops at its first failure.
+ */
+bool VncProtocol::do_verify() {
+    uint32_t nBits, verifyFlags;
+    if (!fetch32(&nBits) || !fetch32(&verifyFlags)) {
+        return true;
+    }
+    const uint32_t nBytes = (nBits + 7) / 8;
+    if (nBits == 0 || nBytes > MyBuffer::XVC_BUFFER_SIZE) {
+        spdlog::error("Bad verify: {} bits", nBits);
         return true;
+    }
+
+    const bool masked = !(verifyFlags & VERIFY_NO_MASK);
+    const bool sendsTms = !(verifyFlags & VERIFY_IN_SHIFT);
+    const bool sendsTdi = !(verifyFlags & VERIFY_TDI_FILL);
+    std::vector<unsigned char> expected(nBytes), mask(nBytes, 0xFF);
+    if ((sendsTms && fread(tmsBuf.buffer->data(), 1, nBytes, fp) != nBytes) ||
+        (sendsTdi && fread(tdiBuf.buffer->data(), 1, nBytes, fp) != nBytes) ||
+        fread(expected.data(), 1, nBytes, fp) != nBytes ||
+        (masked && fread(mask.data(), 1, nBytes, fp) != nBytes)) {
+        Misc::badEOF();
+        return true;
+    }
+    if (!sendsTms) {
+        std::memset(tmsBuf.buffer->data(), 0, nBytes);
+        tmsBuf.buffer->data()[(nBits - 1) / 8] = 1 << (nBits - 1) % 8;
+    }
+    if (!sendsTdi) {
+        std::memset(tdiBuf.buffer->data(), verifyFlags & VERIFY_TDI_ONES ? 0xFF : 0, nBytes);
+    }
+    if (verifyFlags & VERIFY_FIRST) {
+        verifyFailed = false;
+    }
+    verifyCount++;
+
+    std::vector<unsigned char> result(8);
+    uint32_t status = VERIFY_SKIPPED;
+    uint32_t mismatch = VERIFY_NO_MISMATCH;
+    if (verifyFailed && verifyFlags & VERIFY_STOP_ON_FAIL) {
+        verifySkipped++;
     } else {
-        tdoBuf.buffer->resize(nBytes);
-        if (!reply(*tdoBuf.buffer)) {
+        std::lock_guard adapterHeld(adapterLock);
+        if (!shiftChunks(nBits)) {
             return true;
         }
+        bitCount += nBits;
+        shiftCount++;
+        mismatch = firstMismatch(nBits, tdoBuf.buffer->data(), expected.data(), mask.data());
+        status = mismatch == VERIFY_NO_MISMATCH ? VERIFY_PASS : VERIFY_FAIL;
+        verifyFailed = verifyFailed || status == VERIFY_FAIL;
+    }
+    if (showXVC) {
+        spdlog::info("verify: {} bits, flags {:x}, status {}, first mismatch {}", nBits, verifyFlags, status,
+                     static_cast<int32_t>(mismatch));
+    }
+    std::memcpy(result.data(), &status, 4);
+    std::memcpy(result.data() + 4, &mismatch, 4);
+
+    if (verifyFlags & VERIFY_DIFF) {
+        const size_t countAt = result.size();
+        result.resize(countAt + 4);
+        uint32_t count = 0;
+        const unsigned char *tdo = tdoBuf.buffer->data();
+        const uint32_t first = mismatch == VERIFY_NO_MISMATCH ? nBytes : mismatch / 8;
+        for (uint32_t i = first; i < nBytes && count < VERIFY_MAX_DIFF; i++) {
+            const unsigned int valid = i == nBytes - 1 && nBits % 8 ? (1u << nBits % 8) - 1 : 0xFF;
+            if ((tdo[i] ^ expected[i]) & mask[i] & valid) {
+                const size_t at = result.size();
+                result.resize(at + 5);
+                std::memcpy(result.data() + at, &i, 4);
+                result[at + 4] = tdo[i];
+                count++;
+            }
+        }
+        std::memcpy(result.data() + countAt, &count, 4);
+    }
+    return !reply(result);
+}
+
+/*
+ * Eight bytes at a time; bits past nBits in the last byte are ignored. The
+ * caller's vectors are byte arrays, so words are loaded with memcpy.
+ */
+uint32_t VncProtocol::firstMismatch(const uint32_t nBits, const unsigned char *tdo, const unsigned char *expected,
+                                    const unsigned char *mask) {
+    const uint32_t nBytes = (nBits + 7) / 8;
+    uint32_t i = 0;
+    for (; i + 8 <= nBytes; i += 8) {
+        uint64_t t, e, m;
+        std::memcpy(&t, tdo + i, 8);
+        std::memcpy(&e, expected + i, 8);
+        std::memcpy(&m, mask + i, 8);
+        if ((t ^ e) & m) {
+            break;
+        }
+    }
+    for (; i < nBytes; i++) {
+        unsigned int diff = (tdo[i] ^ expected[i]) & mask[i];
+        if (i == nBytes - 1 && nBits % 8) {
+            diff &= (1u << nBits % 8) - 1;
+        }
+        if (diff) {
+            return i * 8 + std::countr_zero(diff);
+        }
+    }
+    return VERIFY_NO_MISMATCH;
+}
+
+/*
+ * axi: <flags> <address> <count> [<count words>]
+ * Reads or, with AXI_WRITE, writes up to ScanBridge::MAX_WORDS 32-bit
+ * words from byte address 'address', replying <status> <words done>
+ * followed by the words read. Needs the matching ScanBridge core in the
+ * FPGA; see ScanBridge.h.
+ */
+bool VncProtocol::do_axi() {
+    uint32_t axiFlags, address, count;
+    if (!fetch32(&axiFlags) || !fetch32(&address) || !fetch32(&count)) {
+        return true;
+    }
+    if (count > ScanBridge::MAX_WORDS || address % 4) {
+        spdlog::error("Bad axi: {} words at 0x{:08x}", count, address);
+        return true;
+    }
+
+    const bool writing = axiFlags & AXI_WRITE;
+    std::vector<uint32_t> data(writing ? count : 0);
+    if (writing && fread(data.data(), 4, count, fp) != count) {
+        Misc::badEOF();
+        return true;
+    }
+    if (showXVC) {
+        spdlog::info("axi: {} {} words at 0x{:08x}", writing ? "write" : "read", count, address);
+    }
+
+    std::unique_lock adapterHeld(adapterLock);
+    if (scanCache && !scanCache->forget(*engine)) {
+        return true;
+    }
+    const auto config = Config::get();
+    ScanBridge bridge(*engine, config->bridgeInstruction, config->bridgeIrLength, bridgeIdleCycles);
+    const uint32_t status = writing ? bridge.write(address, data) : bridge.read(address, count, data);
+    adapterHeld.unlock();
+    if (status != ScanBridge::STATUS_OK) {
+        spdlog::warn("axi: stopped after {} words at 0x{:08x}, status {}", bridge.completed, address, status);
+    }
+
+    std::vector<unsigned char> result(8 + data.size() * 4 * !writing);
+    std::memcpy(result.data(), &status, 4);
+    std::memcpy(result.data() + 4, &bridge.completed, 4);
+    if (!writing) {
+        std::memcpy(result.data() + 8, data.data(), data.size() * 4);
+    }
+    return !reply(result);
+}
+
+/*
+ * svf: <length> <text> or xsvf: <length> <data>
+ * Plays the upload locally and replies <status> <location>, where status is
+ * 0 on success and location is the failing SVF line or XSVF offset.
+ */
+bool VncProtocol::do_play(const bool xsvf) {
+    std::vector<unsigned char> data;
+    if (!fetchBlock(data)) {
+        return true;
+    }
+    if (showXVC) {
+        spdlog::info("{}: {} bytes", xsvf ? "xsvf" : "svf", data.size());
+    }
+
+    std::unique_lock adapterHeld(adapterLock);
+    if (scanCache && !scanCache->forget(*engine)) {
+        return true;
+    }
+    const int result = xsvf
+                           ? player->playXsvf(data)
+                           : player->playSvf(std::string_view(reinterpret_cast<const char *>(data.data()), data.size()));
+    adapterHeld.unlock();
+    if (!result) {
+        spdlog::error("{} upload failed at {} {}", xsvf ? "XSVF" : "SVF", xsvf ? "offset" : "line", player->failedAt);
+    }
+    return !reply32(result ? 0 : 1) || !reply32(result ? 0 : player->failedAt);
+}
+
+/*
+ * auth: <length> <token>
+ * Replies 1 and unlocks mpsse: for this connection, or replies 0 and drops it.
+ */
+bool VncProtocol::do_auth() {
+    const std::string &token = Config::get()->mpsseToken;
+    uint32_t length;
+    if (!fetch32(&length)) {
+        return true;
+    }
+    if (length > MAX_TOKEN_SIZE) {
+        spdlog::error("auth: token of {} bytes exceeds {}", length, MAX_TOKEN_SIZE);
+        return true;
+    }
+    std::vector<unsigned char> offered(length);
+    if (fread(offered.data(), 1, length, fp) != length) {
+        Misc::badEOF();
+        return true;
+    }
+
+    // Compare every byte so the reply time does not depend on the matching prefix
+    unsigned char difference = length != token.size();
+    for (uint32_t i = 0; i < length; i++) {
+        difference |= offered[i] ^ static_cast<unsigned char>(token[i % token.size()]);
+    }
+    authenticated = difference == 0;
+    if (!authenticated) {
+        spdlog::warn("auth: rejected");
+        (void) reply32(0);
+        return true;
+    }
+    return !reply32(1);
+}
+
+/*
+ * mpsse: <length> <commands>
+ * Replies <length> <response bytes>, or <MPSSE_REJECTED> <offset> when the
+ * stream holds an opcode outside the whitelist. Nothing is sent to the
+ * adapter for a rejected stream. If USB fails partway it replies
+ * <MPSSE_TRANSPORT_ERROR> <bytes executed> and drops the connection.
+ */
+bool VncProtocol::do_mpsse() {
+    if (!authenticated) {
+        spdlog::error("mpsse: without auth:");
+        return true;
+    }
+    std::vector<unsigned char> stream;
+    if (!fetchBlock(stream)) {
+        return true;
+    }
+    if (showXVC) {
+        spdlog::info("mpsse: {} bytes", stream.size());
+    }
+
+    std::unique_lock adapterHeld(adapterLock);
+    if (scanCache && !scanCache->forget(*engine)) {
+        return true;
+    }
+    std::vector<unsigned char> response;
+    const int ran = passthrough->run(stream, response);
+    adapterHeld.unlock();
+    if (!ran) {
+        if (passthrough->transportFailed) {
+            spdlog::error("mpsse: USB failed after {} of {} bytes", passthrough->executed, stream.size());
+            (void) (reply32(MPSSE_TRANSPORT_ERROR) && reply32(passthrough->executed));
+            return true;
+        }
+        return !reply32(MPSSE_REJECTED) || !reply32(passthrough->badOffset);
+    }
+    return !reply32(static_cast<uint32_t>(response.size())) || !reply(response);
+}
+
+/*
+ * gpio: <length> <sequence>
+ * Runs a GpioSequencer sequence and replies <status> <pins>, status 0 on
+ * success and pins the low byte read back at the end. Its clocks may move
+ * the TAP out of Test-Logic-Reset, so the scan cache starts over.
+ */
+bool VncProtocol::do_gpio() const {
+    std::vector<unsigned char> data;
+    if (!fetchBlock(data)) {
+        return true;
+    }
+    const std::string_view sequence(reinterpret_cast<const char *>(data.data()), data.size());
+    if (showXVC) {
+        spdlog::info("gpio: {}", sequence);
+    }
+
+    std::unique_lock adapterHeld(adapterLock);
+    if (scanCache && !scanCache->forget(*engine)) {
+        return true;
+    }
+    GpioSequencer sequencer(*ftdi);
+    const int result = sequencer.run(sequence);
+    adapterHeld.unlock();
+    return !reply32(result ? 0 : 1) || !reply32(sequencer.pins);
+}
+
+bool VncProtocol::do_process_a(int &c) {
+    switch (c = std::fgetc(fp)) {
+        case 'u': {
+            if (!passthroughEnabled) {
+                Misc::badChar(c);
+                return true;
+            }
+            if (!matchInput("th:")) return true;
+            if (do_auth()) return true;
+        }
+        break;
+
+        case 'x': {
+            if (!extensions) {
+                Misc::badChar(c);
+                return true;
+            }
+            if (!matchInput("i:")) return true;
+            if (do_axi()) return true;
+        }
+        break;
+
+        default:
+            if (showXVC) {
+                spdlog::error("Bad second char 0x{:02x}", c);
+            }
+            Misc::badChar(c);
+            return true;
+    }
+    return false;
+}
+
+bool VncProtocol::do_process_g(int &c) const {
+    switch (c = std::fgetc(fp)) {
+        case 'e': {
+            if (!matchInput("tinfo:")) return true;
+            if (!do_get_info()) return true;
+        }
+        break;
+
+        case 'p': {
+            if (!extensions || !singleAdapter) {
+                Misc::badChar(c);
+                return true;
+            }
+            if (!matchInput("io:")) return true;
+            if (do_gpio()) return true;
+        }
+        break;
+
+        default:
+            if (showXVC) {
+                spdlog::error("Bad second char 0x{:02x}", c);
+            }
+            Misc::badChar(c);
+            return true;
     }
     return false;
 }
@@ -300,8 +743,18 @@ bool VncProtocol::do_process_s(int &c) {
         }
         break;
 
+        case 'v': {
+            if (!extensions) {
+                Misc::badChar(c);
+                return true;
+            }
+            if (!matchInput("f:")) return true;
+            if (do_play(false)) return true;
+        }
+        break;
+
         default:
-            if (flags->showXVC) {
+            if (showXVC) {
                 spdlog::error("Bad second char 0x{:02x}", c);
             }
             Misc::badChar(c);
@@ -313,59 +766,232 @@ bool VncProtocol::do_process_s(int &c) {
 void VncProtocol::processCommands() {
     int c;
     while (true) {
-        switch (c = std::fgetc(fp)) {
+        c = std::fgetc(fp);
+        switch (c) {
             case 's':
                 if (do_process_s(c)) return;
                 break;
 
             case 'g':
-                if (!matchInput("etinfo:")) return;
-                if (do_get_info()) break;
-                return;
+                if (do_process_g(c)) return;
+                break;
+
+            case 'r':
+                if (!extensions) {
+                    Misc::badChar(c);
+                    return;
+                }
+                if (!matchInput("epeat:")) return;
+                if (do_repeat()) return;
+                break;
+
+            case 'a':
+                if (do_process_a(c)) return;
+                break;
+
+            case 'm':
+                if (!passthroughEnabled) {
+                    Misc::badChar(c);
+                    return;
+                }
+                if (!matchInput("psse:")) return;
+                if (do_mpsse()) return;
+                break;
+
+            case 'v':
+                if (!extensions) {
+                    Misc::badChar(c);
+                    return;
+                }
+                if (!matchInput("erify:")) return;
+                if (do_verify()) return;
+                break;
+
+            case 'x':
+                if (!extensions) {
+                    Misc::badChar(c);
+                    return;
+                }
+                if (!matchInput("svf:")) return;
+                if (do_play(true)) return;
+                break;
 
             case EOF:
                 return;
 
             default:
-                if (flags->showXVC) {
+                if (showXVC) {
                     spdlog::error("Bad initial char 0x{:02x}", c);
                 }
                 Misc::badChar(c);
                 return;
         }
+        if (pinSampler) {
+            pinSampler->released();
+        }
     }
 }
 
 void VncProtocol::set_zero() {
     shiftCount = 0;
-    chunkCount = 0;
+    engine->chunkCount = 0;
+    engine->wireBytes = 0;
+    engine->wireBits = 0;
     bitCount = 0;
 }
 
 void VncProtocol::close() const {
+    if (pinSampler) {
+        pinSampler->stop();
+    }
     printStatistic();
     ftdi->close();
 }
 
+void VncProtocol::startDiscovery() {
+    if (adapterless) {
+        return;
+    }
+    discovery = std::thread([this] {
+        (void) ftdi->usb->discover();
+    });
+}
+
+bool VncProtocol::bringUp() {
+    if (discovery.joinable()) {
+        discovery.join();
+    }
+    return ftdi->init();
+}
+
+void VncProtocol::prewarm() {
+    if (warm || adapterless) {
+        return;
+    }
+    warm = bringUp();
+    if (warm) {
+        spdlog::info("Adapter ready");
+    } else {
+        ftdi->close();
+    }
+}
+
+/*
+ * Reset puts every TAP in IDCODE or BYPASS. Read the DR chain with TDI
+ * held high: a 1 starts a 32-bit IDCODE, a 0 is a bypassed device, and
+ * all ones means the fill has come round.
+ */
+std::vector<uint32_t> VncProtocol::identify() {
+    std::vector<uint32_t> idcodes;
+    if (!adapterless) {
+        prewarm();
+        if (!warm) {
+            return idcodes;
+        }
+    }
+    if (!engine || !engine->persistent()) {
+        engine = ShiftEngine::create(*ftdi);
+        if (!engine) {
+            return idcodes;
+        }
+    }
+
+    // Test-Logic-Reset, Run-Test/Idle, Select-DR, Capture-DR, Shift-DR
+    static constexpr uint32_t PREFIX = 9;
+    const uint32_t last = PREFIX + 32 * MAX_CHAIN_DEVICES - 1;
+    const uint32_t bits = last + 3;
+    std::vector<unsigned char> tms((bits + 7) / 8), tdi(tms.size(), 0xFF), tdo(tms.size());
+    for (const uint32_t i: {0u, 1u, 2u, 3u, 4u, 6u, last, last + 1}) {
+        tms[i / 8] |= 1 << (i % 8);
+    }
+    const int shifted = engine->shift(bits, tms.data(), tdi.data(), tdo.data());
+    // Broadcast replicas stay claimed for the first session; anything else is let go
+    if (!engine->persistent()) {
+        engine.reset();
+    }
+    if (!shifted) {
+        return idcodes;
+    }
+
+    const auto bit = [&tdo](const uint32_t i) { return static_cast<uint32_t>(tdo[i / 8] >> (i % 8) & 1); };
+    for (uint32_t at = PREFIX; at + 32 <= last + 1;) {
+        if (!bit(at)) {
+            at++;
+            continue;
+        }
+        uint32_t idcode = 0;
+        for (uint32_t i = 0; i < 32; i++) {
+            idcode |= bit(at + i) << i;
+        }
+        if (idcode == 0xFFFFFFFF) {
+            break;
+        }
+        idcodes.push_back(idcode);
+        at += 32;
+    }
+    return idcodes;
+}
+
+std::string VncProtocol::adapterSerial() const {
+    return adapterless ? std::string() : ftdi->serial();
+}
+
 bool VncProtocol::connect(FILE *_fp, const int _fd) {
     fp = _fp;
     fd = _fd;
-    if (!ftdi->init()) {
+    authenticated = false;
+    verifyFailed = false;
+    const bool ready = warm || adapterless || bringUp();
+    warm = false;
+    if (!ready) {
         return false;
     }
+    /*
+     * Broadcast replicas are claimed once and reused. Anything else starts
+     * fresh, dropping the last session's engine first since a simulator
+     * may only serve one connection at a time.
+     */
+    player.reset();
+    if (!engine || !engine->persistent()) {
+        engine.reset();
+        engine = ShiftEngine::create(*ftdi);
+        if (!engine) {
+            return false;
+        }
+    }
+    player = std::make_unique<SvfPlayer>(*engine);
+    if (pinSampler) {
+        player->onFlush = [this] { pinSampler->offerTurn(); };
+    }
     set_zero();
+    if (pinSampler) {
+        pinSampler->start();
+    }
     return true;
 }
 
 void VncProtocol::printStatistic() const {
-    if (flags->statisticsFlag) {
+    if (flags->statisticsFlag && engine) {
         spdlog::info("   Shifts: {}", shiftCount);
-        spdlog::info("   Chunks: {}", chunkCount);
+        spdlog::info("   Chunks: {}", engine->chunkCount);
         spdlog::info("     Bits: {}", bitCount);
+        if (engine->wireBits) {
+            spdlog::info(" Bytes/bit: {:.3f}", static_cast<double>(engine->wireBytes) / engine->wireBits);
+        }
         spdlog::info(" Largest shift request: {}", largestShiftRequest);
         spdlog::info(" Largest write request: {}", ftdi->usb->largestWriteRequest);
         spdlog::info("Largest write transfer: {}", ftdi->usb->largestWriteSent);
         spdlog::info("  Largest read request: {}", ftdi->usb->largestReadRequest);
+        engine->printStatistic();
+        if (verifyCount) {
+            spdlog::info("  Verifies: {} ({} skipped after a failure)", verifyCount, verifySkipped);
+        }
+        if (scanCache) {
+            scanCache->printStatistic();
+        }
+        if (pinSampler) {
+            pinSampler->printStatistic();
+        }
     }
 }
 
@@ -1,7 +1,15 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include "usb.h"
 #include "FTDI.h"
+#include "ShiftEngine.h"
+#include "SvfPlayer.h"
+#include "MpssePassthrough.h"
+#include "ScanCache.h"
+#include "PinSampler.h"
 
 
 class VncProtocol {
@@ -12,13 +20,6 @@ public:
 
     void processCommands();
 
-    /*
-     * The FTDI/JTAG chip can't shift data to TMS and TDI simultaneously,
-     * so switch between TMS and TDI shifts commands as necessary.
-     * Break into chunks small enough to fit in a single packet.
-     */
-    [[nodiscard]] int shiftChunks(uint32_t shiftBits);
-
     uint32_t shift();
 
     [[nodiscard]] bool isQuietMode() const;
@@ -27,52 +28,202 @@ public:
 
     bool connect(FILE *_fp, int _fd);
 
+    // Enumerate USB in the background while the server starts listening
+    void startDiscovery();
+
+    // Bring the adapter up before the first client arrives
+    void prewarm();
+
     void printStatistic() const;
 
+    // IDCODEs on the chain, TDO end first; brings the adapter up if needed
+    [[nodiscard]] std::vector<uint32_t> identify();
+
+    // Serial number of the adapter in use, empty before it is up or without one
+    [[nodiscard]] std::string adapterSerial() const;
+
+    // Read by the broker registration thread
+    std::atomic<bool> busy{};
+    std::atomic<uint64_t> servedShifts{};
+    std::atomic<uint64_t> servedNanos{};
+
 private:
+    // Reads TDI from the client and sends TDO back while a shift runs
+    class SocketStream final : public ShiftStream {
+    public:
+        SocketStream(FILE *fp, int fd, unsigned char *tdi, const unsigned char *tdo);
+
+        [[nodiscard]] int fillTdi(uint32_t bytes) override;
+
+        [[nodiscard]] int drainTdo(uint32_t bytes) override;
+
+    private:
+        FILE *fp;
+        int fd;
+        unsigned char *tdi;
+        const unsigned char *tdo;
+        uint32_t tdiBytes = 0;
+        uint32_t tdoBytes = 0;
+    };
+
     DiagnosticFlags *flags;
+
+    // Hot-path diagnostics, copied from flags at construction
+    bool showXVC{};
+    bool loopback{};
+
+    // Overlap socket and USB I/O in shift:, off when vectors are dumped or checked
+    bool cutThrough{};
+
+    // Non-standard commands, only parsed with --extensions
+    bool extensions{};
+
+    // Shifting into a simulator (--bitbang) or a debug bridge (--mmio); the adapter is never opened
+    bool adapterless{};
     std::unique_ptr<FTDI> ftdi;
+    std::unique_ptr<ShiftEngine> engine;
+    std::unique_ptr<SvfPlayer> player;
+    std::unique_ptr<MpssePassthrough> passthrough;
+
+    // Kept across clients, set with --scan-cache
+    std::unique_ptr<ScanCache> scanCache;
+
+    // Held while a command drives the adapter, not while its payload arrives
+    mutable std::mutex adapterLock;
+
+    // Set with --pin-sampler, sampling while a client is connected
+    std::unique_ptr<PinSampler> pinSampler;
+
+    // mpsse: and gpio: drive the primary adapter alone, so --broadcast replicas would drift from it
+    bool singleAdapter{};
+
+    // auth:/mpsse: need --mpsse-token as well as --extensions
+    bool passthroughEnabled{};
+    bool authenticated{};
 
     MyBuffer tmsBuf{"TMS"};
     MyBuffer tdiBuf{"TDI"};
     MyBuffer tdoBuf{"TDO"};
-    MyBuffer cmdBuf{"CMD"};
 
     const int BIT_1 = 0x01;
     const int BIT_80 = 0x80;
 
     uint64_t shiftCount = 0;
-    uint64_t chunkCount = 0;
     uint64_t bitCount = 0;
 
     uint32_t largestShiftRequest = 0;
 
+    // A verify: failed since the last one flagged VERIFY_FIRST
+    bool verifyFailed = false;
+    uint64_t verifyCount = 0;
+    uint64_t verifySkipped = 0;
+
+    // Run-Test/Idle cycles the bridge's AXI side needed last time
+    uint32_t bridgeIdleCycles = 0;
+
+    // 'fresh' bypasses the scan cache for shifts that poll
+    [[nodiscard]] int shiftChunks(uint32_t nBits, bool fresh = false);
+
     int fetch32(uint32_t *value) const;
 
     int matchInput(const char *str) const;
 
     [[nodiscard]] int reply(const std::vector<unsigned char> &buf) const;
 
+    [[nodiscard]] int reply(const unsigned char *data, size_t size) const;
+
     [[nodiscard]] int reply32(uint32_t value) const;
 
+    // The peer closed or reset the connection; doesn't consume anything
+    [[nodiscard]] bool clientGone() const;
+
     [[nodiscard]] int do_get_info() const;
 
     [[nodiscard]] bool do_set_tck() const;
 
     [[nodiscard]] bool do_shift();
 
+    [[nodiscard]] bool do_shift_cut_through();
+
+    [[nodiscard]] bool do_repeat();
+
+    [[nodiscard]] bool do_verify();
+
+    [[nodiscard]] bool do_axi();
+
+    // First bit where TDO differs from 'expected' under 'mask', or VERIFY_NO_MISMATCH
+    [[nodiscard]] static uint32_t firstMismatch(uint32_t nBits, const unsigned char *tdo,
+                                                const unsigned char *expected, const unsigned char *mask);
+
+    [[nodiscard]] bool do_play(bool xsvf);
+
+    [[nodiscard]] bool do_auth();
+
+    [[nodiscard]] bool do_mpsse();
+
+    [[nodiscard]] bool fetchBlock(std::vector<unsigned char> &data) const;
+
     [[nodiscard]] bool do_process_s(int &c);
 
+    [[nodiscard]] bool do_process_a(int &c);
+
+    [[nodiscard]] bool do_process_g(int &c) const;
+
+    [[nodiscard]] bool do_gpio() const;
+
+    [[nodiscard]] bool bringUp();
+
     void set_zero();
 
     static constexpr uint32_t FREQUENCY = 1000000000;
 
+    // repeat: flags and completion record
+    static constexpr uint32_t REPEAT_CHANGES_ONLY = 0x1;
+    static constexpr uint32_t REPEAT_STOP_ON_MATCH = 0x2;
+    static constexpr uint32_t REPEAT_END = 0xFFFFFFFF;
+    static constexpr uint32_t REPEAT_COUNT_REACHED = 0;
+    static constexpr uint32_t REPEAT_CONDITION_MET = 1;
+
+    // verify: flags and status
+    static constexpr uint32_t VERIFY_STOP_ON_FAIL = 0x1;
+    static constexpr uint32_t VERIFY_DIFF = 0x2;
+    static constexpr uint32_t VERIFY_FIRST = 0x4;
+    static constexpr uint32_t VERIFY_NO_MASK = 0x8;
+    static constexpr uint32_t VERIFY_TDI_FILL = 0x10;
+    static constexpr uint32_t VERIFY_TDI_ONES = 0x20;
+    static constexpr uint32_t VERIFY_IN_SHIFT = 0x40;
+    static constexpr uint32_t VERIFY_PASS = 0;
+    static constexpr uint32_t VERIFY_FAIL = 1;
+    static constexpr uint32_t VERIFY_SKIPPED = 2;
+    static constexpr uint32_t VERIFY_NO_MISMATCH = 0xFFFFFFFF;
+    static constexpr uint32_t VERIFY_MAX_DIFF = 256;
+
+    // axi: flags
+    static constexpr uint32_t AXI_WRITE = 0x1;
+
+    static constexpr uint32_t MAX_UPLOAD_SIZE = 256 * 1024 * 1024;
+
+    // identify() gives up on chains longer than this
+    static constexpr uint32_t MAX_CHAIN_DEVICES = 16;
+
+    // mpsse: rejection marker, followed by the offending stream offset
+    static constexpr uint32_t MPSSE_REJECTED = 0xFFFFFFFF;
+
+    // mpsse: USB failure marker, followed by the stream bytes known to have run
+    static constexpr uint32_t MPSSE_TRANSPORT_ERROR = 0xFFFFFFFE;
+    static constexpr uint32_t MAX_TOKEN_SIZE = 1024;
+
     static constexpr std::string concat_version() {
-        return std::format("xvcServer_v1.0:{}", 2048);
+        return std::format("xvcServer_v1.0:{}", MyBuffer::XVC_BUFFER_SIZE);
     }
 
     static const std::string VERSION;
 
     FILE *fp{};
     int fd;
+
+    std::thread discovery;
+
+    // Adapter already initialized by prewarm()
+    bool warm{};
 };
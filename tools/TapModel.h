@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+/*
+ * IEEE 1149.1 TAP with a 6-bit IR and Xilinx-style IDCODE, BYPASS and
+ * a 32-bit USER1 register that keeps what was shifted into it. USER4
+ * fronts the custom bridge of src/ScanBridge.h onto 256 KiB of memory; each transaction takes 'axiLatency' TCKs.
+ */
+class Tap {
+public:
+    explicit Tap(const uint32_t idcode, const uint32_t axiLatency = 0): idcode(idcode), axiLatency(axiLatency),
+                                                                        memory(MEMORY_WORDS) {
+    }
+
+    // TDO as driven since the last falling edge
+    [[nodiscard]] bool tdo() const {
+        if (state == SHIFT_DR) return shiftRegister & 1;
+        if (state == SHIFT_IR) return irShift & 1;
+        return false;
+    }
+
+    void rise(const bool tms, const bool tdi) {
+        if (axiBusy) {
+            axiBusy--;
+        }
+        switch (state) {
+            case RESET: ir = IDCODE;
+                break;
+            case CAPTURE_DR: shiftRegister = ir == IDCODE ? idcode : ir == USER1 ? user : ir == USER4 ? axiStatus() : 0;
+                break;
+            case SHIFT_DR: {
+                const int length = ir == IDCODE || ir == USER1 ? 32 : ir == USER4 ? 64 : 1;
+                shiftRegister = shiftRegister >> 1 | static_cast<uint64_t>(tdi) << (length - 1);
+            }
+            break;
+            case UPDATE_DR: if (ir == USER1) user = static_cast<uint32_t>(shiftRegister);
+                if (ir == USER4) axiCommand(shiftRegister);
+                break;
+            case CAPTURE_IR: irShift = 0x01;
+                break;
+            case SHIFT_IR: irShift = irShift >> 1 | tdi << (IR_LENGTH - 1);
+                break;
+            case UPDATE_IR: ir = irShift;
+                break;
+            default:
+                break;
+        }
+        state = NEXT_STATE[state][tms];
+    }
+
+private:
+    enum State {
+        RESET, IDLE, SELECT_DR, CAPTURE_DR, SHIFT_DR, EXIT1_DR, PAUSE_DR, EXIT2_DR, UPDATE_DR,
+        SELECT_IR, CAPTURE_IR, SHIFT_IR, EXIT1_IR, PAUSE_IR, EXIT2_IR, UPDATE_IR
+    };
+
+    static constexpr State NEXT_STATE[16][2] = {
+        {IDLE, RESET}, {IDLE, SELECT_DR}, {CAPTURE_DR, SELECT_IR}, {SHIFT_DR, EXIT1_DR},
+        {SHIFT_DR, EXIT1_DR}, {PAUSE_DR, UPDATE_DR}, {PAUSE_DR, EXIT2_DR}, {SHIFT_DR, UPDATE_DR},
+        {IDLE, SELECT_DR}, {CAPTURE_IR, RESET}, {SHIFT_IR, EXIT1_IR}, {SHIFT_IR, EXIT1_IR},
+        {PAUSE_IR, UPDATE_IR}, {PAUSE_IR, EXIT2_IR}, {SHIFT_IR, UPDATE_IR}, {IDLE, SELECT_DR}
+    };
+
+    static constexpr int IR_LENGTH = 6;
+    static constexpr uint32_t IDCODE = 0x09;
+    static constexpr uint32_t USER1 = 0x02;
+    static constexpr uint32_t USER4 = 0x23;
+    static constexpr uint32_t MEMORY_WORDS = 64 * 1024;
+
+    // A command arriving while the last one is still running is dropped
+    void axiCommand(const uint64_t command) {
+        if (!(command & 1)) {
+            return;
+        }
+        axiAccepted = axiBusy == 0;
+        if (!axiAccepted) {
+            return;
+        }
+        const auto address = static_cast<uint32_t>(command >> 2 & 0x3FFFFFFF);
+        axiError = address >= MEMORY_WORDS;
+        if (!axiError && command & 2) {
+            memory[address] = static_cast<uint32_t>(command >> 32);
+        }
+        axiData = axiError || command & 2 ? 0 : memory[address];
+        axiBusy = axiLatency;
+    }
+
+    [[nodiscard]] uint64_t axiStatus() const {
+        const bool done = axiAccepted && axiBusy == 0;
+        return done | static_cast<uint64_t>(done && axiError) << 1 | static_cast<uint64_t>(done ? axiData : 0) << 32;
+    }
+
+    uint32_t idcode;
+    uint32_t axiLatency;
+    std::vector<uint32_t> memory;
+    uint32_t axiBusy = 0;
+    bool axiAccepted = false;
+    bool axiError = false;
+    uint32_t axiData = 0;
+
+    State state = RESET;
+    uint32_t ir = IDCODE;
+    uint32_t irShift = 0;
+    uint64_t shiftRegister = 0;
+    uint32_t user = 0;
+};
@@ -0,0 +1,151 @@
+/*
+ * Stand-in for an RTL simulation's JTAG bridge: serves OpenOCD's
+ * remote_bitbang protocol over TCP with one modelled TAP behind it, so
+ * xvcnd --bitbang can be exercised without a simulator. Reports simulated
+ * TCK per second and how many socket reads it took per client.
+ */
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <vector>
+#include "TapModel.h"
+
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        int port = 44853;
+        uint32_t idcode = 0x13631093;
+        uint32_t tckCostNs = 0;
+        uint32_t axiLatency = 8;
+    };
+
+    struct Stats {
+        uint64_t tcks = 0;
+        uint64_t reads = 0;
+        uint64_t bytes = 0;
+    };
+
+    void spin(const uint32_t ns) {
+        const auto until = Clock::now() + std::chrono::nanoseconds(ns);
+        while (Clock::now() < until) {
+        }
+    }
+
+    // Everything received in one read is processed before its replies go out, like a simulator
+    // that services the socket once per time step. Returns on 'Q' or EOF.
+    void serveClient(const int fd, Tap &tap, const Options &options, Stats &stats) {
+        std::vector<char> in(64 * 1024);
+        std::vector<char> out;
+        bool tck = false;
+
+        while (true) {
+            const ssize_t n = recv(fd, in.data(), in.size(), 0);
+            if (n <= 0) {
+                return;
+            }
+            stats.reads++;
+            stats.bytes += n;
+
+            out.clear();
+            for (ssize_t i = 0; i < n; i++) {
+                const char c = in[i];
+                if (c >= '0' && c <= '7') {
+                    const int pins = c - '0';
+                    const bool rising = pins & 4;
+                    if (rising && !tck) {
+                        tap.rise(pins & 2, pins & 1);
+                        stats.tcks++;
+                        if (options.tckCostNs) spin(options.tckCostNs);
+                    }
+                    tck = rising;
+                } else if (c == 'R') {
+                    out.push_back(tap.tdo() ? '1' : '0');
+                } else if (c == 'Q') {
+                    (void) send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+                    return;
+                }
+                // 'B'/'b' blink and 'r'-'u' resets have nothing to model
+            }
+
+            size_t sent = 0;
+            while (sent < out.size()) {
+                const ssize_t m = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+                if (m <= 0) {
+                    return;
+                }
+                sent += m;
+            }
+        }
+    }
+
+    [[noreturn]] void usage(const char *name) {
+        std::println(stderr, "Usage: {} [-p port] [-i idcode] [-t tck_cost_ns] [-l axi_latency_tcks]", name);
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+int main(const int argc, char **argv) {
+    Options options;
+    int option;
+    while ((option = getopt(argc, argv, "p:i:t:l:h")) != -1) {
+        switch (option) {
+            case 'p': options.port = std::atoi(optarg);
+                break;
+            case 'i': options.idcode = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+                break;
+            case 't': options.tckCostNs = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+                break;
+            case 'l': options.axiLatency = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        std::println(stderr, "Can't listen on port {}: {}", options.port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    std::println("remote_bitbang on 127.0.0.1:{}, IDCODE {:08x}", options.port, options.idcode);
+    std::fflush(stdout);
+
+    // The TAP keeps its state across connections, as a running simulation would
+    Tap tap(options.idcode, options.axiLatency);
+    while (true) {
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        Stats stats;
+        const auto start = Clock::now();
+        serveClient(fd, tap, options, stats);
+        close(fd);
+
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        std::println("{} TCKs in {:.3f} s ({:.0f} TCK/s), {} reads of {:.0f} bytes", stats.tcks, seconds,
+                     stats.tcks / seconds, stats.reads, stats.reads ? static_cast<double>(stats.bytes) / stats.reads : 0);
+        std::fflush(stdout);
+    }
+}
@@ -0,0 +1,479 @@
+/*
+ * XVC load generator: replays JTAG workload profiles against a running xvcnd
+ * and reports TCK throughput and per-shift latency percentiles.
+ */
+#include <getopt.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 2542;
+        std::string profile = "mixed";
+        int concurrency = 1;
+        double seconds = 10.0;
+        uint64_t iterations = 0;
+        uint32_t tckPeriodNs = 100;
+        bool simulate = false;
+    };
+
+    /*
+     * TMS/TDI vector under construction, LSB first as on the wire.
+     */
+    class Vector {
+    public:
+        void add(const bool tms, const bool tdi) {
+            if ((bits & 7) == 0) {
+                tmsBytes.push_back(0);
+                tdiBytes.push_back(0);
+            }
+            if (tms) tmsBytes.back() |= 1 << (bits & 7);
+            if (tdi) tdiBytes.back() |= 1 << (bits & 7);
+            bits++;
+        }
+
+        void tms(const std::initializer_list<int> path) {
+            for (const int t: path) add(t, false);
+        }
+
+        // Shift 'count' bits of data, raising TMS on the last one (exit to Exit1)
+        void shift(std::mt19937_64 &rng, const uint32_t count, const bool exit) {
+            for (uint32_t i = 0; i < count; ++i) {
+                add(exit && i + 1 == count, rng() & 1);
+            }
+        }
+
+        void clear() {
+            tmsBytes.clear();
+            tdiBytes.clear();
+            bits = 0;
+        }
+
+        std::vector<unsigned char> tmsBytes;
+        std::vector<unsigned char> tdiBytes;
+        uint32_t bits = 0;
+    };
+
+    class Connection {
+    public:
+        explicit Connection(const Options &options) {
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo *result = nullptr;
+            if (const int rc = getaddrinfo(options.host.c_str(), std::to_string(options.port).c_str(), &hints, &result);
+                rc != 0) {
+                std::println(stderr, "Bad address \"{}\": {}", options.host, gai_strerror(rc));
+                std::exit(EXIT_FAILURE);
+            }
+            fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+            if (fd < 0 || ::connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+                std::println(stderr, "Can't connect to {}:{}: {}", options.host, options.port, strerror(errno));
+                std::exit(EXIT_FAILURE);
+            }
+            freeaddrinfo(result);
+
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        ~Connection() {
+            close(fd);
+        }
+
+        uint32_t getInfo() {
+            send("getinfo:", 8);
+            std::string info;
+            char c;
+            while (receive(&c, 1) && c != '\n') {
+                info += c;
+            }
+            const auto colon = info.rfind(':');
+            return colon == std::string::npos ? 0 : static_cast<uint32_t>(std::strtoul(info.c_str() + colon + 1, nullptr, 10));
+        }
+
+        uint32_t setTck(const uint32_t periodNs) {
+            send("settck:", 7);
+            send32(periodNs);
+            uint32_t actual = 0;
+            receive(&actual, sizeof(actual));
+            return actual;
+        }
+
+        bool shift(const Vector &vector, std::vector<unsigned char> &tdo) {
+            const uint32_t nBytes = (vector.bits + 7) / 8;
+            request.clear();
+            request.insert(request.end(), {'s', 'h', 'i', 'f', 't', ':'});
+            for (int i = 0; i < 32; i += 8) {
+                request.push_back(static_cast<unsigned char>(vector.bits >> i));
+            }
+            request.insert(request.end(), vector.tmsBytes.begin(), vector.tmsBytes.end());
+            request.insert(request.end(), vector.tdiBytes.begin(), vector.tdiBytes.end());
+            tdo.resize(nBytes);
+            return send(request.data(), request.size()) && receive(tdo.data(), nBytes);
+        }
+
+    private:
+        bool send(const void *data, size_t size) const {
+            const auto *p = static_cast<const char *>(data);
+            while (size > 0) {
+                const ssize_t n = write(fd, p, size);
+                if (n <= 0) {
+                    std::println(stderr, "Send failed: {}", strerror(errno));
+                    return false;
+                }
+                p += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        bool send32(const uint32_t value) const {
+            unsigned char buf[4];
+            std::memcpy(buf, &value, sizeof(buf));
+            return send(buf, sizeof(buf));
+        }
+
+        bool receive(void *data, size_t size) const {
+            auto *p = static_cast<char *>(data);
+            while (size > 0) {
+                const ssize_t n = read(fd, p, size);
+                if (n <= 0) {
+                    std::println(stderr, "Receive failed: {}", n == 0 ? "EOF" : strerror(errno));
+                    return false;
+                }
+                p += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        int fd = -1;
+        std::vector<unsigned char> request;
+    };
+
+    /*
+     * Workload profiles. Each call appends one client-sized shift to 'vector',
+     * starting and ending in Run-Test/Idle unless noted.
+     */
+    class Profile {
+    public:
+        Profile(std::string name, const uint32_t maxBits, const uint64_t seed): name(std::move(name)),
+            maxBits(maxBits), rng(seed) {
+        }
+
+        bool next(Vector &vector) {
+            vector.clear();
+            if (name == "bitstream") return bitstream(vector);
+            if (name == "ila") return ila(vector);
+            if (name == "idcode") return idcode(vector);
+            if (name == "axi") return axi(vector);
+            if (name == "random") return random(vector);
+            if (name == "mixed") return mixed(vector);
+            return false;
+        }
+
+    private:
+        // Stay in Shift-DR and stream maximum-size vectors, like a configuration download
+        bool bitstream(Vector &vector) {
+            if (!inShiftDr) {
+                vector.tms({1, 1, 1, 1, 1, 0});
+                irScan(vector, 0x05, 6);
+                vector.tms({1, 0, 1, 0, 0});
+                inShiftDr = true;
+            }
+            vector.shift(rng, maxBits - vector.bits, false);
+            return true;
+        }
+
+        // ILA trigger polling: short USER1 IR scan plus a status DR read
+        bool ila(Vector &vector) {
+            irScan(vector, 0x02, 6);
+            vector.tms({1, 0, 1, 0, 0});
+            vector.shift(rng, 64, true);
+            vector.tms({1, 0});
+            return true;
+        }
+
+        // IDCODE scan from Test-Logic-Reset
+        bool idcode(Vector &vector) {
+            vector.tms({1, 1, 1, 1, 1, 0, 1, 0, 0});
+            vector.shift(rng, 32, true);
+            vector.tms({1, 0});
+            return true;
+        }
+
+        // JTAG-to-AXI read: USER4 IR, command DR, then one data DR per word
+        bool axi(Vector &vector) {
+            irScan(vector, 0x23, 6);
+            vector.tms({1, 0, 1, 0, 0});
+            vector.shift(rng, 72, true);
+            for (int word = 0; word < 8; ++word) {
+                vector.tms({1, 1, 0, 0});
+                vector.shift(rng, 34, true);
+            }
+            vector.tms({1, 0});
+            return true;
+        }
+
+        // Random sizes with sparse random TMS transitions
+        bool random(Vector &vector) {
+            const uint32_t bits = 1 + static_cast<uint32_t>(rng() % (maxBits - vector.bits));
+            for (uint32_t i = 0; i < bits; ++i) {
+                vector.add((rng() % 16) == 0, rng() & 1);
+            }
+            return true;
+        }
+
+        bool mixed(Vector &vector) {
+            if (inShiftDr) {
+                // Leave Shift-DR through Update-DR to Run-Test/Idle
+                vector.tms({1, 1, 0});
+                inShiftDr = false;
+            }
+            switch (rng() % 10) {
+                case 0:
+                    return idcode(vector);
+                case 1:
+                case 2:
+                    return axi(vector);
+                case 3:
+                case 4:
+                case 5:
+                    return ila(vector);
+                case 6:
+                    return random(vector);
+                default:
+                    return bitstream(vector);
+            }
+        }
+
+        // From Run-Test/Idle through Shift-IR, shifting 'length' bits and exiting on the last
+        void irScan(Vector &vector, const uint32_t instruction, const int length) {
+            vector.tms({1, 1, 0, 0});
+            for (int i = 0; i < length; ++i) {
+                vector.add(i + 1 == length, (instruction >> i) & 1);
+            }
+        }
+
+        std::string name;
+        uint32_t maxBits;
+        std::mt19937_64 rng;
+        bool inShiftDr = false;
+    };
+
+    struct Result {
+        std::vector<uint64_t> latencyNs;
+        uint64_t bits = 0;
+        uint64_t shifts = 0;
+        bool failed = false;
+    };
+
+    /*
+     * Minimal in-process XVC responder for running without hardware.
+     * TDO mirrors TDI and each shift takes the time its TCK cycles would.
+     */
+    class Simulator {
+    public:
+        Simulator() {
+            listenFd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t len = sizeof(addr);
+            if (listenFd < 0 ||
+                bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+                listen(listenFd, 64) < 0 ||
+                getsockname(listenFd, reinterpret_cast<sockaddr *>(&addr), &len) < 0) {
+                std::println(stderr, "Simulator setup failed: {}", strerror(errno));
+                std::exit(EXIT_FAILURE);
+            }
+            port = ntohs(addr.sin_port);
+            std::thread{[this] { acceptLoop(); }}.detach();
+        }
+
+        int port = 0;
+
+    private:
+        static constexpr uint32_t MAX_VECTOR_BYTES = 1024;
+
+        void acceptLoop() const {
+            while (true) {
+                const int fd = accept(listenFd, nullptr, nullptr);
+                if (fd < 0) {
+                    return;
+                }
+                std::thread{[fd] { serve(fd); }}.detach();
+            }
+        }
+
+        static bool readAll(const int fd, void *data, size_t size) {
+            auto *p = static_cast<char *>(data);
+            while (size > 0) {
+                const ssize_t n = read(fd, p, size);
+                if (n <= 0) return false;
+                p += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        static void serve(const int fd) {
+            std::vector<unsigned char> tms(MAX_VECTOR_BYTES), tdi(MAX_VECTOR_BYTES);
+            uint32_t periodNs = 100;
+            char command[8];
+            while (readAll(fd, command, 2)) {
+                if (command[0] == 'g' && readAll(fd, command, 6)) {
+                    const std::string info = std::format("xvcServer_v1.0:{}\n", MAX_VECTOR_BYTES);
+                    (void) !write(fd, info.data(), info.size());
+                } else if (command[1] == 'e' && readAll(fd, command, 5) && readAll(fd, &periodNs, 4)) {
+                    (void) !write(fd, &periodNs, 4);
+                } else if (command[1] == 'h' && readAll(fd, command, 4)) {
+                    uint32_t bits;
+                    if (!readAll(fd, &bits, 4)) break;
+                    const uint32_t bytes = (bits + 7) / 8;
+                    if (bytes > MAX_VECTOR_BYTES || !readAll(fd, tms.data(), bytes) || !readAll(fd, tdi.data(), bytes)) {
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(static_cast<uint64_t>(bits) * periodNs));
+                    (void) !write(fd, tdi.data(), bytes);
+                } else {
+                    break;
+                }
+            }
+            close(fd);
+        }
+
+        int listenFd = -1;
+    };
+
+    [[noreturn]] void usage(const char *name) {
+        std::println(stderr, "Usage: {} [-a address] [-p port] [-w profile] [-c concurrency] "
+                     "[-t seconds | -n shifts] [-k tck_period_ns] [-s]", name);
+        std::println(stderr, "  profiles: bitstream, ila, idcode, axi, random, mixed");
+        std::exit(EXIT_FAILURE);
+    }
+
+    void worker(const Options &options, const int id, const Clock::time_point deadline, Result &result) {
+        Connection connection(options);
+        const uint32_t maxBytes = connection.getInfo();
+        if (maxBytes == 0) {
+            std::println(stderr, "Bad getinfo reply");
+            result.failed = true;
+            return;
+        }
+        connection.setTck(options.tckPeriodNs);
+
+        Profile profile(options.profile, maxBytes * 8, 0x5eed0000 + id);
+        Vector vector;
+        std::vector<unsigned char> tdo;
+        while (options.iterations ? result.shifts < options.iterations : Clock::now() < deadline) {
+            if (!profile.next(vector)) {
+                std::println(stderr, "Unknown profile \"{}\"", options.profile);
+                result.failed = true;
+                return;
+            }
+            const auto start = Clock::now();
+            if (!connection.shift(vector, tdo)) {
+                result.failed = true;
+                return;
+            }
+            result.latencyNs.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+            result.bits += vector.bits;
+            result.shifts++;
+        }
+    }
+
+    double percentile(const std::vector<uint64_t> &sorted, const double p) {
+        if (sorted.empty()) return 0;
+        const auto index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1) + 0.5);
+        return static_cast<double>(sorted[index]) / 1000.0;
+    }
+}
+
+int main(const int argc, char **argv) {
+    Options options;
+    int option;
+    while ((option = getopt(argc, argv, "a:p:w:c:t:n:k:sh")) != -1) {
+        switch (option) {
+            case 'a': options.host = optarg;
+                break;
+            case 'p': options.port = std::atoi(optarg);
+                break;
+            case 'w': options.profile = optarg;
+                break;
+            case 'c': options.concurrency = std::max(1, std::atoi(optarg));
+                break;
+            case 't': options.seconds = std::atof(optarg);
+                break;
+            case 'n': options.iterations = std::strtoull(optarg, nullptr, 0);
+                break;
+            case 'k': options.tckPeriodNs = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+                break;
+            case 's': options.simulate = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+
+    std::unique_ptr<Simulator> simulator;
+    if (options.simulate) {
+        simulator = std::make_unique<Simulator>();
+        options.host = "127.0.0.1";
+        options.port = simulator->port;
+    }
+
+    std::vector<Result> results(options.concurrency);
+    std::vector<std::thread> threads;
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::duration_cast<Clock::duration>(
+                              std::chrono::duration<double>(options.seconds));
+    for (int i = 0; i < options.concurrency; ++i) {
+        threads.emplace_back(worker, std::cref(options), i, deadline, std::ref(results[i]));
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Result total;
+    for (auto &result: results) {
+        total.latencyNs.insert(total.latencyNs.end(), result.latencyNs.begin(), result.latencyNs.end());
+        total.bits += result.bits;
+        total.shifts += result.shifts;
+        total.failed |= result.failed;
+    }
+    std::ranges::sort(total.latencyNs);
+
+    std::println("     Profile: {} x{}", options.profile, options.concurrency);
+    std::println("      Shifts: {} in {:.2f} s", total.shifts, elapsed);
+    std::println("  Throughput: {:.3f} Mbit/s TCK", static_cast<double>(total.bits) / elapsed / 1e6);
+    std::println(" Latency p50: {:.1f} us", percentile(total.latencyNs, 0.50));
+    std::println(" Latency p99: {:.1f} us", percentile(total.latencyNs, 0.99));
+    std::println("Latency p999: {:.1f} us", percentile(total.latencyNs, 0.999));
+
+    return total.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
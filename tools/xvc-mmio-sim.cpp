@@ -0,0 +1,123 @@
+/*
+ * Software model of a Xilinx debug_bridge JTAG controller: maps a file
+ * shared with xvcnd --mmio, watches the control register and services
+ * each started word against one modelled TAP, so the memory-mapped path
+ * can be exercised without PCIe or Zynq hardware. Reports words and TCKs
+ * per second once a second while busy.
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <string>
+#include "TapModel.h"
+
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::string path = "/dev/shm/xvc-mmio";
+        uint32_t idcode = 0x13631093;
+    };
+
+    // Same layout as the debug_bridge, in words
+    constexpr int REG_LENGTH = 0;
+    constexpr int REG_TMS = 1;
+    constexpr int REG_TDI = 2;
+    constexpr int REG_TDO = 3;
+    constexpr int REG_CONTROL = 4;
+    constexpr uint32_t CONTROL_START = 0x01;
+    constexpr size_t WINDOW_SIZE = 4096;
+
+    // Give the CPU back after this many empty polls
+    constexpr int IDLE_SPINS = 256;
+
+    [[noreturn]] void usage(const char *name) {
+        std::println(stderr, "Usage: {} [-f file] [-i idcode]", name);
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+int main(const int argc, char **argv) {
+    Options options;
+    int option;
+    while ((option = getopt(argc, argv, "f:i:h")) != -1) {
+        switch (option) {
+            case 'f': options.path = optarg;
+                break;
+            case 'i': options.idcode = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+
+    const int fd = open(options.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, WINDOW_SIZE) < 0) {
+        std::println(stderr, "Can't create {}: {}", options.path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    void *mapping = mmap(nullptr, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::println(stderr, "Can't map {}: {}", options.path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    auto *registers = static_cast<volatile uint32_t *>(mapping);
+    std::println("debug_bridge model at {}@0x0, IDCODE {:08x}", options.path, options.idcode);
+    std::fflush(stdout);
+
+    // The TAP keeps its state across clients, as the hardware would
+    Tap tap(options.idcode);
+    uint64_t words = 0;
+    uint64_t tcks = 0;
+    auto reported = Clock::now();
+    int idle = 0;
+
+    while (true) {
+        if (!(registers[REG_CONTROL] & CONTROL_START)) {
+            if (++idle == IDLE_SPINS) {
+                idle = 0;
+                sched_yield();
+                if (words && Clock::now() - reported >= std::chrono::seconds(1)) {
+                    const double seconds = std::chrono::duration<double>(Clock::now() - reported).count();
+                    std::println("{} words, {:.0f} TCK/s", words, tcks / seconds);
+                    std::fflush(stdout);
+                    words = 0;
+                    tcks = 0;
+                    reported = Clock::now();
+                }
+            }
+            continue;
+        }
+        idle = 0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        const uint32_t length = std::min(static_cast<uint32_t>(registers[REG_LENGTH]), 32u);
+        const uint32_t tms = registers[REG_TMS];
+        const uint32_t tdi = registers[REG_TDI];
+        uint32_t tdo = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            tdo |= static_cast<uint32_t>(tap.tdo()) << i;
+            tap.rise(tms >> i & 1, tdi >> i & 1);
+        }
+        registers[REG_TDO] = tdo;
+        std::atomic_thread_fence(std::memory_order_release);
+        registers[REG_CONTROL] = 0;
+
+        words++;
+        tcks += length;
+    }
+}
@@ -0,0 +1,172 @@
+/*
+ * Prints the GPIO pin samples xvcnd --pin-sampler takes, from its ring
+ * file or from its TCP port, one line per sample: time, both pin bytes
+ * and the time since the line before.
+ */
+#include <getopt.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <print>
+#include <string>
+#include <thread>
+#include "PinSampler.h"
+
+
+namespace {
+    using Sample = PinSampler::Sample;
+    using RingHeader = PinSampler::RingHeader;
+
+    struct Options {
+        bool changesOnly = false;
+        bool follow = false;
+        uint64_t count = UINT64_MAX;
+    };
+
+    class Printer {
+    public:
+        explicit Printer(const Options &options): options(options) {
+        }
+
+        // False once 'count' lines are out
+        bool print(const Sample &sample) {
+            if (sample.lost) {
+                std::println("-- {} samples lost", sample.lost);
+            }
+            if (options.changesOnly && printed && sample.low == last.low && sample.high == last.high) {
+                return true;
+            }
+            const double deltaUs = printed ? static_cast<double>(sample.timestampNs - last.timestampNs) / 1000 : 0;
+            std::println("{}.{:09} low {:02x} high {:02x} +{:.1f}us", sample.timestampNs / 1'000'000'000,
+                         sample.timestampNs % 1'000'000'000, sample.low, sample.high, deltaUs);
+            last = sample;
+            return ++printed < options.count;
+        }
+
+    private:
+        const Options &options;
+        Sample last{};
+        uint64_t printed = 0;
+    };
+
+    [[noreturn]] void usage(const char *name) {
+        std::println(stderr, "Usage: {} [-e] [-f] [-n count] ringfile | host:port", name);
+        std::println(stderr, "  -e  only samples where a pin changed\n  -f  keep reading new samples from the ring");
+        std::exit(EXIT_FAILURE);
+    }
+
+    int dumpRing(const std::string &path, const Options &options) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        struct stat status{};
+        if (fd < 0 || fstat(fd, &status) < 0 || static_cast<size_t>(status.st_size) < sizeof(RingHeader)) {
+            std::println(stderr, "Can't read {}: {}", path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            std::println(stderr, "Can't map {}: {}", path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        auto *header = static_cast<RingHeader *>(mapping);
+        const auto *samples = reinterpret_cast<const Sample *>(header + 1);
+        if (std::memcmp(header->magic, PinSampler::MAGIC, sizeof(PinSampler::MAGIC)) != 0 ||
+            header->version != PinSampler::VERSION ||
+            sizeof(RingHeader) + header->capacity * sizeof(Sample) > static_cast<size_t>(status.st_size)) {
+            std::println(stderr, "{} is not a pin sample ring", path);
+            return EXIT_FAILURE;
+        }
+
+        Printer printer(options);
+        const uint64_t capacity = header->capacity;
+        uint64_t written = std::atomic_ref(header->written).load(std::memory_order_acquire);
+        // The oldest slot is the next one written, so start after it
+        uint64_t next = written >= capacity ? written - capacity + 1 : 0;
+        while (true) {
+            while (next < written) {
+                const Sample sample = samples[next % capacity];
+                // The writer may have started on this slot again while it was copied
+                const uint64_t now = std::atomic_ref(header->written).load(std::memory_order_acquire);
+                if (now - next >= capacity) {
+                    std::println("-- {} samples overwritten", now - capacity + 1 - next);
+                    next = now - capacity + 1;
+                    written = now;
+                    continue;
+                }
+                if (!printer.print(sample)) {
+                    return EXIT_SUCCESS;
+                }
+                next++;
+            }
+            if (!options.follow) {
+                return EXIT_SUCCESS;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            written = std::atomic_ref(header->written).load(std::memory_order_acquire);
+        }
+    }
+
+    int dumpStream(const std::string &address, const Options &options) {
+        const auto colon = address.rfind(':');
+        const std::string host = address.substr(0, colon);
+        const std::string port = address.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo *result = nullptr;
+        if (const int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &result); rc != 0) {
+            std::println(stderr, "Bad address \"{}\": {}", address, gai_strerror(rc));
+            return EXIT_FAILURE;
+        }
+        const int fd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+        if (fd < 0 || connect(fd, result->ai_addr, result->ai_addrlen) < 0) {
+            std::println(stderr, "Can't connect to {}: {}", address, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        freeaddrinfo(result);
+
+        Printer printer(options);
+        Sample sample{};
+        while (recv(fd, &sample, sizeof(sample), MSG_WAITALL) == sizeof(sample)) {
+            if (!printer.print(sample)) {
+                break;
+            }
+        }
+        close(fd);
+        return EXIT_SUCCESS;
+    }
+}
+
+int main(const int argc, char **argv) {
+    Options options;
+    int option;
+    while ((option = getopt(argc, argv, "efn:h")) != -1) {
+        switch (option) {
+            case 'e': options.changesOnly = true;
+                break;
+            case 'f': options.follow = true;
+                break;
+            case 'n': options.count = std::strtoull(optarg, nullptr, 0);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+
+    // An existing file is a ring, anything else with a colon an xvcnd to connect to
+    const std::string target = argv[optind];
+    if (access(target.c_str(), F_OK) != 0 && target.find(':') != std::string::npos) {
+        return dumpStream(target, options);
+    }
+    return dumpRing(target, options);
+}
@@ -0,0 +1,134 @@
+/*
+ * Offline formatter for binary traces written by xvcnd -T.
+ * With -P, replays the recorded TMS/TDI vectors through the shift planner
+ * and compares its wire bytes per bit with the old greedy encoder.
+ */
+#include <getopt.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <print>
+#include <string>
+#include <vector>
+#include "TraceLog.h"
+#include "ShiftPlanner.h"
+
+
+static void usage(const char *name) {
+    std::println(stderr, "Usage: {} [-a] [-n bytes] [-t tag] [-P] tracefile", name);
+    std::exit(EXIT_FAILURE);
+}
+
+int main(const int argc, char **argv) {
+    uint32_t maxBytes = 40;
+    std::string tagFilter;
+    bool planReport = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "an:t:Ph")) != -1) {
+        switch (option) {
+            case 'a':
+                maxBytes = UINT32_MAX;
+                break;
+            case 'n':
+                maxBytes = static_cast<uint32_t>(std::strtoul(optarg, nullptr, 0));
+                break;
+            case 't':
+                tagFilter = optarg;
+                break;
+            case 'P':
+                planReport = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+    }
+
+    FILE *fp = std::fopen(argv[optind], "rb");
+    if (fp == nullptr) {
+        std::println(stderr, "Can't open \"{}\": {}", argv[optind], std::strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    TraceLog::FileHeader fileHeader{};
+    if (std::fread(&fileHeader, sizeof(fileHeader), 1, fp) != 1 ||
+        std::memcmp(fileHeader.magic, TraceLog::MAGIC, sizeof(fileHeader.magic)) != 0) {
+        std::println(stderr, "\"{}\" is not an xvcnd trace", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (fileHeader.version != TraceLog::VERSION) {
+        std::println(stderr, "Unsupported trace version {}", fileHeader.version);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<unsigned char> data;
+    TraceLog::RecordHeader header{};
+    uint64_t records = 0;
+
+    // -P: TMS is recorded just before the TDI of the same shift
+    ShiftPlanner planner;
+    std::vector<ShiftPlanner::Op> ops;
+    std::vector<unsigned char> tms;
+    uint64_t planBits = 0, plannedBytes = 0, greedyBytes = 0, vectors = 0;
+    while (std::fread(&header, sizeof(header), 1, fp) == 1) {
+        data.resize(header.captured);
+        if (std::fread(data.data(), 1, header.captured, fp) != header.captured) {
+            std::println(stderr, "Truncated record {}", records);
+            return EXIT_FAILURE;
+        }
+        records++;
+
+        const std::string tag(header.tag, strnlen(header.tag, sizeof(header.tag)));
+        if (planReport) {
+            if (tag == "TMS") {
+                tms = data;
+            } else if (tag == "TDI" && tms.size() == data.size() && !data.empty()) {
+                // Byte-granular: the trace does not keep the exact bit count
+                const auto bits = static_cast<uint32_t>(data.size() * 8);
+                planner.plan(tms.data(), data.data(), 0, bits, ops);
+                for (const auto &op: ops) {
+                    plannedBytes += ShiftPlanner::txBytes(op) + ShiftPlanner::rxBytes(op);
+                }
+                greedyBytes += ShiftPlanner::greedyCost(tms.data(), data.data(), bits);
+                planBits += bits;
+                vectors++;
+                tms.clear();
+            }
+            continue;
+        }
+        if (!tagFilter.empty() && tag != tagFilter) {
+            continue;
+        }
+
+        const time_t seconds = static_cast<time_t>(header.timestampNs / 1000000000);
+        tm local{};
+        localtime_r(&seconds, &local);
+        char stamp[16];
+        std::strftime(stamp, sizeof(stamp), "%H:%M:%S", &local);
+
+        std::string line;
+        const uint32_t shown = std::min(header.captured, maxBytes);
+        for (uint32_t i = 0; i < shown; ++i) {
+            line += std::format(" {:02x}", data[i]);
+        }
+        std::println("{}.{:09} {}{}:{}", stamp, header.timestampNs % 1000000000, tag, header.size, line);
+    }
+
+    std::fclose(fp);
+
+    if (planReport) {
+        if (planBits == 0) {
+            std::println(stderr, "No TMS/TDI records; capture with xvcnd -X -T");
+            return EXIT_FAILURE;
+        }
+        std::println("{} vectors, {} bits", vectors, planBits);
+        std::println("  greedy: {} bytes, {:.3f} bytes/bit", greedyBytes, static_cast<double>(greedyBytes) / planBits);
+        std::println(" planned: {} bytes, {:.3f} bytes/bit", plannedBytes,
+                     static_cast<double>(plannedBytes) / planBits);
+    }
+    return EXIT_SUCCESS;
+}